@@ -0,0 +1,24 @@
+#!/bin/sh
+# Loopback throughput of the event-loop backends: starts ircserv with each
+# backend in turn (flood control lifted) and drives it with the same ircbench
+# run, a fanout-heavy one by default.
+#
+# Usage: bench/compare_backends.sh [port] [ircbench options...]
+#        make bench_backends
+
+PORT=${1:-6668}
+[ $# -gt 0 ] && shift
+OPTIONS=${*:--c 500 -C 5 -r 5000 -d 10}
+PASSWORD=bench
+
+for backend in poll epoll io_uring; do
+	IRCSERV_EVENT_BACKEND=$backend IRCSERV_FLOOD_MESSAGE=0:0:0:0 IRCSERV_FLOOD_CHANNEL=0:0:0:0 \
+		IRCSERV_LOG_LEVEL=error ./ircserv "$PORT" "$PASSWORD" &
+	server=$!
+	sleep 0.5
+	echo "=== $backend"
+	# shellcheck disable=SC2086
+	./ircbench "$PORT" "$PASSWORD" $OPTIONS | grep -E "^(throughput|deliveries|delivery latency)"
+	kill -INT "$server"
+	wait "$server" 2>/dev/null
+done
@@ -0,0 +1,508 @@
+// ircbench: multi-connection load generator for ircserv.
+//
+// Opens <connections> non-blocking connections to a server on loopback,
+// registers every one of them (PASS / NICK / USER), joins each to <joins>
+// channels out of <channels>, then sends PRIVMSGs to those channels at a
+// fixed total rate for <duration> seconds. Every message carries its send
+// time, so each receiver measures the end-to-end delivery latency.
+//
+// Everything runs in one thread on one epoll instance, which is enough to
+// saturate a single-reactor server from the same box.
+//
+// Usage: ./ircbench <port> <password> [-c connections] [-C channels] [-j joins]
+//                   [-r messages/s] [-d seconds] [-p parallel connects] [-n nick prefix]
+
+#include "../includes/Metrics.hpp" // For LatencyHistogram
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#define READ_CHUNK 65536
+#define MAX_PENDING_OUTPUT (64 * 1024) // A sender with more unsent bytes skips its turn
+#define DRAIN_SECONDS 2 // How long to wait for the last deliveries after the traffic stops
+
+struct BenchOptions
+{
+	int port = 0;
+	std::string password;
+	size_t connections = 1000;
+	size_t channels = 10;
+	size_t joins = 1; // Channels joined by every connection
+	size_t rate = 10000; // PRIVMSGs per second, all connections together
+	double duration = 10;
+	size_t parallel_connects = 256; // Connections being established at the same time
+	std::string nick_prefix = "bench";
+};
+
+enum ConnectionState
+{
+	CONN_CONNECTING,
+	CONN_REGISTERING,
+	CONN_JOINING,
+	CONN_READY,
+	CONN_CLOSED
+};
+
+struct Connection
+{
+	int fd = -1;
+	ConnectionState state = CONN_CONNECTING;
+	std::string nick;
+	std::string input;
+	std::string output;
+	size_t joins_seen = 0;
+	uint64_t connect_started = 0;
+	uint64_t connected_at = 0;
+};
+
+struct BenchStats
+{
+	size_t connected = 0;
+	size_t registered = 0;
+	size_t failed = 0;
+	uint64_t messages_sent = 0;
+	uint64_t messages_skipped = 0; // The sender's output was backed up
+	uint64_t deliveries = 0;
+	uint64_t expected_deliveries = 0;
+	LatencyHistogram connect_latency;
+	LatencyHistogram registration_latency;
+	LatencyHistogram delivery_latency;
+};
+
+class IrcBench
+{
+	private:
+		BenchOptions _options;
+		int _epoll_fd;
+		std::vector<Connection> _connections;
+		std::vector<size_t> _members; // Members of each channel
+		BenchStats _stats;
+		size_t _next_to_connect;
+		size_t _in_progress;
+
+		static void print_histogram(const char* name, const LatencyHistogram& histogram);
+		std::string channel_name(size_t connection, size_t join) const;
+		void start_connect(size_t index);
+		void watch(size_t index, uint32_t events, int op);
+		void on_connected(size_t index);
+		void close_connection(size_t index);
+		void queue(size_t index, const std::string& data);
+		void flush(size_t index);
+		void read_input(size_t index);
+		void handle_line(size_t index, const std::string& line);
+		void poll_once(int timeout_ms);
+		void connect_all();
+		void join_all();
+		void send_traffic();
+
+	public:
+		explicit IrcBench(const BenchOptions& options);
+		~IrcBench();
+		void run();
+		void report(double connect_seconds, double traffic_seconds) const;
+};
+
+IrcBench::IrcBench(const BenchOptions& options)
+	: _options(options), _epoll_fd(epoll_create1(EPOLL_CLOEXEC)), _connections(options.connections),
+	_members(options.channels, 0), _next_to_connect(0), _in_progress(0)
+{
+	if (_epoll_fd < 0)
+		throw std::runtime_error(std::string("epoll_create1: ") + std::strerror(errno));
+	for (size_t i = 0; i < _connections.size(); ++i)
+		_connections[i].nick = _options.nick_prefix + std::to_string(i);
+}
+
+IrcBench::~IrcBench()
+{
+	for (Connection& connection : _connections)
+	{
+		if (connection.fd >= 0)
+			close(connection.fd);
+	}
+	close(_epoll_fd);
+}
+
+std::string IrcBench::channel_name(size_t connection, size_t join) const
+{
+	return "#bench" + std::to_string((connection + join) % _options.channels);
+}
+
+void IrcBench::watch(size_t index, uint32_t events, int op)
+{
+	epoll_event event;
+	event.events = events;
+	event.data.u64 = index;
+	epoll_ctl(_epoll_fd, op, _connections[index].fd, &event);
+}
+
+void IrcBench::start_connect(size_t index)
+{
+	Connection& connection = _connections[index];
+	connection.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (connection.fd < 0)
+		throw std::runtime_error(std::string("socket: ") + std::strerror(errno));
+	int one = 1;
+	setsockopt(connection.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	sockaddr_in addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(_options.port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	connection.connect_started = Metrics::now_ns();
+	++_in_progress;
+	if (connect(connection.fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 && errno != EINPROGRESS)
+	{
+		close_connection(index);
+		return ;
+	}
+	// Writable once the handshake is done
+	watch(index, EPOLLOUT, EPOLL_CTL_ADD);
+}
+
+void IrcBench::on_connected(size_t index)
+{
+	Connection& connection = _connections[index];
+	int error = 0;
+	socklen_t length = sizeof(error);
+	getsockopt(connection.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+	if (error != 0)
+	{
+		close_connection(index);
+		return ;
+	}
+	--_in_progress;
+	++_stats.connected;
+	connection.connected_at = Metrics::now_ns();
+	_stats.connect_latency.record(connection.connected_at - connection.connect_started);
+	connection.state = CONN_REGISTERING;
+	watch(index, EPOLLIN, EPOLL_CTL_MOD);
+	queue(index, "PASS " + _options.password + "\r\nNICK " + connection.nick + "\r\nUSER " + connection.nick + " 0 * :ircbench\r\n");
+}
+
+void IrcBench::close_connection(size_t index)
+{
+	Connection& connection = _connections[index];
+	if (connection.state == CONN_CONNECTING)
+		--_in_progress;
+	if (connection.state != CONN_READY)
+		++_stats.failed;
+	if (connection.fd >= 0)
+		close(connection.fd);
+	connection.fd = -1;
+	connection.state = CONN_CLOSED;
+}
+
+void IrcBench::queue(size_t index, const std::string& data)
+{
+	Connection& connection = _connections[index];
+	bool was_empty = connection.output.empty();
+	connection.output += data;
+	if (was_empty)
+		flush(index);
+}
+
+void IrcBench::flush(size_t index)
+{
+	Connection& connection = _connections[index];
+	if (connection.output.empty() || connection.fd < 0)
+		return ;
+	ssize_t n = send(connection.fd, connection.output.data(), connection.output.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+	{
+		close_connection(index);
+		return ;
+	}
+	if (n > 0)
+		connection.output.erase(0, static_cast<size_t>(n));
+	// Ask for a write event only while something is left
+	watch(index, connection.output.empty() ? EPOLLIN : (EPOLLIN | EPOLLOUT), EPOLL_CTL_MOD);
+}
+
+void IrcBench::read_input(size_t index)
+{
+	char buffer[READ_CHUNK];
+	while (_connections[index].fd >= 0)
+	{
+		ssize_t n = recv(_connections[index].fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+		if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+		{
+			close_connection(index);
+			return ;
+		}
+		if (n < 0)
+			return ;
+		Connection& connection = _connections[index];
+		connection.input.append(buffer, static_cast<size_t>(n));
+		size_t start = 0;
+		size_t newline;
+		while ((newline = connection.input.find('\n', start)) != std::string::npos)
+		{
+			handle_line(index, connection.input.substr(start, newline - start));
+			start = newline + 1;
+		}
+		_connections[index].input.erase(0, start);
+	}
+}
+
+void IrcBench::handle_line(size_t index, const std::string& line)
+{
+	Connection& connection = _connections[index];
+	uint64_t now = Metrics::now_ns();
+	size_t privmsg = line.find(" PRIVMSG ");
+	if (privmsg != std::string::npos)
+	{
+		// ":nick!user@host PRIVMSG #chan :<send time in ns> <payload>"
+		size_t text = line.find(" :", privmsg);
+		if (text != std::string::npos)
+		{
+			uint64_t sent_at = std::strtoull(line.c_str() + text + 2, NULL, 10);
+			if (sent_at > 0 && sent_at <= now)
+				_stats.delivery_latency.record(now - sent_at);
+		}
+		++_stats.deliveries;
+		return ;
+	}
+	if (connection.state == CONN_REGISTERING && line.find("Welcome to the server, ") != std::string::npos)
+	{
+		connection.state = CONN_JOINING;
+		++_stats.registered;
+		_stats.registration_latency.record(now - connection.connected_at);
+		return ;
+	}
+	// Not anchored at the start of the line: the server's colored replies end
+	// with an escape sequence after their CRLF, which lands before the next line
+	if (connection.state == CONN_JOINING && line.find(" JOIN ") != std::string::npos
+		&& line.find(":" + connection.nick + "!") != std::string::npos)
+	{
+		if (++connection.joins_seen == _options.joins)
+			connection.state = CONN_READY;
+	}
+}
+
+void IrcBench::poll_once(int timeout_ms)
+{
+	epoll_event events[1024];
+	int count = epoll_wait(_epoll_fd, events, 1024, timeout_ms);
+	if (count < 0 && errno != EINTR)
+		throw std::runtime_error(std::string("epoll_wait: ") + std::strerror(errno));
+	for (int i = 0; i < count; ++i)
+	{
+		size_t index = events[i].data.u64;
+		if (_connections[index].fd < 0)
+			continue;
+		if (_connections[index].state == CONN_CONNECTING)
+		{
+			on_connected(index);
+			continue;
+		}
+		if (events[i].events & EPOLLOUT)
+			flush(index);
+		if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+			read_input(index);
+	}
+}
+
+// Establishes and registers every connection, at most parallel_connects at a time
+void IrcBench::connect_all()
+{
+	uint64_t last_progress = Metrics::now_ns();
+	size_t last_registered = 0;
+	while (_stats.registered + _stats.failed < _connections.size())
+	{
+		while (_next_to_connect < _connections.size() && _in_progress < _options.parallel_connects)
+			start_connect(_next_to_connect++);
+		poll_once(100);
+		if (_stats.registered != last_registered)
+		{
+			last_registered = _stats.registered;
+			last_progress = Metrics::now_ns();
+		}
+		else if (Metrics::now_ns() - last_progress > 10000000000ULL)
+			throw std::runtime_error("no registration progress for 10 seconds");
+	}
+}
+
+void IrcBench::join_all()
+{
+	for (size_t i = 0; i < _connections.size(); ++i)
+	{
+		if (_connections[i].state != CONN_JOINING)
+			continue;
+		std::string channels;
+		for (size_t j = 0; j < _options.joins; ++j)
+		{
+			channels += (j ? "," : "") + channel_name(i, j);
+			++_members[(i + j) % _options.channels];
+		}
+		queue(i, "JOIN " + channels + "\r\n");
+	}
+	uint64_t deadline = Metrics::now_ns() + 10000000000ULL;
+	while (Metrics::now_ns() < deadline)
+	{
+		size_t joining = 0;
+		for (const Connection& connection : _connections)
+			joining += (connection.state == CONN_JOINING);
+		if (joining == 0)
+			return ;
+		poll_once(100);
+	}
+	throw std::runtime_error("JOIN did not complete within 10 seconds");
+}
+
+// Sends rate messages per second, spread over the senders in turn
+void IrcBench::send_traffic()
+{
+	std::vector<size_t> senders;
+	for (size_t i = 0; i < _connections.size(); ++i)
+	{
+		if (_connections[i].state == CONN_READY)
+			senders.push_back(i);
+	}
+	if (senders.empty())
+		throw std::runtime_error("no connection is ready to send");
+	uint64_t start = Metrics::now_ns();
+	uint64_t end = start + static_cast<uint64_t>(_options.duration * 1e9);
+	uint64_t due = 0;
+	size_t turn = 0;
+	uint64_t now;
+	while ((now = Metrics::now_ns()) < end)
+	{
+		due = static_cast<uint64_t>((now - start) / 1e9 * _options.rate);
+		while (_stats.messages_sent + _stats.messages_skipped < due)
+		{
+			size_t index = senders[turn++ % senders.size()];
+			Connection& connection = _connections[index];
+			if (connection.fd < 0 || connection.output.size() > MAX_PENDING_OUTPUT)
+			{
+				++_stats.messages_skipped;
+				continue;
+			}
+			size_t channel = index % _options.channels;
+			queue(index, "PRIVMSG " + channel_name(index, 0) + " :" + std::to_string(Metrics::now_ns())
+				+ " The quick brown fox jumps over the lazy dog\r\n");
+			++_stats.messages_sent;
+			// The server does not echo channel messages to their sender
+			_stats.expected_deliveries += _members[channel] - 1;
+		}
+		poll_once(1);
+	}
+	// Let the last messages arrive
+	uint64_t drain_end = Metrics::now_ns() + DRAIN_SECONDS * 1000000000ULL;
+	while (_stats.deliveries < _stats.expected_deliveries && Metrics::now_ns() < drain_end)
+		poll_once(10);
+}
+
+void IrcBench::run()
+{
+	uint64_t start = Metrics::now_ns();
+	connect_all();
+	double connect_seconds = (Metrics::now_ns() - start) / 1e9;
+	join_all();
+	uint64_t traffic_start = Metrics::now_ns();
+	send_traffic();
+	report(connect_seconds, (Metrics::now_ns() - traffic_start) / 1e9);
+}
+
+void IrcBench::print_histogram(const char* name, const LatencyHistogram& histogram)
+{
+	std::printf("%-22s count %-9llu p50 %9.1f  p90 %9.1f  p99 %9.1f  p99.9 %9.1f  max %9.1f us\n", name,
+		static_cast<unsigned long long>(histogram.count()), histogram.percentile(0.5) / 1e3, histogram.percentile(0.9) / 1e3,
+		histogram.percentile(0.99) / 1e3, histogram.percentile(0.999) / 1e3, histogram.max() / 1e3);
+}
+
+void IrcBench::report(double connect_seconds, double traffic_seconds) const
+{
+	std::printf("connections:           %zu requested, %zu connected, %zu registered, %zu failed\n",
+		_options.connections, _stats.connected, _stats.registered, _stats.failed);
+	std::printf("connection rate:       %.0f registered connections/s\n", _stats.registered / connect_seconds);
+	print_histogram("connect latency", _stats.connect_latency);
+	print_histogram("registration latency", _stats.registration_latency);
+	std::printf("channels:              %zu, joined %zu per connection\n", _options.channels, _options.joins);
+	std::printf("messages:              %llu sent (target %zu/s), %llu skipped on backed-up senders\n",
+		static_cast<unsigned long long>(_stats.messages_sent), _options.rate, static_cast<unsigned long long>(_stats.messages_skipped));
+	std::printf("throughput:            %.0f messages/s, %.0f deliveries/s\n",
+		_stats.messages_sent / traffic_seconds, _stats.deliveries / traffic_seconds);
+	std::printf("deliveries:            %llu of %llu expected\n",
+		static_cast<unsigned long long>(_stats.deliveries), static_cast<unsigned long long>(_stats.expected_deliveries));
+	print_histogram("delivery latency", _stats.delivery_latency);
+}
+
+// Thousands of connections need as many fds
+static void raise_fd_limit(size_t connections)
+{
+	rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+		return ;
+	rlim_t wanted = connections + 64;
+	if (limit.rlim_cur < wanted)
+	{
+		limit.rlim_cur = (limit.rlim_max < wanted) ? limit.rlim_max : wanted;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+	if (limit.rlim_cur < wanted)
+		std::cerr << "ircbench: warning: fd limit " << limit.rlim_cur << " is too low for " << connections << " connections" << std::endl;
+}
+
+static void usage(const char* name)
+{
+	std::cerr << "Usage: " << name << " <port> <password> [-c connections] [-C channels] [-j joins]"
+		<< " [-r messages/s] [-d seconds] [-p parallel connects] [-n nick prefix]" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	BenchOptions options;
+	int opt;
+	while ((opt = getopt(argc, argv, "c:C:j:r:d:p:n:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'c': options.connections = std::strtoul(optarg, NULL, 10); break;
+			case 'C': options.channels = std::strtoul(optarg, NULL, 10); break;
+			case 'j': options.joins = std::strtoul(optarg, NULL, 10); break;
+			case 'r': options.rate = std::strtoul(optarg, NULL, 10); break;
+			case 'd': options.duration = std::strtod(optarg, NULL); break;
+			case 'p': options.parallel_connects = std::strtoul(optarg, NULL, 10); break;
+			case 'n': options.nick_prefix = optarg; break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+	if (argc - optind != 2)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+	options.port = std::atoi(argv[optind]);
+	options.password = argv[optind + 1];
+	if (options.connections == 0 || options.channels == 0 || options.joins == 0 || options.joins > options.channels
+		|| options.parallel_connects == 0 || options.duration <= 0)
+	{
+		std::cerr << "ircbench: invalid arguments" << std::endl;
+		return 1;
+	}
+	raise_fd_limit(options.connections);
+	try
+	{
+		IrcBench bench(options);
+		bench.run();
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "ircbench: " << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,275 @@
+// Micro-benchmarks of the server's hot paths, linked against the server objects.
+//
+//   framing:   Client::read_from_socket + extract_output_line on mixed line sizes
+//   parsing:   parse_irc_message + lookup_command, as done by dispatch_command
+//   nicknames: NicknameIndex::find, as done by is_duplicate_nickname
+//   fanout:    Channel::broadcast_message to 10 .. 10k members over socketpairs
+//
+// Every benchmark prints ns/op and heap allocations/op (operator new is
+// counted below). Run it with "make bench".
+
+#include "../includes/Server.hpp"
+#include "../includes/PollLoop.hpp"
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+
+#define MIN_BENCH_NS 200000000ULL // Each benchmark runs for at least 0.2 s
+#define MEMBERS_PER_SOCKET 64 // Fanout members sharing one socketpair (through dup()), to stay under the fd limit
+#define BROADCASTS_PER_DRAIN 4 // Broadcasts between two drains of the peers, must fit in a socket buffer
+
+static size_t g_allocations = 0;
+
+void* operator new(size_t size)
+{
+	++g_allocations;
+	if (void* pointer = std::malloc(size ? size : 1))
+		return pointer;
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* pointer) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept
+{
+	std::free(pointer);
+}
+
+// Keeps the optimizer from dropping a result
+template <typename T>
+static void keep(const T& value)
+{
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+static uint64_t now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void report(const char* name, uint64_t elapsed_ns, uint64_t ops, size_t allocations)
+{
+	std::printf("%-32s %12.1f ns/op %10.2f allocs/op %12llu ops\n", name, static_cast<double>(elapsed_ns) / ops,
+		static_cast<double>(allocations) / ops, static_cast<unsigned long long>(ops));
+}
+
+// Runs body(batch) until MIN_BENCH_NS elapsed; body returns the number of ops it did
+template <typename Body>
+static void run_bench(const char* name, Body body)
+{
+	body(); // Warm-up: caches, lazy buffers
+	uint64_t ops = 0;
+	size_t allocations_before = g_allocations;
+	uint64_t start = now_ns();
+	uint64_t elapsed = 0;
+	while (elapsed < MIN_BENCH_NS)
+	{
+		ops += body();
+		elapsed = now_ns() - start;
+	}
+	report(name, elapsed, ops, g_allocations - allocations_before);
+}
+
+static std::vector<std::string> sample_lines(size_t count)
+{
+	static const char* const templates[] = {
+		"PING :ircserv",
+		"NICK alice",
+		"JOIN #general,#random",
+		"PRIVMSG #general :hello there",
+		"PRIVMSG bob :The quick brown fox jumps over the lazy dog, again and again and again and again",
+		"USER alice 0 * :Alice Liddell",
+		":alice!alice@127.0.0.1 PRIVMSG #general :a longer message that pads the line a bit more so the framing has to look further for its newline, as chat lines of a few hundred bytes are common enough",
+		"PART #random :bye",
+	};
+	std::vector<std::string> lines;
+	std::mt19937 random(42);
+	for (size_t i = 0; i < count; ++i)
+		lines.push_back(templates[random() % (sizeof(templates) / sizeof(templates[0]))]);
+	return lines;
+}
+
+static void bench_framing(EventLoop& loop)
+{
+	int fds[2];
+	// Non-blocking, as the server's accepted sockets are
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) < 0)
+		throw std::runtime_error("socketpair failed");
+	loop.add(fds[0], EVENT_READ);
+	Client client(fds[0], &loop);
+	std::string stream;
+	size_t lines_per_batch = 0;
+	for (const std::string& line : sample_lines(1000))
+	{
+		if (stream.size() + line.size() + 2 > 16384)
+			break;
+		stream += line + "\r\n";
+		++lines_per_batch;
+	}
+	run_bench("framing (per line)", [&]() -> uint64_t {
+		if (write(fds[1], stream.data(), stream.size()) != static_cast<ssize_t>(stream.size()))
+			throw std::runtime_error("short write on socketpair");
+		size_t lines = 0;
+		while (lines < lines_per_batch && client.read_from_socket() > 0)
+		{
+			std::string_view line;
+			while (client.extract_output_line(line))
+			{
+				keep(line.size());
+				++lines;
+			}
+		}
+		client.compact_input();
+		return lines;
+	});
+	loop.remove(fds[0]);
+	close(fds[1]);
+}
+
+static void bench_parsing()
+{
+	std::vector<std::string> lines = sample_lines(1024);
+	run_bench("parse + command lookup", [&]() -> uint64_t {
+		for (const std::string& line : lines)
+		{
+			IrcMessage msg;
+			if (parse_irc_message(line, msg))
+				keep(lookup_command(msg.command));
+		}
+		return lines.size();
+	});
+}
+
+static void bench_nicknames()
+{
+	NicknameIndex index;
+	std::vector<std::string> lookups;
+	for (int i = 0; i < 10000; ++i)
+	{
+		std::string nick = "User" + std::to_string(i);
+		index.insert(nick, i + 10);
+		// Half of the lookups hit with another case, half miss
+		lookups.push_back((i % 2) ? "uSER" + std::to_string(i) : "Nobody" + std::to_string(i));
+	}
+	run_bench("nickname lookup (10k nicks)", [&]() -> uint64_t {
+		for (const std::string& nick : lookups)
+			keep(index.find(nick));
+		return lookups.size();
+	});
+}
+
+static void bench_fanout(EventLoop& loop, size_t members)
+{
+	ClientTable clients;
+	std::vector<int> peers;
+	ChannelRegistry registry;
+	bool created;
+	Channel* channel = registry.find_or_create("#bench", clients, created);
+	int shared_fd = -1;
+	for (size_t i = 0; i < members; ++i)
+	{
+		// Every member has its own fd (and Client), but MEMBERS_PER_SOCKET of
+		// them write into the same socketpair, read back by one peer
+		int client_fd;
+		if (i % MEMBERS_PER_SOCKET == 0)
+		{
+			int fds[2];
+			if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) < 0)
+				throw std::runtime_error("socketpair failed (fd limit?)");
+			shared_fd = client_fd = fds[0];
+			peers.push_back(fds[1]);
+		}
+		else if ((client_fd = dup(shared_fd)) < 0)
+			throw std::runtime_error("dup failed (fd limit?)");
+		loop.add(client_fd, EVENT_READ);
+		clients.emplace(client_fd, client_fd, &loop);
+		channel->add_client(client_fd);
+	}
+	std::string line = ":alice!alice@127.0.0.1 PRIVMSG #bench :The quick brown fox jumps over the lazy dog\r\n";
+	char drain[65536];
+	uint64_t broadcast_ns = 0;
+	uint64_t ops = 0;
+	size_t allocations = 0;
+	// Only the broadcast itself is timed, draining the peers is not
+	while (broadcast_ns < MIN_BENCH_NS)
+	{
+		size_t allocations_before = g_allocations;
+		uint64_t start = now_ns();
+		for (int i = 0; i < BROADCASTS_PER_DRAIN; ++i)
+			channel->broadcast_message(make_shared_buffer(line), -1);
+		broadcast_ns += now_ns() - start;
+		allocations += g_allocations - allocations_before;
+		ops += BROADCASTS_PER_DRAIN;
+		for (int peer : peers)
+			while (recv(peer, drain, sizeof(drain), MSG_DONTWAIT) > 0)
+				;
+	}
+	char name[64];
+	std::snprintf(name, sizeof(name), "broadcast (%zu members)", members);
+	report(name, broadcast_ns, ops, allocations);
+	std::printf("%-32s %12.1f ns/member\n", "", static_cast<double>(broadcast_ns) / ops / members);
+	clients.for_each([&loop](int fd, Client&) { loop.remove(fd); });
+	for (int peer : peers)
+		close(peer);
+}
+
+// The 10k-member fanout needs more than 10k fds
+static size_t raise_fd_limit()
+{
+	rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+		return 1024;
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+	getrlimit(RLIMIT_NOFILE, &limit);
+	return limit.rlim_cur;
+}
+
+int main()
+{
+	size_t fd_limit = raise_fd_limit();
+	try
+	{
+		PollLoop loop; // Never waited on: clients only ask it for write events when a socket is full
+		bench_framing(loop);
+		bench_parsing();
+		bench_nicknames();
+		for (size_t members : {10, 100, 1000, 10000})
+		{
+			if (members + members / MEMBERS_PER_SOCKET + 64 > fd_limit)
+			{
+				std::printf("broadcast (%zu members)          skipped: fd limit %zu is too low\n", members, fd_limit);
+				continue;
+			}
+			bench_fanout(loop, members);
+		}
+	}
+	catch (const std::exception& e)
+	{
+		std::fprintf(stderr, "microbench: %s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,192 @@
+// PRIVMSG throughput benchmark.
+//
+// Connects one sender and <receivers> receivers to a running ircserv, joins
+// them to one channel and pushes <messages> PRIVMSGs through the server as
+// fast as it accepts them. Everything runs in one thread with poll(), and
+// the server under test only has a single event loop, so the numbers are
+// messages per second delivered through one reactor.
+//
+// Usage: ./privmsg_bench <port> <password> [messages] [receivers] [nick|channel]
+//   nick:    the sender writes to the first receiver by nickname
+//   channel: the sender writes to #bench and every receiver gets a copy
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#define MAX_IN_FLIGHT 2000 // Messages sent but not yet seen by the first receiver
+
+static int connect_to(int port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		throw std::runtime_error(std::string("socket: ") + std::strerror(errno));
+	sockaddr_in addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+		throw std::runtime_error(std::string("connect: ") + std::strerror(errno));
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return fd;
+}
+
+static void send_all(int fd, const std::string& data)
+{
+	size_t sent = 0;
+	while (sent < data.size())
+	{
+		ssize_t n = send(fd, data.data() + sent, data.size() - sent, 0);
+		if (n < 0)
+			throw std::runtime_error(std::string("send: ") + std::strerror(errno));
+		sent += static_cast<size_t>(n);
+	}
+}
+
+// Blocks until the server sent something containing token
+static void wait_for(int fd, const std::string& token)
+{
+	std::string received;
+	char buffer[4096];
+	while (received.find(token) == std::string::npos)
+	{
+		ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+		if (n <= 0)
+			throw std::runtime_error("connection closed while waiting for '" + token + "'");
+		received.append(buffer, n);
+	}
+}
+
+// Counts the PRIVMSG lines in a stream that may be cut anywhere
+struct LineCounter
+{
+	std::string partial;
+	size_t lines = 0;
+
+	void feed(const char* data, size_t size)
+	{
+		partial.append(data, size);
+		size_t start = 0;
+		size_t newline;
+		while ((newline = partial.find('\n', start)) != std::string::npos)
+		{
+			if (partial.compare(start, 1, ":") == 0 && partial.find(" PRIVMSG ", start) < newline)
+				++lines;
+			start = newline + 1;
+		}
+		partial.erase(0, start);
+	}
+};
+
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		std::cerr << "Usage: " << argv[0] << " <port> <password> [messages] [receivers] [nick|channel]" << std::endl;
+		return 1;
+	}
+	int port = std::atoi(argv[1]);
+	std::string password = argv[2];
+	size_t messages = (argc > 3) ? std::strtoul(argv[3], NULL, 10) : 200000;
+	size_t receiver_count = (argc > 4) ? std::strtoul(argv[4], NULL, 10) : 1;
+	std::string mode = (argc > 5) ? argv[5] : "channel";
+	if (receiver_count == 0 || messages == 0 || (mode != "nick" && mode != "channel"))
+	{
+		std::cerr << "Invalid arguments" << std::endl;
+		return 1;
+	}
+
+	try
+	{
+		// Register everybody and join #bench
+		int sender = connect_to(port);
+		send_all(sender, "PASS " + password + "\r\nNICK bsender\r\nUSER bench 0 * :bench\r\nJOIN #bench\r\n");
+		wait_for(sender, " JOIN #bench");
+		std::vector<int> receivers;
+		for (size_t i = 0; i < receiver_count; ++i)
+		{
+			int fd = connect_to(port);
+			std::string nick = "brecv" + std::to_string(i);
+			send_all(fd, "PASS " + password + "\r\nNICK " + nick + "\r\nUSER bench 0 * :bench\r\nJOIN #bench\r\n");
+			wait_for(fd, " JOIN #bench");
+			receivers.push_back(fd);
+		}
+		std::string target = (mode == "nick") ? "brecv0" : "#bench";
+		size_t expected = (mode == "nick") ? messages : messages * receiver_count;
+		std::string line = "PRIVMSG " + target + " :The quick brown fox jumps over the lazy dog 0123456789\r\n";
+
+		// Pipeline the messages while draining every receiver
+		std::vector<pollfd> pfds;
+		pfds.push_back({sender, POLLOUT, 0});
+		for (int fd : receivers)
+			pfds.push_back({fd, POLLIN, 0});
+		std::vector<LineCounter> counters(receivers.size());
+		std::string pending;
+		size_t queued = 0;
+		size_t delivered = 0;
+		char buffer[65536];
+		auto start = std::chrono::steady_clock::now();
+		while (delivered < expected)
+		{
+			// Keep at most MAX_IN_FLIGHT messages between us and the first receiver
+			size_t in_flight = queued - counters[0].lines;
+			pfds[0].events = (queued < messages && in_flight < MAX_IN_FLIGHT) || !pending.empty() ? POLLOUT : 0;
+			if (poll(pfds.data(), pfds.size(), 5000) <= 0)
+				throw std::runtime_error("no progress for 5 seconds");
+			if (pfds[0].revents & POLLOUT)
+			{
+				while (pending.size() < 64 * 1024 && queued < messages && queued - counters[0].lines < MAX_IN_FLIGHT)
+				{
+					pending += line;
+					++queued;
+				}
+				ssize_t n = send(sender, pending.data(), pending.size(), MSG_DONTWAIT);
+				if (n > 0)
+					pending.erase(0, n);
+			}
+			for (size_t i = 1; i < pfds.size(); ++i)
+			{
+				if (!(pfds[i].revents & (POLLIN | POLLHUP)))
+					continue;
+				ssize_t n = recv(pfds[i].fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+				if (n == 0)
+					throw std::runtime_error("receiver disconnected");
+				if (n < 0)
+					continue;
+				size_t before = counters[i - 1].lines;
+				counters[i - 1].feed(buffer, n);
+				delivered += counters[i - 1].lines - before;
+			}
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::cout << "mode:             " << mode << " (" << receiver_count << " receiver(s))" << std::endl;
+		std::cout << "messages sent:    " << messages << std::endl;
+		std::cout << "lines delivered:  " << delivered << std::endl;
+		std::cout << "elapsed:          " << seconds << " s" << std::endl;
+		std::cout << "messages/s:       " << static_cast<size_t>(messages / seconds) << std::endl;
+		std::cout << "deliveries/s:     " << static_cast<size_t>(delivered / seconds) << std::endl;
+		close(sender);
+		for (int fd : receivers)
+			close(fd);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "privmsg_bench: " << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef CASEMAPPING_HPP
+# define CASEMAPPING_HPP
+
+# include <string>
+# include <string_view>
+
+// How nicknames and channel names are compared (ISUPPORT CASEMAPPING).
+// rfc1459: A-Z equal a-z, and "[]\~" are the upper case of "{}|^"
+//          (Scandinavian origin of IRC), so "Bob[1]" and "bob{1}" are the same nick
+// ascii:   only A-Z equal a-z
+enum CaseMapping
+{
+	CASEMAPPING_RFC1459,
+	CASEMAPPING_ASCII
+};
+
+inline char irc_tolower(char c, CaseMapping mapping)
+{
+	if (c >= 'A' && c <= 'Z')
+		return static_cast<char>(c - 'A' + 'a');
+	if (mapping == CASEMAPPING_RFC1459)
+	{
+		switch (c)
+		{
+			case '[': return '{';
+			case ']': return '}';
+			case '\\': return '|';
+			case '~': return '^';
+			default: break;
+		}
+	}
+	return c;
+}
+
+// Lower-cased copy of name, used as the key of the case-insensitive indexes
+inline std::string irc_casefold(std::string_view name, CaseMapping mapping)
+{
+	std::string folded(name);
+	for (char& c : folded)
+		c = irc_tolower(c, mapping);
+	return folded;
+}
+
+#endif
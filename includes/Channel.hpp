@@ -2,33 +2,45 @@
 # define CHANNEL_HPP
 
 # include "Socket.hpp"   // Include our Socket class
-# include <set>          // For storing unique client file descriptors
+# include <algorithm>    // For lower_bound / binary_search on the member list
 # include <string>       // For password
 # include <vector>       // For pollfd vector
-# include <iostream>     // For logging
+# include "Logger.hpp"   // For logging
 # include <unordered_map> // For unordered_map
-# include "Client.hpp"
+# include "ClientTable.hpp"
+# include "SharedBuffer.hpp"
+# include "ChannelName.hpp"
+# include "History.hpp"
 #include "../includes/Colors.hpp"
 
 class Channel 
 {
 	private:
-		std::string _name;
-		std::set<int> _clients; // Set of unique client file descriptors, that are part of this channel. With this we can access a client directly through the reference to the clients map in Server
-		std::unordered_map<int, Client>& _clients_ref; // Reference to the clients map in Server
+		ChannelName _name;
+		std::vector<int> _clients; // Sorted, unique client file descriptors that are part of this channel. With this we can access a client directly through the reference to the client table in Server.
+		                           // A flat vector keeps the members contiguous, so a broadcast walks one cache-friendly array
+		ClientTable& _clients_ref; // Reference to the client table in Server
+		ChannelHistory _history; // Recent messages, filled through ChannelRegistry::record_history
 
 	public:
-		Channel(const std::string& name, std::unordered_map<int, Client>& clients);
+		Channel(ChannelName name, ClientTable& clients);
 		Channel(const Channel&) = delete;
 		Channel& operator=(const Channel&) = delete;
 
 		Channel(Channel&& other);
 		~Channel() = default;
 
-		std::set<int> get_clients() const;
-		void add_client(int client_fd);
-		void remove_client(int client_fd);
+		const std::vector<int>& get_clients() const;
+		const std::string& get_name() const;
+		const ChannelName& get_name_ref() const;
+		const ChannelHistory& get_history() const;
+		ChannelHistory& get_history();
+		bool has_client(int client_fd) const;
+		bool empty() const;
+		bool add_client(int client_fd); // Returns false if the client was already a member
+		bool remove_client(int client_fd); // Returns false if the client was not a member
 		void broadcast_message(const std::string& message, int sender_fd) const;
+		void broadcast_message(const SharedBuffer& message, int sender_fd) const;
 };
 
 #endif
\ No newline at end of file
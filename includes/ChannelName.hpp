@@ -0,0 +1,16 @@
+#ifndef CHANNELNAME_HPP
+# define CHANNELNAME_HPP
+
+# include <string>
+# include <memory>
+
+// Interned channel name, allocated once when the channel is created and
+// shared by the Channel, the members' reverse index and the registry key
+struct ChannelNameData
+{
+	std::string name; // As first given, '#' included (used in outgoing messages)
+	std::string key; // Case-folded name, key of the ChannelRegistry
+};
+typedef std::shared_ptr<const ChannelNameData> ChannelName;
+
+#endif
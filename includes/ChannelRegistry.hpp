@@ -0,0 +1,75 @@
+#ifndef CHANNELREGISTRY_HPP
+# define CHANNELREGISTRY_HPP
+
+# include <string>
+# include <string_view>
+# include <memory>
+# include <unordered_map>
+# include <deque>
+# include "Channel.hpp"
+# include "CaseMapping.hpp"
+
+# define CHANNELLEN 50 // Maximum channel name length, '#' included (RFC 2812)
+
+// Hash-based registry of every channel, keyed by the case-folded name.
+// The key is a view into the channel's interned name, so a lookup folds the
+// requested name on the stack and does one hash lookup, without allocating.
+// A channel is destroyed once its last member left and its history is
+// empty: recent messages outlive the members, until the global history cap
+// drops them.
+class ChannelRegistry
+{
+	private:
+		std::unordered_map<std::string_view, std::unique_ptr<Channel>> _channels; // folded name -> channel
+		CaseMapping _mapping;
+		HistoryLimits _history_limits;
+		size_t _history_bytes; // Held by every channel history together
+		size_t _history_entries;
+		uint64_t _last_msgid;
+		uint64_t _generation; // Moves on with every channel created, destroyed or talked in
+		// Every stored message in msgid order, to drop the oldest one of the
+		// whole server when over the global cap. Entries the channels dropped
+		// on their own stay until they reach the front or a compaction
+		std::deque<std::pair<ChannelName, uint64_t>> _history_order;
+
+		bool is_live(const std::pair<ChannelName, uint64_t>& entry) const;
+		void compact_history_order();
+
+		// Folds name into buffer (at least CHANNELLEN bytes), returns the folded view
+		std::string_view fold(std::string_view name, char* buffer) const;
+
+	public:
+		explicit ChannelRegistry(CaseMapping mapping = CASEMAPPING_RFC1459, const HistoryLimits& history_limits = HistoryLimits{0, 0, 0});
+		ChannelRegistry(const ChannelRegistry&) = delete;
+		ChannelRegistry& operator=(const ChannelRegistry&) = delete;
+
+		// A valid name is '#' followed by 1 to CHANNELLEN - 1 chars, none of them space, comma or ^G
+		static bool is_valid_name(std::string_view name);
+
+		// Channel called name (any case), or NULL
+		Channel* find(std::string_view name) const;
+		// Same, for an already folded name (e.g. ChannelName::key)
+		Channel* find_by_key(std::string_view key) const;
+		// Returns the existing channel or creates it; created tells which one happened
+		Channel* find_or_create(std::string_view name, ClientTable& clients, bool& created);
+		// Destroys channel if nobody is left in it and it has no history
+		void release_if_empty(Channel* channel);
+		size_t size() const;
+		void reserve(size_t channel_count); // Room for that many channels without rehashing
+		// Keeps line, as sent to the channel at time_ms (wall clock), in its
+		// history, dropping the oldest messages of the server when over the cap.
+		// channel itself is never released here, even if left memberless and empty
+		void record_history(Channel& channel, const SharedBuffer& line, uint64_t time_ms);
+		size_t history_bytes() const;
+		const HistoryLimits& history_limits() const;
+		uint64_t generation() const; // Unchanged: nothing worth a new snapshot happened
+		// Calls f(channel) for every channel, in no particular order
+		template <typename Function>
+		void for_each(Function f) const
+		{
+			for (const auto& entry : _channels)
+				f(*entry.second);
+		}
+};
+
+#endif
@@ -2,14 +2,47 @@
 #define CLIENT_HPP
 
 #include "Socket.hpp"
+#include "InputBuffer.hpp"
+#include "EventLoop.hpp"
+#include "SharedBuffer.hpp"
+#include "ChannelName.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+#include "TimerWheel.hpp"
+#include "FloodControl.hpp"
 #include <string>
 #include <vector>
+#include <deque>
 #include <poll.h>
 #include <iostream>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <csignal>
 
+// Most bytes a slow reader may have waiting in its send queue before it is dropped
+#ifndef SEND_QUEUE_MAX
+# define SEND_QUEUE_MAX (1024 * 1024)
+#endif
+// Same for a link to another server, which carries the burst and the traffic of many users
+#ifndef LINK_SEND_QUEUE_MAX
+# define LINK_SEND_QUEUE_MAX (16 * 1024 * 1024)
+#endif
+// Most queued messages handed to a single writev() call
+#define SEND_IOV_MAX 64
+// Corked output is written before the end of the iteration once this many bytes wait
+#ifndef SEND_CORK_MAX
+# define SEND_CORK_MAX (64 * 1024)
+#endif
+
+// What a connection is besides a user: another server of the network
+// (see Server::accept_link). Outgoing links are the ones we started with CONNECT
+enum LinkRole
+{
+	LINK_NONE,
+	LINK_INCOMING,
+	LINK_OUTGOING
+};
+
 // CHANGED (tobias)
 // Authentication in the client terminal:
 // 
@@ -19,34 +52,70 @@
 class Client
 {
 private:
-    std::unique_ptr<Socket> _socket;
-	std::string input_buffer = ""; // When the server sends data to the client, it is stored here
-    std::string output_buffer = ""; // When the client sends data to the server, it is stored here
+    Socket _socket; // Held by value: no separate allocation per client
+	EventLoop* _event_loop; // Used to ask for write events while the send queue is not empty
+
+	// Outbound queue: messages wait here until the socket accepts them.
+	// Entries are shared, so a broadcast is queued by pointer, not copied
+	std::deque<SharedBuffer> _send_queue;
+	size_t _send_offset = 0; // Bytes of _send_queue.front() already written
+	size_t _send_queue_bytes = 0; // Bytes still waiting in the whole queue
+	bool _write_interest = false; // Are we currently registered for EVENT_WRITE?
+	bool _send_failed = false; // The connection is broken or the queue overflowed
+	bool _send_in_flight = false; // A write was given to a batching event loop, its completion is pending
+	// Corking: send() only queues and adds the fd to this list, the server
+	// flushes every listed client once per loop iteration. NULL: write right away
+	std::vector<int>* _flush_list;
+	bool _flush_queued = false; // Already in _flush_list
+
+	void fail_send();
+	int fill_send_iov(iovec* iov) const;
+	bool consume_sent(size_t written);
+	void set_write_interest(bool want_write);
+    InputBuffer _recv_buffer; // When the client sends data to the server, recv() writes it straight in here
 
 	// Authentication data
 	std::string _nickname = ""; // from NICK
 	std::string _username = ""; // from USER
 	std::string _realname = "";  // from USER after ':'
 	std::string _password = ""; // from PASS
+	std::string _hostname = ""; // Peer address, filled when the connection is accepted
+	std::string _prefix = ""; // "nick!user@host", rebuilt when the nickname or username changes
+	std::vector<ChannelName> _channels; // Reverse index: interned names of the channels this client is in
 	bool passed_pass = false;
 	bool passed_nick = false;
 	bool passed_user = false;
 	bool passed_realname = false;
     bool authenticated = false;
+	bool _operator = false; // Granted by a successful OPER
+	LinkRole _link_role = LINK_NONE;
+
+	// Liveness, driven by the server's timer wheel (see Server::handle_client_timer)
+	TimerNode _timer; // Registration, keepalive or PONG deadline: one timer at a time
+	uint64_t _last_activity_ms = 0; // Last line received, on the loop's cached clock
+	uint64_t _last_command_ms = 0; // Same, PING and PONG excluded (idle reaping)
+	uint64_t _ping_sent_ms = 0; // When our PING went out, 0 when none is waiting for its PONG
+	FloodControl _flood; // Token buckets per command class, see Server::dispatch_command
+	bool _input_queued = false; // Input left over by the per-iteration budgets, see Server::queue_input
+	bool _hung_up = false; // The peer closed its side, what is left in the socket is all there is
+
+	void update_prefix();
 
 public:
     Client() = delete;
     Client(const Client&) = delete;
     Client& operator=(const Client&) = delete;
 
-	// Move constructor and assignment operator
-	Client(Client&&);
-	Client& operator=(Client&&);
+	// Clients are built in place in the ClientTable and never move
+	Client(Client&&) = delete;
+	Client& operator=(Client&&) = delete;
 
-    Client(std::unique_ptr<Socket> socket);
+    // Takes ownership of the connected socket client_fd
+    Client(int client_fd, EventLoop* event_loop, size_t recv_chunk_size = RECV_CHUNK_SIZE, std::vector<int>* flush_list = NULL);
     ~Client() = default;
 
     int get_fd() const;
+	size_t get_recv_chunk_size() const;
     void close();
 	bool get_passed_pass() const;
 	bool get_passed_nick() const;
@@ -54,20 +123,63 @@ public:
 	bool get_passed_realname() const;
 
 	std::string const &get_nickname() const;
+	std::string const &get_username() const;
+	std::string const &get_hostname() const;
+	std::string const &get_realname() const;
+	std::string const &get_prefix() const; // Source of the messages this client sends: nick!user@host
 	void set_passed_pass(std::string const &pass);
 	void set_passed_nick(std::string const &nick);
 	void set_passed_user(std::string const &user);
 	void set_passed_realname(std::string const &realname);
 
+	const std::vector<ChannelName>& get_channels() const;
+	void add_channel(ChannelName const &channel_name);
+	void remove_channel(ChannelName const &channel_name);
+
 	bool is_authenticated() const;
 	void set_authenticated();
+	bool is_operator() const;
+	void set_operator();
+	std::string const &get_password() const; // As given with PASS
+	// Server links: a link is "authenticated" once both sides exchanged SERVER
+	bool is_link() const;
+	LinkRole get_link_role() const;
+	void set_link_role(LinkRole role);
+
+	TimerNode& get_timer();
+	void note_activity(uint64_t now_ms, bool is_command);
+	uint64_t get_last_activity() const;
+	uint64_t get_last_command() const;
+	uint64_t get_ping_sent() const;
+	void set_ping_sent(uint64_t now_ms); // 0 once the PONG (or anything else) came back
+	FloodControl& get_flood();
 
 	// std::string const &get_read_buffer() const;
 	// std::string const &get_write_buffer() const;
 
-	void send(std::string const &msg); // Append data to the input_buffer to send to the client
-	void write_output_buffer(std::string const &data); // Append data to the output_buffer to send to the server
-	std::string extract_output_line();
+	void send(std::string const &msg); // Queue data for the client, written as soon as the socket allows it
+	void send(SharedBuffer const &msg); // Same, for a message shared with other clients (no copy)
+	bool flush_send_queue(); // Write as much of the queue as the socket accepts. Returns false once the connection is broken
+	bool take_flush_queued(); // Was the client in the flush list? Clears the flag
+	bool complete_send(int result); // Result of a write submitted through a batching event loop (EVENT_SENT). Same return value
+	bool has_pending_output() const;
+	bool has_send_failed() const;
+	ssize_t read_from_socket(); // One large recv() into the receive buffer, returns what recv() returned
+	// Next complete line as a view into the receive buffer (valid until compact_input())
+	bool extract_output_line(std::string_view &line);
+	void compact_input(); // Drops the handled lines from the receive buffer, once per read batch
+	void unread_line(std::string_view line); // Puts back the line last extracted (deferred by flood control)
+	size_t get_input_size() const; // Bytes received and not handled yet
+	size_t take_overlong_lines(); // Lines dropped for being longer than MAX_LINE_LENGTH since the last call
+	bool is_input_queued() const;
+	void set_input_queued(bool queued);
+	bool is_hung_up() const;
+	void set_hung_up();
+	// Hot upgrade: what is left in both directions, and putting it back in the new process
+	std::string_view get_pending_input() const;
+	std::string get_pending_output() const;
+	void restore_input(std::string_view bytes);
+	bool has_send_in_flight() const;
 };
 
 #endif
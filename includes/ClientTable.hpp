@@ -0,0 +1,88 @@
+#ifndef CLIENTTABLE_HPP
+# define CLIENTTABLE_HPP
+
+# include <vector>
+# include <memory>
+# include <new>       // For placement new, std::launder
+# include <cstdint>
+# include <stdexcept>
+# include "Client.hpp"
+
+# define CLIENT_CHUNK_SLOTS 256 // Slots allocated at once, a chunk is never freed or moved
+
+// Identifies one connection, not just one fd: the generation changes every
+// time the slot is freed, so a handle kept across events (timers, pending
+// lists...) does not match a new client that was given the same fd.
+struct ClientHandle
+{
+	int fd;
+	uint32_t generation;
+};
+
+// Dense client table indexed by fd.
+// The kernel hands out the lowest free fd, so fds stay small and the table
+// stays dense: a lookup is one division and one array index, and the
+// clients live next to each other in fixed chunks instead of one heap node
+// each. Chunks are allocated on demand and reused as fds are reused;
+// a Client never moves once constructed, so references to it stay valid
+// until it is erased.
+class ClientTable
+{
+	private:
+		struct Slot
+		{
+			alignas(Client) unsigned char storage[sizeof(Client)];
+			uint32_t generation; // Bumped every time the slot is freed
+			bool used;
+		};
+
+		std::vector<std::unique_ptr<Slot[]>> _chunks; // _chunks[fd / CLIENT_CHUNK_SLOTS]
+		size_t _size;
+
+		Slot* slot(int fd) const;
+		Slot& make_slot(int fd);
+		static Client* client_in(Slot& slot) { return std::launder(reinterpret_cast<Client*>(slot.storage)); }
+
+	public:
+		ClientTable();
+		ClientTable(const ClientTable&) = delete;
+		ClientTable& operator=(const ClientTable&) = delete;
+		~ClientTable();
+
+		// Builds the Client in place for fd. The fd must not be in use
+		template <typename... Args>
+		Client& emplace(int fd, Args&&... args)
+		{
+			Slot& free_slot = make_slot(fd);
+			Client* client = new (free_slot.storage) Client(std::forward<Args>(args)...);
+			free_slot.used = true;
+			++_size;
+			return *client;
+		}
+		void erase(int fd);
+
+		Client* find(int fd) const; // NULL when no client uses fd
+		Client* find(ClientHandle handle) const; // NULL when that connection is gone, even if the fd was reused
+		Client& at(int fd) const; // Throws std::out_of_range when no client uses fd
+		ClientHandle handle_of(int fd) const;
+		size_t size() const;
+
+		// Calls f(fd, client) for every client, in fd order
+		template <typename Function>
+		void for_each(Function f) const
+		{
+			for (size_t chunk = 0; chunk < _chunks.size(); ++chunk)
+			{
+				if (!_chunks[chunk])
+					continue;
+				for (size_t i = 0; i < CLIENT_CHUNK_SLOTS; ++i)
+				{
+					Slot& current = _chunks[chunk][i];
+					if (current.used)
+						f(static_cast<int>(chunk * CLIENT_CHUNK_SLOTS + i), *client_in(current));
+				}
+			}
+		}
+};
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef COMMANDS_HPP
+# define COMMANDS_HPP
+
+# include <string_view>
+# include <cstdint>
+# include <cstddef>
+# include "FloodControl.hpp"
+
+// Every command the server knows. CMD_UNKNOWN must stay first (index 0)
+enum CommandId
+{
+	CMD_UNKNOWN,
+	CMD_PASS,
+	CMD_NICK,
+	CMD_USER,
+	CMD_JOIN,
+	CMD_PART,
+	CMD_PRIVMSG,
+	CMD_QUIT,
+	CMD_NOTICE,
+	CMD_OPER,
+	CMD_STATS,
+	CMD_PING,
+	CMD_PONG,
+	CMD_CHATHISTORY,
+	// Server-to-server links (see Server::handle_server)
+	CMD_SERVER,
+	CMD_SQUIT,
+	CMD_CONNECT,
+	CMD_LINKS,
+	CMD_KILL,
+	CMD_NJOIN,
+	CMD_ERROR,
+	CMD_COUNT // Number of entries, keep it last
+};
+
+// Registration states a command can be allowed in (bit mask)
+enum RegistrationState
+{
+	STATE_UNREGISTERED = 1 << 0, // Still going through PASS / NICK / USER
+	STATE_REGISTERED = 1 << 1,
+	STATE_ANY = STATE_UNREGISTERED | STATE_REGISTERED
+};
+
+struct CommandSpec
+{
+	CommandId id;
+	const char* name;
+	unsigned int allowed_states; // RegistrationState mask
+	size_t min_params; // Fewer params => "not enough parameters" error
+	FloodClass flood_class; // Rate limit the command is charged to
+};
+
+// Indexed by CommandId
+constexpr CommandSpec COMMAND_TABLE[CMD_COUNT] = {
+	{CMD_UNKNOWN, "", 0, 0, FLOOD_CLASS_DEFAULT},
+	{CMD_PASS, "PASS", STATE_UNREGISTERED, 1, FLOOD_CLASS_DEFAULT},
+	{CMD_NICK, "NICK", STATE_ANY, 1, FLOOD_CLASS_DEFAULT},
+	{CMD_USER, "USER", STATE_ANY, 4, FLOOD_CLASS_DEFAULT},
+	{CMD_JOIN, "JOIN", STATE_REGISTERED, 1, FLOOD_CLASS_CHANNEL},
+	{CMD_PART, "PART", STATE_REGISTERED, 1, FLOOD_CLASS_CHANNEL},
+	{CMD_PRIVMSG, "PRIVMSG", STATE_REGISTERED, 0, FLOOD_CLASS_MESSAGE},
+	{CMD_QUIT, "QUIT", STATE_REGISTERED, 0, FLOOD_CLASS_DEFAULT},
+	{CMD_NOTICE, "NOTICE", STATE_REGISTERED, 0, FLOOD_CLASS_MESSAGE},
+	{CMD_OPER, "OPER", STATE_REGISTERED, 2, FLOOD_CLASS_DEFAULT},
+	{CMD_STATS, "STATS", STATE_REGISTERED, 0, FLOOD_CLASS_DEFAULT},
+	{CMD_PING, "PING", STATE_ANY, 1, FLOOD_CLASS_PING},
+	{CMD_PONG, "PONG", STATE_ANY, 0, FLOOD_CLASS_PING},
+	{CMD_CHATHISTORY, "CHATHISTORY", STATE_REGISTERED, 4, FLOOD_CLASS_DEFAULT},
+	{CMD_SERVER, "SERVER", STATE_UNREGISTERED, 3, FLOOD_CLASS_DEFAULT},
+	{CMD_SQUIT, "SQUIT", STATE_REGISTERED, 1, FLOOD_CLASS_DEFAULT},
+	{CMD_CONNECT, "CONNECT", STATE_REGISTERED, 2, FLOOD_CLASS_DEFAULT},
+	{CMD_LINKS, "LINKS", STATE_REGISTERED, 0, FLOOD_CLASS_DEFAULT},
+	// Only ever sent by servers: allowed in no client state
+	{CMD_KILL, "KILL", 0, 2, FLOOD_CLASS_DEFAULT},
+	{CMD_NJOIN, "NJOIN", 0, 2, FLOOD_CLASS_DEFAULT},
+	{CMD_ERROR, "ERROR", 0, 0, FLOOD_CLASS_DEFAULT},
+};
+
+// Packs a command name of up to 8 letters into one integer, upper-casing it
+// on the way (commands are case-insensitive). Anything longer or containing
+// something else than a letter or a digit packs to 0, which matches nothing.
+constexpr uint64_t pack_command(std::string_view name)
+{
+	if (name.empty() || name.size() > 8)
+		return 0;
+	uint64_t packed = 0;
+	for (char c : name)
+	{
+		if (c >= 'a' && c <= 'z')
+			c = static_cast<char>(c - 'a' + 'A');
+		else if (!((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')))
+			return 0;
+		packed = (packed << 8) | static_cast<unsigned char>(c);
+	}
+	return packed;
+}
+
+// A single switch on the packed bytes: the compiler turns the case labels
+// (computed at compile time) into a jump table or a binary search, with no
+// string comparison at all.
+constexpr CommandId lookup_command(std::string_view name)
+{
+	// The only command longer than 8 letters: packed in two halves
+	if (name.size() > 8)
+	{
+		return (name.size() == 11 && pack_command(name.substr(0, 8)) == pack_command("CHATHIST")
+			&& pack_command(name.substr(8)) == pack_command("ORY")) ? CMD_CHATHISTORY : CMD_UNKNOWN;
+	}
+	switch (pack_command(name))
+	{
+		case pack_command("PASS"): return CMD_PASS;
+		case pack_command("NICK"): return CMD_NICK;
+		case pack_command("USER"): return CMD_USER;
+		case pack_command("JOIN"): return CMD_JOIN;
+		case pack_command("PART"): return CMD_PART;
+		case pack_command("PRIVMSG"): return CMD_PRIVMSG;
+		case pack_command("QUIT"): return CMD_QUIT;
+		case pack_command("NOTICE"): return CMD_NOTICE;
+		case pack_command("OPER"): return CMD_OPER;
+		case pack_command("STATS"): return CMD_STATS;
+		case pack_command("PING"): return CMD_PING;
+		case pack_command("PONG"): return CMD_PONG;
+		case pack_command("SERVER"): return CMD_SERVER;
+		case pack_command("SQUIT"): return CMD_SQUIT;
+		case pack_command("CONNECT"): return CMD_CONNECT;
+		case pack_command("LINKS"): return CMD_LINKS;
+		case pack_command("KILL"): return CMD_KILL;
+		case pack_command("NJOIN"): return CMD_NJOIN;
+		case pack_command("ERROR"): return CMD_ERROR;
+		default: return CMD_UNKNOWN;
+	}
+}
+
+// The table and the switch must agree, checked at compile time
+static_assert(lookup_command("privmsg") == CMD_PRIVMSG, "lookup_command is case-insensitive");
+static_assert(lookup_command("ChatHistory") == CMD_CHATHISTORY && lookup_command("CHATHISTORX") == CMD_UNKNOWN,
+	"lookup_command knows the long command");
+static_assert(lookup_command(COMMAND_TABLE[CMD_QUIT].name) == CMD_QUIT, "COMMAND_TABLE is indexed by CommandId");
+
+#endif
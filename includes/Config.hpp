@@ -0,0 +1,56 @@
+#ifndef CONFIG_HPP
+# define CONFIG_HPP
+
+# include <string>
+# include <cstddef>
+# include "InputBuffer.hpp"
+# include "CaseMapping.hpp"
+# include "Logger.hpp"
+# include "FloodControl.hpp"
+# include "Upgrade.hpp"
+
+// Runtime tunables of the server.
+// The subject forces the command line to be "./ircserv <port> <password>",
+// so everything else is read from IRCSERV_* environment variables.
+struct Config
+{
+	std::string event_backend = "epoll"; // IRCSERV_EVENT_BACKEND: "io_uring", "epoll" or "poll"
+	size_t recv_chunk_size = RECV_CHUNK_SIZE; // IRCSERV_RECV_CHUNK_SIZE: bytes per recv() call
+	size_t listen_backlog = 4096; // IRCSERV_LISTEN_BACKLOG: pending connections queued by the kernel (capped by net.core.somaxconn)
+	size_t accept_batch = 256; // IRCSERV_ACCEPT_BATCH: connections accepted per loop iteration at most
+	size_t read_budget = 65536; // IRCSERV_READ_BUDGET: bytes read from one client per loop iteration at most
+	size_t line_budget = 64; // IRCSERV_LINE_BUDGET: lines handled for one client per loop iteration at most
+	size_t registration_timeout = 60; // IRCSERV_REGISTRATION_TIMEOUT: seconds to complete PASS / NICK / USER
+	size_t ping_interval = 120; // IRCSERV_PING_INTERVAL: seconds of silence before the server sends a PING
+	size_t ping_timeout = 60; // IRCSERV_PING_TIMEOUT: seconds to answer that PING
+	size_t idle_timeout = 0; // IRCSERV_IDLE_TIMEOUT: seconds without a command (PING/PONG aside) before disconnecting, 0 = never
+	CaseMapping casemapping = CASEMAPPING_RFC1459; // IRCSERV_CASEMAPPING: "rfc1459" or "ascii"
+	std::string log_file; // IRCSERV_LOG_FILE: appended to, stderr when empty
+	LogLevel log_level = LOG_LEVEL_INFO; // IRCSERV_LOG_LEVEL: "debug", "info", "warn" or "error"
+	std::string oper_password; // IRCSERV_OPER_PASSWORD: password of the OPER command, OPER is refused when empty
+	std::string server_name = "ircserv.local"; // IRCSERV_SERVER_NAME: our name on the network, unique among the linked servers
+	std::string link_password; // IRCSERV_LINK_PASSWORD: shared by the linked servers, links are refused when empty
+	// IRCSERV_FLOOD_DEFAULT, _MESSAGE, _CHANNEL, _PING: "lines/s:line burst:bytes/s:byte burst",
+	// a rate of 0 lifts that limit. Indexed by FloodClass
+	FloodLimit flood_limits[FLOOD_CLASS_COUNT] = {
+		{4, 16, 1024, 8192}, // FLOOD_CLASS_DEFAULT
+		{10, 40, 8192, 32768}, // FLOOD_CLASS_MESSAGE
+		{2, 20, 2048, 16384}, // FLOOD_CLASS_CHANNEL
+		{4, 16, 1024, 8192}, // FLOOD_CLASS_PING
+	};
+	size_t flood_excess_timeout = 10; // IRCSERV_FLOOD_EXCESS_TIMEOUT: seconds of deferred input before "Excess Flood"
+	size_t flood_max_backlog = 65536; // IRCSERV_FLOOD_MAX_BACKLOG: deferred bytes before "Excess Flood"
+	int upgrade_fd = -1; // IRCSERV_UPGRADE_FD: set by a running ircserv handing its clients over (hot upgrade), not by hand
+	size_t history_lines = 100; // IRCSERV_HISTORY_LINES: messages kept per channel, 0 = no history
+	size_t history_bytes = 65536; // IRCSERV_HISTORY_BYTES: bytes kept per channel
+	size_t history_total_bytes = 16 * 1024 * 1024; // IRCSERV_HISTORY_TOTAL_BYTES: bytes kept for every channel together
+	size_t history_join_replay = 20; // IRCSERV_HISTORY_JOIN_REPLAY: messages replayed to a client joining a channel
+	std::string snapshot_file; // IRCSERV_SNAPSHOT_FILE: channels and history are saved there and loaded at startup, none when empty
+	size_t snapshot_interval = 60; // IRCSERV_SNAPSHOT_INTERVAL: seconds between two snapshots (skipped when nothing changed)
+	std::string metrics_socket; // IRCSERV_METRICS_SOCKET: Unix socket path serving Prometheus metrics, none when empty
+
+	// Builds a Config from the environment, keeping the defaults above for unset variables
+	static Config from_environment();
+};
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef EPOLLLOOP_HPP
+# define EPOLLLOOP_HPP
+
+# include "EventLoop.hpp"
+
+# ifdef __linux__
+#  include <sys/epoll.h> // For epoll_create1(), epoll_ctl(), epoll_wait()
+
+// Edge-triggered epoll backend.
+// epoll_wait() only returns the fds that changed state, so a wakeup costs
+// O(ready fds) instead of O(connected clients).
+class EpollLoop : public EventLoop
+{
+	private:
+		int _epoll_fd;
+		std::vector<epoll_event> _events; // Output buffer for epoll_wait(), grows with the number of watched fds
+		size_t _watched; // Number of fds currently registered
+
+		static uint32_t to_epoll_events(unsigned int events);
+
+	public:
+		EpollLoop();
+		EpollLoop(const EpollLoop&) = delete;
+		EpollLoop& operator=(const EpollLoop&) = delete;
+		~EpollLoop();
+
+		void add(int fd, unsigned int events);
+		void modify(int fd, unsigned int events);
+		void remove(int fd);
+		int wait(std::vector<IoEvent>& ready, int timeout_ms);
+		bool is_edge_triggered() const;
+		const char* name() const;
+};
+
+# endif
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef EVENTLOOP_HPP
+# define EVENTLOOP_HPP
+
+# include <vector>       // For the ready events vector
+# include <memory>       // For std::unique_ptr
+# include <string>       // For the backend name
+# include <sys/uio.h>    // For iovec
+
+// Readiness flags understood by every backend.
+// They are our own values so the Server never has to know about POLLIN / EPOLLIN.
+enum EventFlags
+{
+	EVENT_READ = 1 << 0,   // Data (or a new connection) is ready to be read
+	EVENT_WRITE = 1 << 1,  // The socket can accept more outgoing data
+	EVENT_HANGUP = 1 << 2, // The peer closed the connection
+	EVENT_ERROR = 1 << 3,  // An error is pending on the socket
+	EVENT_SENT = 1 << 4    // A write given to submit_send() completed, see IoEvent::result
+};
+
+// One ready file descriptor returned by EventLoop::wait()
+struct IoEvent
+{
+	int fd;
+	unsigned int events; // Combination of EventFlags
+	int result; // EVENT_SENT only: bytes written, or -errno
+};
+
+// Interface of the event-loop backends used by Server::run().
+// A backend only reports file descriptors that are actually ready, so the
+// Server never has to walk over every connected client on each wakeup.
+class EventLoop
+{
+	public:
+		virtual ~EventLoop() = default;
+
+		// Start watching fd for the given EventFlags
+		virtual void add(int fd, unsigned int events) = 0;
+		// Change the EventFlags we are interested in for an already watched fd
+		virtual void modify(int fd, unsigned int events) = 0;
+		// Stop watching fd. Must be called BEFORE the fd is closed
+		virtual void remove(int fd) = 0;
+		// Block up to timeout_ms (-1 = forever) and fill ready with the ready fds.
+		// Returns the number of ready fds, or -1 with errno set (EINTR included)
+		virtual int wait(std::vector<IoEvent>& ready, int timeout_ms) = 0;
+
+		// Edge-triggered backends only notify on state changes, so the caller
+		// must always read / accept until EAGAIN
+		virtual bool is_edge_triggered() const = 0;
+		virtual const char* name() const = 0;
+
+		// Completion-based backends (io_uring) can take the writes over: they
+		// are handed to the kernel together, in the next wait(), and each
+		// result comes back from wait() as an EVENT_SENT event. The iovec
+		// array is copied, the bytes it points to must stay valid until then.
+		// Only called when batches_sends() is true
+		virtual bool batches_sends() const { return false; }
+		virtual void submit_send(int fd, const iovec* iov, int iov_count) { (void)fd; (void)iov; (void)iov_count; }
+
+		// Creates the requested backend ("io_uring", "epoll" or "poll").
+		// Falls back to epoll, then poll(), when the requested one is not
+		// available on this system.
+		static std::unique_ptr<EventLoop> create(const std::string& backend);
+};
+
+#endif
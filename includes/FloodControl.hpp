@@ -0,0 +1,76 @@
+#ifndef FLOODCONTROL_HPP
+# define FLOODCONTROL_HPP
+
+# include <cstdint>
+# include <cstddef>
+
+// Commands are rate limited by class, each class with its own buckets
+enum FloodClass
+{
+	FLOOD_CLASS_DEFAULT, // Registration, QUIT, OPER, STATS, unknown commands
+	FLOOD_CLASS_MESSAGE, // PRIVMSG, NOTICE
+	FLOOD_CLASS_CHANNEL, // JOIN, PART
+	FLOOD_CLASS_PING, // PING, PONG
+	FLOOD_CLASS_COUNT // Number of classes, keep it last
+};
+
+// Sustained rates and bursts of one class. A rate of 0 means no limit
+struct FloodLimit
+{
+	uint32_t lines_per_second;
+	uint32_t line_burst;
+	uint32_t bytes_per_second;
+	uint32_t byte_burst;
+};
+
+// Token bucket in integer arithmetic only: the tokens are counted in
+// thousandths, so a rate per second times elapsed milliseconds is exactly
+// the number of thousandths earned. A line that goes through costs no
+// division; only the wait of a deferred line is divided out.
+// A new bucket starts full.
+class TokenBucket
+{
+	private:
+		uint64_t _milli_tokens;
+		uint64_t _last_ms;
+
+		void refill(uint32_t rate, uint32_t burst, uint64_t now_ms);
+
+	public:
+		TokenBucket();
+
+		// Milliseconds until cost tokens are available, 0 when they already are.
+		// Nothing is taken
+		uint64_t wait_ms(uint32_t rate, uint32_t burst, uint64_t cost, uint64_t now_ms);
+		void take(uint32_t rate, uint64_t cost);
+};
+
+// Per-client flood state: one line bucket and one byte bucket per class,
+// plus where the client stands when its input is being deferred.
+class FloodControl
+{
+	private:
+		TokenBucket _lines[FLOOD_CLASS_COUNT];
+		TokenBucket _bytes[FLOOD_CLASS_COUNT];
+		uint64_t _throttled_since; // When input started being deferred, 0 when it is not
+		uint64_t _resume_at; // When the deferred line can go through
+		bool _queued; // In the server's list of throttled clients
+
+	public:
+		FloodControl();
+
+		// Charges one line of `bytes` bytes to its class when both buckets
+		// allow it and returns 0. Otherwise charges nothing and returns the
+		// milliseconds to wait before the line can go through
+		uint64_t charge(const FloodLimit& limit, FloodClass flood_class, size_t bytes, uint64_t now_ms);
+
+		bool is_throttled() const { return _throttled_since != 0; }
+		uint64_t throttled_since() const { return _throttled_since; }
+		uint64_t resume_at() const { return _resume_at; }
+		void throttle(uint64_t now_ms, uint64_t resume_at);
+		void unthrottle() { _throttled_since = 0; }
+		bool is_queued() const { return _queued; }
+		void set_queued(bool queued) { _queued = queued; }
+};
+
+#endif
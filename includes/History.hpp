@@ -0,0 +1,70 @@
+#ifndef HISTORY_HPP
+# define HISTORY_HPP
+
+# include <cstdint>
+# include <cstddef>
+# include <vector>
+# include "SharedBuffer.hpp"
+
+// Caps of the channel history. 0 lines: no history is kept at all
+struct HistoryLimits
+{
+	size_t lines; // Per channel
+	size_t bytes; // Per channel
+	size_t total_bytes; // Every channel together, see ChannelRegistry::record_history
+};
+
+// One message, kept exactly as the members got it: replaying it is queueing
+// the same buffer again, with no formatting
+struct HistoryEntry
+{
+	uint64_t msgid; // Increasing across every channel
+	uint64_t time_ms; // Wall clock, milliseconds since the epoch
+	SharedBuffer line;
+};
+
+enum HistorySelector
+{
+	HISTORY_LATEST, // The most recent messages (after a time, when there is one)
+	HISTORY_BEFORE, // The messages just before a time
+	HISTORY_AFTER // The messages just after a time
+};
+
+// Wall clock in milliseconds since the epoch, for HistoryEntry::time_ms
+uint64_t history_clock_ms();
+
+// Ring of the recent messages of one channel, oldest first. The slots grow
+// with the history up to the line cap and are reused from then on, so a
+// quiet channel does not pay for a full ring
+class ChannelHistory
+{
+	private:
+		std::vector<HistoryEntry> _slots;
+		size_t _head; // Slot of the oldest entry
+		size_t _count;
+		size_t _bytes; // Sum of the line sizes
+
+		// First entry (0 = oldest) sent at time_ms or later, or after time_ms
+		size_t lower_bound(uint64_t time_ms) const;
+		size_t upper_bound(uint64_t time_ms) const;
+
+	public:
+		ChannelHistory();
+
+		size_t size() const;
+		size_t bytes() const;
+		bool empty() const;
+		const HistoryEntry& at(size_t index) const; // 0 is the oldest
+
+		// Drops the oldest entries until entry fits in limits, then appends it.
+		// A line bigger than the byte cap alone is not stored: returns false
+		bool append(HistoryEntry entry, const HistoryLimits& limits);
+		size_t pop_oldest(); // Returns the bytes freed
+		void reserve(size_t lines); // Slots for that many entries, capped by the line cap by the caller
+
+		// Appends up to limit lines to out, oldest first. time_ms is ignored
+		// by HISTORY_LATEST when 0
+		void select(HistorySelector selector, uint64_t time_ms, size_t limit, std::vector<SharedBuffer>& out) const;
+};
+
+#endif
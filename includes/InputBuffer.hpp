@@ -0,0 +1,71 @@
+#ifndef INPUTBUFFER_HPP
+# define INPUTBUFFER_HPP
+
+# include <vector>
+# include <string_view>  // For the lines handed out by next_line()
+# include <cstddef>      // For size_t
+# include <sys/types.h>  // For ssize_t
+
+// Default number of bytes asked to recv() in one call (IRCSERV_RECV_CHUNK_SIZE)
+# ifndef RECV_CHUNK_SIZE
+#  define RECV_CHUNK_SIZE 16384
+# endif
+// Longest line accepted, "\r\n" included (RFC 1459, 2.3)
+# define MAX_LINE_LENGTH 512
+
+// Contiguous receive buffer owned by a Client, with the IRC line framing on top.
+// recv() writes straight into the free space at the tail, next_line() hands
+// out complete lines as string_views into the buffer, and compact() slides the
+// unfinished line back to the front once per read batch.
+//
+//   _data: [ consumed | unread bytes (_start.._end) | free space ]
+//                            ^ _scan: no '\n' between _start and here
+//
+// _scan remembers how far we already searched, so a line arriving in many
+// small pieces is only scanned once.
+//
+// Lines longer than MAX_LINE_LENGTH are dropped: an unfinished line is thrown
+// away as soon as it is too long, so a sender that never sends '\n' cannot
+// make the buffer grow, and the rest of it is skipped up to the next '\n'.
+class InputBuffer
+{
+	private:
+		std::vector<char> _data;
+		size_t _start; // First unread byte
+		size_t _end; // One past the last received byte
+		size_t _scan; // Where the next search for '\n' starts
+		size_t _chunk_size; // How much room we ask recv() to fill
+		bool _discarding; // The unfinished line was too long: skip up to the next '\n'
+		size_t _overlong; // Lines dropped for being too long, see take_overlong()
+
+		void reserve_chunk();
+
+	public:
+		explicit InputBuffer(size_t chunk_size = RECV_CHUNK_SIZE);
+
+		// Performs ONE recv() of up to chunk_size bytes into the buffer.
+		// Returns what recv() returned (0 on EOF, -1 with errno set on error)
+		ssize_t read_from(int fd);
+
+		const char* data() const; // First unread byte
+		size_t size() const; // Number of unread bytes
+		bool empty() const;
+		size_t chunk_size() const;
+
+		// Hands out the next complete line without its "\r\n" (or "\n").
+		// The view points into the buffer and stays valid until the next
+		// read_from() or compact(). Returns false when no full line is left
+		bool next_line(std::string_view& line);
+		// Moves the unfinished line (if any) back to the front of the storage.
+		// Call it once after all the lines of a read batch were handled
+		void compact();
+		// Puts back the line last handed out by next_line(), so it comes out
+		// again on the next call (a command deferred by flood control)
+		void unread(std::string_view line);
+		// Appends bytes as if they had been received (input handed over on a hot upgrade)
+		void append(std::string_view bytes);
+		// Number of lines dropped for being too long since the last call
+		size_t take_overlong();
+};
+
+#endif
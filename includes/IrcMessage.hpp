@@ -0,0 +1,26 @@
+#ifndef IRCMESSAGE_HPP
+# define IRCMESSAGE_HPP
+
+# include <string_view>
+# include <cstddef>
+
+// RFC 1459 / 2812: a message has at most 15 parameters
+# define IRC_MAX_PARAMS 15
+
+// One parsed IRC line:  [":" prefix SPACE] command *(SPACE param) [SPACE ":" trailing]
+// Every field is a view into the line that was parsed, nothing is allocated,
+// so the message is only valid as long as that line is.
+struct IrcMessage
+{
+	std::string_view prefix; // Without the leading ':' (empty when there is none)
+	std::string_view command; // As sent by the client (case is not normalized)
+	std::string_view params[IRC_MAX_PARAMS];
+	size_t param_count;
+	bool has_trailing; // The last param was introduced by ':' (it may contain spaces or be empty)
+};
+
+// Splits line (without its CRLF) into msg.
+// Returns false when the line holds no command (empty or prefix only).
+bool parse_irc_message(std::string_view line, IrcMessage& msg);
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef LOGGER_HPP
+# define LOGGER_HPP
+
+# include <atomic>       // For the ring buffer indexes
+# include <thread>       // For the background writer
+# include <memory>
+# include <string>
+# include <string_view>
+# include <cstdint>
+# include <cstddef>
+# include <charconv>     // For std::to_chars
+
+enum LogLevel
+{
+	LOG_LEVEL_DEBUG = 0,
+	LOG_LEVEL_INFO = 1,
+	LOG_LEVEL_WARN = 2,
+	LOG_LEVEL_ERROR = 3,
+	LOG_LEVEL_OFF = 4
+};
+
+// Levels below LOG_MIN_LEVEL are removed at compile time (their arguments are
+// not even evaluated). Build with -DLOG_MIN_LEVEL=0 to get the debug logs back
+# ifndef LOG_MIN_LEVEL
+#  define LOG_MIN_LEVEL 1
+# endif
+# ifndef LOG_RING_SLOTS
+#  define LOG_RING_SLOTS 8192 // Records the ring buffer can hold (power of two)
+# endif
+# define LOG_RECORD_SIZE 240 // Longer messages are truncated
+
+// Asynchronous logger.
+// The event loop formats a record straight into a slot of a lock-free
+// single-producer / single-consumer ring buffer; a background thread writes
+// the records to the log file (or stderr) in batches. When the ring is full
+// the record is dropped and counted instead of blocking the event loop.
+//
+// Only the event-loop thread may log (single producer). Signal handlers must not.
+class Logger
+{
+	public:
+		struct Slot
+		{
+			int64_t time_ms; // Wall clock, milliseconds
+			uint8_t level;
+			uint16_t length;
+			char text[LOG_RECORD_SIZE];
+		};
+
+	private:
+		std::unique_ptr<Slot[]> _slots;
+		alignas(64) std::atomic<size_t> _head; // Next slot to write (producer)
+		alignas(64) std::atomic<size_t> _tail; // Next slot to read (consumer)
+		alignas(64) std::atomic<uint64_t> _dropped;
+		std::atomic<bool> _running;
+		std::atomic<int> _level; // Runtime threshold, on top of LOG_MIN_LEVEL
+		std::thread _writer;
+		int _fd; // Where the batches are written
+		bool _owns_fd;
+		bool _colors; // Colored level tags when writing to a terminal
+
+		Logger();
+		void writer_loop();
+		size_t drain(std::string& batch);
+		void write_all(const std::string& batch);
+
+	public:
+		Logger(const Logger&) = delete;
+		Logger& operator=(const Logger&) = delete;
+		~Logger();
+
+		static Logger& instance();
+
+		// Opens path for appending ("" = stderr) and starts the writer thread
+		void start(const std::string& path, LogLevel level);
+		// Stops the writer thread and flushes what is left in the ring
+		void stop();
+		void set_level(LogLevel level);
+		bool enabled(LogLevel level) const { return level >= _level.load(std::memory_order_relaxed); }
+		uint64_t dropped() const;
+
+		// Producer side, used by LogRecord
+		Slot* reserve();
+		void commit();
+};
+
+// Builds one log line in place inside a ring slot, published when destroyed.
+// Use it through the LOG_* macros: LOG_INFO("Client FD " << fd << " connected");
+class LogRecord
+{
+	private:
+		Logger::Slot* _slot; // NULL when the ring was full (the record is dropped)
+		size_t _length;
+
+		void append(const char* data, size_t size);
+		template <typename T>
+		LogRecord& append_number(T value)
+		{
+			char buffer[24];
+			std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+			append(buffer, result.ptr - buffer);
+			return *this;
+		}
+
+	public:
+		explicit LogRecord(LogLevel level);
+		LogRecord(const LogRecord&) = delete;
+		LogRecord& operator=(const LogRecord&) = delete;
+		~LogRecord();
+
+		LogRecord& operator<<(std::string_view text) { append(text.data(), text.size()); return *this; }
+		LogRecord& operator<<(const char* text) { return *this << std::string_view(text ? text : "(null)"); }
+		LogRecord& operator<<(const std::string& text) { return *this << std::string_view(text); }
+		LogRecord& operator<<(char c) { append(&c, 1); return *this; }
+		LogRecord& operator<<(bool value) { return *this << (value ? "true" : "false"); }
+		LogRecord& operator<<(int value) { return append_number(value); }
+		LogRecord& operator<<(unsigned int value) { return append_number(value); }
+		LogRecord& operator<<(long value) { return append_number(value); }
+		LogRecord& operator<<(unsigned long value) { return append_number(value); }
+		LogRecord& operator<<(long long value) { return append_number(value); }
+		LogRecord& operator<<(unsigned long long value) { return append_number(value); }
+};
+
+# define LOG_AT(level, message) \
+	do { if (Logger::instance().enabled(level)) { LogRecord log_record_(level); log_record_ << message; } } while (0)
+
+# if LOG_MIN_LEVEL <= 0
+#  define LOG_DEBUG(message) LOG_AT(LOG_LEVEL_DEBUG, message)
+# else
+#  define LOG_DEBUG(message) do {} while (0)
+# endif
+# if LOG_MIN_LEVEL <= 1
+#  define LOG_INFO(message) LOG_AT(LOG_LEVEL_INFO, message)
+# else
+#  define LOG_INFO(message) do {} while (0)
+# endif
+# if LOG_MIN_LEVEL <= 2
+#  define LOG_WARN(message) LOG_AT(LOG_LEVEL_WARN, message)
+# else
+#  define LOG_WARN(message) do {} while (0)
+# endif
+# define LOG_ERROR(message) LOG_AT(LOG_LEVEL_ERROR, message)
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef METRICS_HPP
+# define METRICS_HPP
+
+# include <string>
+# include <cstdint>
+# include <cstddef>
+# include "Commands.hpp"
+
+// Log-linear latency histogram (HDR style), values in nanoseconds.
+// Values below 2^HISTOGRAM_SUB_BITS get their own bucket; above that every
+// power of two is split into 2^HISTOGRAM_SUB_BITS linear buckets, so any
+// recorded value is known within 1 / 2^HISTOGRAM_SUB_BITS (6.25%).
+// Recording is one bit scan and one increment: cheap enough for every line.
+# define HISTOGRAM_SUB_BITS 4
+# define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+# define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+class LatencyHistogram
+{
+	private:
+		uint64_t _buckets[HISTOGRAM_BUCKETS];
+		uint64_t _count;
+		uint64_t _sum;
+		uint64_t _max;
+
+		static size_t bucket_index(uint64_t value);
+		static uint64_t bucket_upper_bound(size_t index);
+
+	public:
+		LatencyHistogram();
+
+		void record(uint64_t nanoseconds);
+		// Smallest bucket bound under which a fraction p (0..1) of the values falls
+		uint64_t percentile(double p) const;
+		uint64_t count() const { return _count; }
+		uint64_t sum() const { return _sum; }
+		uint64_t max() const { return _max; }
+};
+
+// Counters of everything the server does, updated inline on the event-loop
+// thread (no atomics needed) and read by STATS and the metrics socket.
+struct Metrics
+{
+	uint64_t start_time_ns;
+	uint64_t bytes_received = 0;
+	uint64_t bytes_sent = 0;
+	uint64_t send_calls = 0; // writev() calls, or writes submitted to io_uring
+	uint64_t lines_parsed = 0;
+	uint64_t commands[CMD_COUNT] = {}; // Indexed by CommandId, CMD_UNKNOWN included
+	uint64_t accepts = 0;
+	uint64_t disconnects = 0;
+	uint64_t loop_iterations = 0;
+	uint64_t lines_deferred = 0; // Lines put back by flood control (counted on every attempt)
+	uint64_t excess_flood_disconnects = 0;
+	uint64_t lines_too_long = 0; // Dropped for being longer than MAX_LINE_LENGTH
+	uint64_t input_yields = 0; // Client turns cut short by the read or line budget
+	uint64_t history_replayed = 0; // History lines sent on JOIN or CHATHISTORY
+	size_t send_queue_high_water = 0; // Largest send queue seen on any client, in bytes
+	LatencyHistogram command_latency; // Line received -> its command handled
+	LatencyHistogram loop_latency; // One event-loop iteration, wait() excluded
+
+	Metrics();
+
+	static Metrics& instance();
+	static uint64_t now_ns(); // Monotonic clock
+
+	void note_send_queue(size_t bytes) { if (bytes > send_queue_high_water) send_queue_high_water = bytes; }
+	uint64_t uptime_seconds() const;
+	// Prometheus text exposition format. The gauges come from the server
+	std::string to_prometheus(size_t clients, size_t channels) const;
+};
+
+// Local Unix socket serving the Prometheus text: every connection gets one
+// dump and is closed, e.g. "socat - UNIX-CONNECT:/tmp/ircserv.metrics"
+class MetricsListener
+{
+	private:
+		int _fd;
+		std::string _path;
+
+	public:
+		explicit MetricsListener(const std::string& path);
+		MetricsListener(const std::string& path, int fd); // Adopts a socket already bound to path (hot upgrade)
+		MetricsListener(const MetricsListener&) = delete;
+		MetricsListener& operator=(const MetricsListener&) = delete;
+		~MetricsListener();
+
+		int get_fd() const;
+		// Accepts every pending connection and writes payload to each of them
+		void serve(const std::string& payload);
+		// Closes our copy but leaves the socket file: another process serves it now
+		void hand_over();
+};
+
+#endif
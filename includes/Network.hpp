@@ -0,0 +1,90 @@
+#ifndef NETWORK_HPP
+# define NETWORK_HPP
+
+# include <string>
+# include <string_view>
+# include <vector>
+# include "ChannelName.hpp"
+
+// Remote users get negative ids, stored next to the local client fds in the
+// NicknameIndex and in the channel member lists. -1 already means "nobody"
+// there, so the ids start at -2. Sorted member lists keep the remote members
+// first, before every local fd
+# define REMOTE_ID_FIRST -2
+
+// Another server of the network, linked to us directly (hopcount 1) or
+// through one of our links
+struct RemoteServer
+{
+	std::string name;
+	std::string uplink; // Server that introduced it, our own name for our direct links
+	std::string info;
+	unsigned int hopcount;
+	int link_fd; // The link it is reached through
+};
+
+// A user connected to another server of the network
+struct RemoteUser
+{
+	std::string nickname;
+	std::string username;
+	std::string hostname;
+	std::string realname;
+	std::string server; // Where the user is connected
+	std::string prefix; // "nick!user@host", rebuilt with update_prefix()
+	unsigned int hopcount;
+	int link_fd; // The link the user is reached through
+	std::vector<ChannelName> channels; // Reverse index, like Client::get_channels()
+	bool used;
+
+	void update_prefix();
+	void remove_channel(const ChannelName& channel_name);
+};
+
+// What the server knows about the rest of the network: the other servers
+// and their users. Only the state, the protocol is in Server (handle_server
+// and the link_* handlers). The servers form a spanning tree: each one is
+// reached through exactly one of our links.
+class Network
+{
+	private:
+		std::vector<RemoteServer> _servers; // In introduction order: a server always comes after its uplink
+		std::vector<RemoteUser> _users; // Indexed by REMOTE_ID_FIRST - id, freed slots are reused
+		std::vector<int> _free_ids;
+		size_t _user_count;
+
+	public:
+		Network();
+
+		static bool is_remote(int id) { return id <= REMOTE_ID_FIRST; }
+
+		// Servers. Names are case-insensitive
+		const std::vector<RemoteServer>& get_servers() const;
+		const RemoteServer* find_server(std::string_view name) const;
+		const RemoteServer* find_link(int link_fd) const; // The server at the other end of a direct link
+		void add_server(const RemoteServer& server);
+		// Removes the server called name and every server behind it, or every
+		// server reached through link_fd. Returns the names of the removed servers
+		std::vector<std::string> remove_servers(std::string_view name);
+		std::vector<std::string> remove_link(int link_fd);
+
+		// Users
+		int add_user(RemoteUser user); // Returns the new user's id
+		RemoteUser* find_user(int id);
+		void remove_user(int id);
+		size_t user_count() const;
+		// Calls f(id, user) for every user
+		template <typename Function>
+		void for_each_user(Function f)
+		{
+			for (size_t i = 0; i < _users.size(); ++i)
+			{
+				if (_users[i].used)
+					f(REMOTE_ID_FIRST - static_cast<int>(i), _users[i]);
+			}
+		}
+
+		static bool is_valid_server_name(std::string_view name);
+};
+
+#endif
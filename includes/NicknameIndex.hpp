@@ -0,0 +1,48 @@
+#ifndef NICKNAMEINDEX_HPP
+# define NICKNAMEINDEX_HPP
+
+# include <string>
+# include <string_view>
+# include <memory>
+# include <unordered_map>
+# include "CaseMapping.hpp"
+
+# define NICKLEN 30 // Maximum nickname length
+
+// Case-insensitive nickname -> client fd index.
+// Keys are folded with the server's CaseMapping, so "Bob" and "bob" are one
+// nickname and every lookup is a single hash lookup instead of a walk over
+// all the clients. The key is a view into the entry's own folded copy, so a
+// lookup folds the requested name on the stack, without allocating.
+// Nicknames longer than NICKLEN are never stored.
+class NicknameIndex
+{
+	private:
+		struct Entry
+		{
+			std::unique_ptr<const std::string> key; // The folded nickname the map key points into
+			int fd;
+		};
+
+		std::unordered_map<std::string_view, Entry> _fds; // folded nickname -> client fd
+		CaseMapping _mapping;
+
+		// Folds name into buffer (NICKLEN bytes), name must fit
+		std::string_view fold(std::string_view name, char* buffer) const;
+
+	public:
+		explicit NicknameIndex(CaseMapping mapping = CASEMAPPING_RFC1459);
+		NicknameIndex(const NicknameIndex&) = delete;
+		NicknameIndex& operator=(const NicknameIndex&) = delete;
+
+		// fd of the client using nickname, or -1
+		int find(std::string_view nickname) const;
+		// Returns false (and changes nothing) when nickname is already used by
+		// another fd, or is longer than NICKLEN
+		bool insert(std::string_view nickname, int client_fd);
+		void erase(std::string_view nickname);
+		size_t size() const;
+		CaseMapping get_casemapping() const;
+};
+
+#endif
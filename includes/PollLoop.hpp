@@ -0,0 +1,31 @@
+#ifndef POLLLOOP_HPP
+# define POLLLOOP_HPP
+
+# include "EventLoop.hpp"
+# include <poll.h>          // For poll(), pollfd
+# include <unordered_map>   // For fd -> index in _pollfds
+
+// Level-triggered fallback backend built on poll().
+// poll() itself still scans every registered fd, but registration and
+// removal are O(1) thanks to the fd -> index map (swap with last on removal).
+class PollLoop : public EventLoop
+{
+	private:
+		std::vector<pollfd> _pollfds; // List of file descriptors poll() should monitor
+		std::unordered_map<int, size_t> _index; // fd -> position inside _pollfds
+
+		static short to_poll_events(unsigned int events);
+
+	public:
+		PollLoop() = default;
+		~PollLoop() = default;
+
+		void add(int fd, unsigned int events);
+		void modify(int fd, unsigned int events);
+		void remove(int fd);
+		int wait(std::vector<IoEvent>& ready, int timeout_ms);
+		bool is_edge_triggered() const;
+		const char* name() const;
+};
+
+#endif
@@ -5,24 +5,36 @@
 # include <string>       // For password
 # include <vector>       // For pollfd vector
 # include <poll.h>       // For poll(), pollfd
-# include <iostream>     // For logging
+# include "Logger.hpp"   // For logging
 # include <netinet/in.h> // For sockaddr_in
 # include <arpa/inet.h>  // For htons()
 # include <csignal>     // For signal handling
 # include <map>
 # include <unordered_map> // For mapping client file descriptors to Client objects
-# include "Client.hpp"
+# include "ClientTable.hpp"
 # include "Channel.hpp"
+# include "EventLoop.hpp"
+# include "Config.hpp"
+# include "IrcMessage.hpp"
+# include "Commands.hpp"
+# include "NicknameIndex.hpp"
+# include "ChannelRegistry.hpp"
+# include "Metrics.hpp"
+# include "TimerWheel.hpp"
+# include "Upgrade.hpp"
+# include "Network.hpp"
+# include "Snapshot.hpp"
 #include "../includes/Server.hpp"
 #include "../includes/Colors.hpp"
 #include <stdexcept>
 #include <cstring> // For strerror
-#include <sstream> // For std::istringstream
 
 // Constants
 # define DEFAULT_PORT 6667 // Default port for IRC servers
 # define MAX_PORT_NBR 65535 // Maximum port number
-# define BACKLOG 10 // Backlog for listen()
+# define SERVER_INFO "ft_irc server" // Description given to the linked servers
+# define CHATHISTORY_MAX 100 // Most messages one CHATHISTORY returns
+# define ACCEPT_RETRY_MS 100 // Pause before accepting again once out of file descriptors
 
 class Server 
 {
@@ -30,39 +42,166 @@ class Server
 		Socket _listening_socket; // The socket that accepts new connections
 		int _port;
 		std::string _password;
-		std::vector<pollfd> _pollfds; // List of file descriptors poll() should monitor
-        std::unordered_map<int, Client> _clients; // Map of client fds to Client objects. For client data like read/write buffers, status, nickname, ...
-		std::map<std::string, Channel> _channels; // Map of channel names to Channel objects
-		static bool _signal_received; // For signal handling
+		std::unique_ptr<EventLoop> _event_loop; // poll() or epoll backend watching the listening socket and every client
+		std::vector<IoEvent> _ready_events; // Filled by _event_loop->wait() on every iteration
+		std::vector<ClientHandle> _ready_handles; // Connection each ready event belongs to, see run()
+		size_t _recv_chunk_size; // Bytes asked to recv() per call for every client
+		int _listen_backlog; // Backlog for listen()
+		size_t _accept_batch; // Connections accepted per loop iteration at most
+		bool _accept_pending; // The last batch hit _accept_batch: the accept queue may not be empty
+		uint64_t _accept_retry_ms; // When accepting resumes after running out of fds, 0 when not paused
+		size_t _read_budget; // Bytes read from one client per loop iteration at most
+		size_t _line_budget; // Lines handled for one client per loop iteration at most
+        ClientTable _clients; // Dense fd-indexed table of Client objects. For client data like read/write buffers, status, nickname, ...
+		ChannelRegistry _channels; // Case-insensitive hash of channel names to Channel objects
+		NicknameIndex _nicknames; // Case-insensitive nickname -> client fd, for O(1) NICK checks and lookups
+		size_t _history_join_replay; // Messages of a channel's history replayed on JOIN
+		uint64_t _history_batch_id; // Last BATCH reference given to a CHATHISTORY reply
+		std::string _oper_password; // OPER password, OPER is refused when empty
+		std::string _server_name; // Our name on the network of linked servers
+		std::string _link_password; // Shared by the linked servers, links are refused when empty
+		Network _network; // The other servers of the network and their users
+		std::vector<int> _links; // fds of our registered links, in the order they were made
+		std::string_view _link_line; // Line being handled from a link, for the handlers that forward it as is
+		std::unique_ptr<MetricsListener> _metrics_listener; // Prometheus dump on a Unix socket, NULL when disabled
+		uint64_t _now_ms; // Monotonic clock, read once per loop iteration
+		TimerWheel _timers; // One timer per client: registration, keepalive and PONG deadlines
+		std::vector<int> _expired_timers; // Owners of the timers that fired, filled by _timers.advance()
+		uint64_t _registration_timeout_ms;
+		uint64_t _ping_interval_ms;
+		uint64_t _ping_timeout_ms;
+		uint64_t _idle_timeout_ms; // 0: idle clients are never reaped
+		FloodLimit _flood_limits[FLOOD_CLASS_COUNT]; // Indexed by FloodClass
+		uint64_t _flood_excess_timeout_ms; // Deferring input for that long disconnects with "Excess Flood"
+		size_t _flood_max_backlog; // Same when the deferred input grows past this many bytes
+		std::vector<ClientHandle> _throttled; // Clients with lines deferred by flood control
+		std::vector<ClientHandle> _resuming; // _throttled being worked through, see run_throttled_clients()
+		std::vector<ClientHandle> _input_pending; // Clients with input left over by the budgets, served next iteration
+		std::vector<ClientHandle> _input_resuming; // _input_pending taken at the start of an iteration, see run_pending_input()
+		std::vector<int> _flush_list; // Clients with corked output, written by flush_clients() at the end of the iteration
+		std::string _snapshot_path; // IRCSERV_SNAPSHOT_FILE, empty when disabled
+		std::string _snapshot_temp_path; // Written first, then renamed over _snapshot_path
+		uint64_t _snapshot_interval_ms;
+		uint64_t _next_snapshot_ms;
+		uint64_t _snapshot_generation; // _channels.generation() the last snapshot was taken at
+		pid_t _snapshot_pid; // Child writing a snapshot, -1 when none
+		std::vector<ClientHandle> _inherited_input; // Clients handed over with unhandled lines, dispatched when run() starts
+		static volatile sig_atomic_t _signal_received; // For signal handling
+		static volatile sig_atomic_t _upgrade_requested; // SIGUSR2: hand everything over to a new process, see hot_upgrade()
 
 		// Helper methods for socket setup (optional, can be in constructor)
 		bool valid_inputs(int port, const std::string& password);
 		sockaddr_in create_sockaddr_in(int port);
 		pollfd create_pollfd();
 		void handle_new_connection();
-		void handle_disconnection(size_t& index);
+		void pause_accepting();
+		void resume_accepting();
+		void add_client(int client_fd);
+		void handle_disconnection(int client_fd, const std::string& reason = "Connection closed");
+		void leave_all_channels(int client_fd, const std::string& reason);
+		void close_link(int client_fd, const std::string& reason);
+		void run_timers();
+		void handle_client_timer(int client_fd);
+		// Hot upgrade
+		bool hot_upgrade();
+		bool settle_sends();
+		UpgradeState snapshot() const;
+		void restore(const UpgradeState& state);
+		pid_t spawn_successor(int socket_fd) const;
 		void setup_listening_socket();
 		void bind_listening_socket();
 		void listen_on_socket();
-		void handle_authentication(size_t &index, int client_fd, const std::vector<std::string>& lines);
-		void process_client_data(size_t& index, int client_fd);
-		bool is_duplicate_nickname(const std::string& nickname);
+		void process_client_data(int client_fd);
+		bool dispatch_buffered_lines(int client_fd, size_t max_lines);
+		void queue_input(int client_fd);
+		void run_pending_input();
+		void run_throttled_clients();
+		// Snapshots of the channels (see Snapshot)
+		void load_snapshot();
+		void run_snapshot();
+		void write_final_snapshot();
+		void flush_clients();
+		int next_wait_ms();
+		bool is_duplicate_nickname(std::string_view nickname, int client_fd);
+		static bool is_valid_nickname(std::string_view nickname);
         // Helper methods for authentication
-        int parse_pass(std::string line, int client_fd);
-        int parse_nick(std::string line, int client_fd);
-        int parse_user(std::string line, int client_fd);
-		int handle_client_command(size_t &index, int client_fd, const std::vector<std::string>& lines);
+        int parse_pass(std::string_view pass, int client_fd);
+        int parse_nick(std::string_view nick, int client_fd);
+        int parse_user(const IrcMessage& msg, int client_fd);
+		void try_complete_registration(int client_fd);
+
+		// Command dispatch: one handler per CommandId, looked up in _command_handlers.
+		// A handler returns false when it disconnected the client
+		typedef bool (Server::*CommandHandler)(int client_fd, const IrcMessage& msg);
+		static const CommandHandler _command_handlers[CMD_COUNT];
+		enum DispatchResult
+		{
+			DISPATCH_DONE,
+			DISPATCH_DEFERRED, // Over the flood limit, the line was not handled
+			DISPATCH_DISCONNECTED // The command disconnected the client
+		};
+		DispatchResult dispatch_command(int client_fd, std::string_view line);
+		bool handle_pass(int client_fd, const IrcMessage& msg);
+		bool handle_nick(int client_fd, const IrcMessage& msg);
+		bool handle_user(int client_fd, const IrcMessage& msg);
+		bool handle_join(int client_fd, const IrcMessage& msg);
+		bool handle_part(int client_fd, const IrcMessage& msg);
+		bool handle_privmsg(int client_fd, const IrcMessage& msg);
+		bool handle_quit(int client_fd, const IrcMessage& msg);
+		bool handle_notice(int client_fd, const IrcMessage& msg);
+		bool handle_oper(int client_fd, const IrcMessage& msg);
+		bool handle_stats(int client_fd, const IrcMessage& msg);
+		bool handle_ping(int client_fd, const IrcMessage& msg);
+		bool handle_pong(int client_fd, const IrcMessage& msg);
+		bool handle_chathistory(int client_fd, const IrcMessage& msg);
+		void replay_history(int client_fd, const Channel& channel, HistorySelector selector, uint64_t time_ms, size_t limit);
+		bool handle_server(int client_fd, const IrcMessage& msg);
+		bool handle_squit(int client_fd, const IrcMessage& msg);
+		bool handle_connect(int client_fd, const IrcMessage& msg);
+		bool handle_links(int client_fd, const IrcMessage& msg);
+		void deliver_message(int client_fd, const IrcMessage& msg, const char* command, bool is_notice);
+
+		// Server-to-server links: the same parsing, another handler table.
+		// Handlers get the link's fd; the source of a message is its prefix
+		static const CommandHandler _link_handlers[CMD_COUNT];
+		bool dispatch_link_command(int link_fd, std::string_view line, const IrcMessage& msg, CommandId id);
+		bool accept_link(int link_fd, const IrcMessage& msg);
+		void send_burst(int link_fd);
+		void drop_link(int link_fd, const std::string& reason);
+		void split_servers(const std::vector<std::string>& servers, const std::string& reason);
+		void remove_remote_user(int id, const SharedBuffer& quit_message);
+		int link_source(int link_fd, const IrcMessage& msg);
+		void send_to_links(const SharedBuffer& message, int except_link);
+		void send_to_channel_links(const Channel& channel, const SharedBuffer& message, int except_link);
+		static std::string user_introduction(const std::string& nickname, unsigned int hopcount, const std::string& username,
+			const std::string& hostname, const std::string& server, const std::string& realname);
+		bool link_pass(int link_fd, const IrcMessage& msg);
+		bool link_server(int link_fd, const IrcMessage& msg);
+		bool link_squit(int link_fd, const IrcMessage& msg);
+		bool link_nick(int link_fd, const IrcMessage& msg);
+		bool link_join(int link_fd, const IrcMessage& msg);
+		bool link_njoin(int link_fd, const IrcMessage& msg);
+		bool link_part(int link_fd, const IrcMessage& msg);
+		bool link_message(int link_fd, const IrcMessage& msg);
+		bool link_quit(int link_fd, const IrcMessage& msg);
+		bool link_kill(int link_fd, const IrcMessage& msg);
+		bool link_ping(int link_fd, const IrcMessage& msg);
+		bool link_error(int link_fd, const IrcMessage& msg);
+		void send_numeric(int client_fd, const char* code, const std::string& text);
 
 		public:
 		// Socket get_listening_socket() const;
 		// Constructor: Sets up the server with port and password, creates and binds listening socket
-		Server(int port, const std::string& password);
+		// With upgrade, the listening socket and the clients are taken over from
+		// the process that sent it instead of being created
+		Server(int port, const std::string& password, const Config& config = Config(), const UpgradeState* upgrade = NULL);
 		// The main server loop
 		void run();
 		// Destructor (optional for Block 1, but good practice): Cleans up resources
 		~Server();
 		// signal handling methods
 		static void handle_signal(int signum);
+		static void handle_upgrade_signal(int signum);
 		static void setup_signal_handlers();
 		
 		// void handle_new_connection();
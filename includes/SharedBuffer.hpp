@@ -0,0 +1,17 @@
+#ifndef SHAREDBUFFER_HPP
+# define SHAREDBUFFER_HPP
+
+# include <memory>  // For std::shared_ptr
+# include <string>
+
+// An outgoing message serialized once and shared by every send queue it is
+// put on. Fanning a line out to N clients costs one payload plus N pointers,
+// and the payload is freed when the last queue has written it.
+typedef std::shared_ptr<const std::string> SharedBuffer;
+
+inline SharedBuffer make_shared_buffer(std::string message)
+{
+	return std::make_shared<const std::string>(std::move(message));
+}
+
+#endif
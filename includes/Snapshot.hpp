@@ -0,0 +1,31 @@
+#ifndef SNAPSHOT_HPP
+# define SNAPSHOT_HPP
+
+# include <string>
+# include <cstddef>
+# include "ChannelRegistry.hpp"
+
+# define SNAPSHOT_BUFFER_SIZE (64 * 1024) // Bytes gathered before each write()
+
+// Durable state kept across restarts in IRCSERV_SNAPSHOT_FILE: the channels
+// and their history (connections and memberships are not durable, a hot
+// upgrade carries those). The format is a flat binary file in host byte
+// order, read where the kernel mapped it:
+//   "IRCS" magic, version, channel count (u32 each)
+//   per channel: name (u32 length + bytes), message count (u32),
+//                per message: time_ms (u64), line (u32 length + bytes)
+class Snapshot
+{
+	public:
+		// Writes the channels worth keeping (members or history) to temp_path,
+		// then renames it over path, so a crash never leaves half a file.
+		// Only open/write/fsync/rename and no allocation: safe in a child
+		// forked from the multi-threaded server. false on failure, errno set
+		static bool write(const char* path, const char* temp_path, const ChannelRegistry& channels);
+		// Recreates the channels of the snapshot at path, memberless. Returns
+		// how many, 0 when there is no file. Throws std::runtime_error when
+		// the file is corrupt
+		static size_t load(const std::string& path, ChannelRegistry& channels, ClientTable& clients);
+};
+
+#endif
@@ -14,24 +14,22 @@ class Socket
 {
 	private:
 		int _fd;
-		//TODO: should we disable copy and assignment to prevent double-closing the same FD??
-		// Socket(const Socket&);
-		// Socket& operator=(const Socket&);
 
 	public:
 		Socket();
 		// Constructor: Wraps an existing file descriptor (useful for accepted connections)
 		explicit Socket(int fd);
+		// Copying would close the same fd twice; moving hands it over
+		Socket(const Socket&) = delete;
+		Socket& operator=(const Socket&) = delete;
+		Socket(Socket&& other);
 		// Destructor: Ensures the socket is closed
 		~Socket();
 
 		int get_fd() const;
-		// Set the socket to non-blocking mode
-		void set_nonblocking();
-
 		// void bind(int port);
 		// void listen(int backlog);
-		std::unique_ptr<Socket> accept() const; // Returns a new Socket object for the client (or unique_ptr)
+		int accept() const; // fd of the accepted connection (non-blocking, close-on-exec), -1 with errno set otherwise (EAGAIN when there is none)
 		// ssize_t send(const void* buf, size_t len, int flags = 0);
 		// ssize_t recv(void* buf, size_t len, int flags = 0);
 };
@@ -0,0 +1,75 @@
+#ifndef TIMERWHEEL_HPP
+# define TIMERWHEEL_HPP
+
+# include <vector>
+# include <cstdint>
+# include <cstddef>
+
+# define TIMER_TICK_MS 100 // Resolution of the wheel
+# define TIMER_LEVEL_BITS 6
+# define TIMER_SLOTS (1 << TIMER_LEVEL_BITS) // Slots per level
+# define TIMER_LEVELS 4 // 64^4 ticks of 100 ms: about 19 days of range
+
+class TimerWheel;
+
+// Intrusive timer: embedded in the object it times (a Client), so arming
+// and cancelling never allocate. Destroying an armed node cancels it.
+struct TimerNode
+{
+	TimerNode* prev = NULL;
+	TimerNode* next = NULL;
+	TimerWheel* wheel = NULL; // Set while armed
+	uint64_t expires = 0; // Tick at which the timer fires
+	int owner = -1; // Free for the user of the wheel (the client fd)
+
+	TimerNode() = default;
+	TimerNode(const TimerNode&) = delete;
+	TimerNode& operator=(const TimerNode&) = delete;
+	~TimerNode();
+
+	bool armed() const { return wheel != NULL; }
+	void unlink();
+};
+
+// Hashed hierarchical timer wheel.
+// Level 0 has one slot per tick, each higher level one slot per full turn of
+// the level below. A timer goes into the lowest level that covers its delay
+// and moves down a level each time its slot comes up (cascade), so insert and
+// cancel are O(1) and a tick only touches the timers that are due or cascade,
+// however many are armed.
+class TimerWheel
+{
+	private:
+		TimerNode _slots[TIMER_LEVELS][TIMER_SLOTS]; // Sentinel heads of circular lists
+		uint64_t _start_ms;
+		uint64_t _current_tick;
+		size_t _armed;
+
+		void insert(TimerNode& node);
+		void cascade(size_t level, size_t index);
+		static bool slot_empty(const TimerNode& head) { return head.next == &head; }
+
+		friend struct TimerNode;
+
+	public:
+		explicit TimerWheel(uint64_t now_ms);
+		TimerWheel(const TimerWheel&) = delete;
+		TimerWheel& operator=(const TimerWheel&) = delete;
+		~TimerWheel();
+
+		static uint64_t monotonic_ms();
+
+		// (Re)arms node to fire delay_ms after now_ms. The wheel's own tick may
+		// lag behind now_ms (advance() runs at the end of a loop iteration, and
+		// not at all while the loop sleeps with nothing armed): it only counts
+		// as the start when it is ahead
+		void schedule(TimerNode& node, uint64_t now_ms, uint64_t delay_ms);
+		void cancel(TimerNode& node);
+		// Moves the wheel to now_ms and appends the owners of the timers that fired
+		void advance(uint64_t now_ms, std::vector<int>& expired_owners);
+		// Milliseconds the event loop may sleep before advance() has work, -1 when nothing is armed
+		int next_timeout_ms(uint64_t now_ms) const;
+		size_t size() const;
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef UPGRADE_HPP
+# define UPGRADE_HPP
+
+# include <string>
+# include <vector>
+# include <cstddef>
+# include <cstdint>
+
+// Environment variable telling a freshly exec'd ircserv that it takes over
+// from a running one: the fd of the Unix socket the state arrives on
+# define UPGRADE_FD_VARIABLE "IRCSERV_UPGRADE_FD"
+# define UPGRADE_FDS_PER_MESSAGE 250 // SCM_RIGHTS carries at most 253 fds per message
+# define UPGRADE_ACK_TIMEOUT_MS 10000 // How long the old process waits for the new one to take over
+
+// One connected client, as handed over on a hot upgrade (SIGUSR2).
+// The timers and flood buckets are not carried: they start afresh
+struct UpgradeClient
+{
+	int fd; // In the sending process; the receiver fills in its own fd
+	std::string nickname;
+	std::string username;
+	std::string realname;
+	bool passed_pass;
+	bool passed_nick;
+	bool passed_user;
+	bool authenticated;
+	bool is_operator;
+	std::string pending_input; // Received, not handled yet (an unfinished line, deferred lines)
+	std::string pending_output; // Queued, not written yet
+};
+
+// A message of a channel's history
+struct UpgradeMessage
+{
+	uint64_t time_ms;
+	std::string line;
+};
+
+struct UpgradeChannel
+{
+	std::string name;
+	std::vector<uint32_t> members; // Indexes into UpgradeState::clients
+	std::vector<UpgradeMessage> history; // Oldest first
+};
+
+// Everything a new process needs to carry on serving the clients of the old
+// one. It travels over a Unix socket: a length-prefixed binary blob, then the
+// sockets themselves with SCM_RIGHTS (listening socket, metrics socket when
+// there is one, then the clients in order).
+struct UpgradeState
+{
+	int listening_fd = -1;
+	int metrics_fd = -1;
+	std::vector<UpgradeClient> clients;
+	std::vector<UpgradeChannel> channels;
+
+	// Both throw std::runtime_error when the transfer fails
+	void send(int socket_fd) const;
+	static UpgradeState receive(int socket_fd);
+
+	// The new process tells the old one it took over, which then exits
+	static void acknowledge(int socket_fd);
+	// Old process side: true once the acknowledgement came, false on EOF or timeout
+	static bool wait_for_acknowledgement(int socket_fd, int timeout_ms);
+};
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef URINGLOOP_HPP
+# define URINGLOOP_HPP
+
+# include "EventLoop.hpp"
+
+// Built when the kernel headers know io_uring (no liburing needed: the ring
+// is driven with the raw syscalls). Whether the running kernel allows it is
+// only known at runtime, see EventLoop::create()
+# if defined(__linux__) && defined(__has_include)
+#  if __has_include(<linux/io_uring.h>)
+#   include <linux/io_uring.h>
+#   ifdef IORING_FEAT_EXT_ARG
+#    define IRCSERV_HAVE_IO_URING 1
+#   endif
+#  endif
+# endif
+
+# ifdef IRCSERV_HAVE_IO_URING
+
+#  include <sys/uio.h> // For iovec
+#  include <cstdint>
+
+#  define URING_ENTRIES 4096 // Submission queue size, the completion queue is twice as big
+#  define URING_IOV_ARENA 16384 // iovecs waiting for submission at most
+
+// io_uring backend.
+// Readiness comes from multishot POLL_ADD requests: a poll is armed once per
+// fd and keeps posting completions, so unlike epoll_ctl() nothing is paid per
+// event. Writes go through the ring too (submit_send()): every client's
+// WRITEV of the iteration is queued and handed to the kernel in the single
+// io_uring_enter() of the next wait(), together with the poll updates,
+// instead of one writev() syscall per client. For a channel broadcast that is
+// one syscall instead of one per member.
+//
+// Sockets are non-blocking, so a WRITEV that finds the socket full completes
+// right away with -EAGAIN instead of being parked in the kernel: the data
+// only has to stay valid until it is submitted, and the Client keeps it in
+// its queue until the completion anyway.
+class UringLoop : public EventLoop
+{
+	private:
+		// Per-fd state. seq changes on every add / modify / remove, and is
+		// part of the user_data of every request, so completions of an older
+		// registration (a removed fd, or a new client given the same fd) are
+		// recognized and dropped
+		struct FdState
+		{
+			uint32_t seq;
+			unsigned int events; // EventFlags the poll is armed for, 0 when not watched
+		};
+
+		int _ring_fd;
+		// Submission ring
+		void* _sq_ring;
+		size_t _sq_ring_size;
+		unsigned* _sq_head;
+		unsigned* _sq_tail;
+		unsigned* _sq_mask;
+		unsigned* _sq_array;
+		io_uring_sqe* _sqes;
+		size_t _sqes_size;
+		unsigned _sq_entries;
+		// Completion ring (shares the submission ring's mapping with IORING_FEAT_SINGLE_MMAP)
+		void* _cq_ring;
+		size_t _cq_ring_size;
+		unsigned* _cq_head;
+		unsigned* _cq_tail;
+		unsigned* _cq_mask;
+		io_uring_cqe* _cqes;
+
+		std::vector<FdState> _fds; // Indexed by fd
+		std::vector<iovec> _iov_arena; // Storage of the queued WRITEVs' iovecs until they are submitted
+		size_t _iov_used;
+		std::vector<IoEvent> _early; // Completions reaped to make room in the ring, reported by the next wait()
+
+		FdState& state(int fd);
+		io_uring_sqe* next_sqe();
+		void commit_sqe();
+		void arm_poll(int fd);
+		void cancel_poll(int fd);
+		int enter(unsigned to_submit, unsigned min_complete, unsigned flags, const void* arg, size_t arg_size);
+		void submit_pending();
+		void reap(std::vector<IoEvent>& ready);
+		void unmap();
+
+	public:
+		UringLoop();
+		UringLoop(const UringLoop&) = delete;
+		UringLoop& operator=(const UringLoop&) = delete;
+		~UringLoop();
+
+		void add(int fd, unsigned int events);
+		void modify(int fd, unsigned int events);
+		void remove(int fd);
+		int wait(std::vector<IoEvent>& ready, int timeout_ms);
+		bool is_edge_triggered() const;
+		const char* name() const;
+
+		bool batches_sends() const;
+		void submit_send(int fd, const iovec* iov, int iov_count);
+};
+
+# endif
+
+#endif
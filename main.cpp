@@ -33,15 +33,27 @@ int main(int argc, char** argv)
 	// >>> ADDED FOR SIGNAL HANDLING <<<
 	Server::setup_signal_handlers();
 
+	Config config = Config::from_environment();
+	// Logs are written by a background thread; stop() flushes what is left at exit
+	Logger::instance().start(config.log_file, config.log_level);
+	std::atexit([] { Logger::instance().stop(); });
+
 	try 
 	{
-		Server server(port, password); // Create the server object
+		// Started by a running ircserv on SIGUSR2: take its sockets over
+		std::unique_ptr<UpgradeState> upgrade;
+		if (config.upgrade_fd >= 0)
+			upgrade.reset(new UpgradeState(UpgradeState::receive(config.upgrade_fd)));
+		Server server(port, password, config, upgrade.get()); // Create the server object
+		// The old process exits once told we are serving its clients
+		if (upgrade)
+			UpgradeState::acknowledge(config.upgrade_fd);
 		server.run(); // Start the server's main loop
 	}
 	// Catch any exceptions thrown during setup or runtime
 	catch (const std::exception& e) 
 	{
-		std::cerr << "Server error: " << e.what() << std::endl;
+		LOG_ERROR("Server error: " << e.what());
 		return 1;
 	}
 	// The server loop is infinite, so this point is theoretically unreachable
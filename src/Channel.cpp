@@ -12,58 +12,88 @@
 
 # include "Channel.hpp"
 
-Channel::Channel(const std::string& name, std::unordered_map<int, Client>& clients) : _name(name), _clients_ref(clients)
+Channel::Channel(ChannelName name, ClientTable& clients) : _name(std::move(name)), _clients_ref(clients)
 {	
 }
 
-Channel::Channel(Channel&& other) : _name(std::move(other._name)), _clients(std::move(other._clients)), _clients_ref(other._clients_ref) {}
+Channel::Channel(Channel&& other) : _name(std::move(other._name)), _clients(std::move(other._clients)), _clients_ref(other._clients_ref), _history(std::move(other._history)) {}
 
-void Channel::add_client(int client_fd)
+bool Channel::has_client(int client_fd) const
 {
-	if (_clients.find(client_fd) == _clients.end())
-	{
-		_clients.insert(client_fd);
-		std::cout << "Client FD " << client_fd << " added to channel " << _name << std::endl;
-	}
-	else
-	{
-		std::cerr << "Client FD " << client_fd << " is already in channel " << _name << std::endl;
-	}
+	return std::binary_search(_clients.begin(), _clients.end(), client_fd);
+}
+
+bool Channel::empty() const
+{
+	return _clients.empty();
+}
+
+const std::string& Channel::get_name() const
+{
+	return _name->name;
+}
+
+const ChannelName& Channel::get_name_ref() const
+{
+	return _name;
 }
 
-void Channel::remove_client(int client_fd)
+const ChannelHistory& Channel::get_history() const
 {
-	if (_clients.find(client_fd) != _clients.end())
+	return _history;
+}
+
+ChannelHistory& Channel::get_history()
+{
+	return _history;
+}
+
+bool Channel::add_client(int client_fd)
+{
+	// Keep the vector sorted so membership checks are a binary search
+	auto it = std::lower_bound(_clients.begin(), _clients.end(), client_fd);
+	if (it == _clients.end() || *it != client_fd)
 	{
-		_clients.erase(client_fd);
-		std::cout << "Client FD " << client_fd << " removed from channel " << _name << std::endl;
+		_clients.insert(it, client_fd);
+		LOG_DEBUG("Client FD " << client_fd << " added to channel " << _name->name);
+		return true;
 	}
-	else
+	LOG_DEBUG("Client FD " << client_fd << " is already in channel " << _name->name);
+	return false;
+}
+
+bool Channel::remove_client(int client_fd)
+{
+	auto it = std::lower_bound(_clients.begin(), _clients.end(), client_fd);
+	if (it != _clients.end() && *it == client_fd)
 	{
-		std::cerr << "Client FD " << client_fd << " not found in channel " << _name << std::endl;
+		_clients.erase(it);
+		LOG_DEBUG("Client FD " << client_fd << " removed from channel " << _name->name);
+		return true;
 	}
+	LOG_DEBUG("Client FD " << client_fd << " not found in channel " << _name->name);
+	return false;
 }
 
-std::set<int> Channel::get_clients() const
+const std::vector<int>& Channel::get_clients() const
 {
 	return _clients;
 }
 
+// Serialize once: every member queues the same buffer
 void Channel::broadcast_message(const std::string& message, int sender_fd) const
+{
+	broadcast_message(make_shared_buffer(message), sender_fd);
+}
+
+void Channel::broadcast_message(const SharedBuffer& message, int sender_fd) const
 {
 	for (const auto& member_fd : _clients)
 	{
-		if (member_fd != sender_fd)
-		{
-			try
-			{
-			    _clients_ref.at(member_fd).send(message);
-			}
-			catch (const std::exception& e)
-			{
-			    std::cerr << "Failed to send join message to client: " << e.what() << std::endl;
-				return ;
-			}
-		}
+		if (member_fd == sender_fd)
+			continue;
+		// A failing member never stops the delivery to the others
+		if (Client* member = _clients_ref.find(member_fd))
+			member->send(message);
 	}
 }
@@ -0,0 +1,147 @@
+#include "../includes/ChannelRegistry.hpp"
+
+ChannelRegistry::ChannelRegistry(CaseMapping mapping, const HistoryLimits& history_limits)
+	: _mapping(mapping), _history_limits(history_limits), _history_bytes(0), _history_entries(0), _last_msgid(0), _generation(0)
+{
+}
+
+bool ChannelRegistry::is_valid_name(std::string_view name)
+{
+	if (name.size() < 2 || name.size() > CHANNELLEN || name[0] != '#')
+		return false;
+	return name.find_first_of(std::string_view(" ,\x07\0", 4)) == std::string_view::npos;
+}
+
+std::string_view ChannelRegistry::fold(std::string_view name, char* buffer) const
+{
+	size_t size = (name.size() < CHANNELLEN) ? name.size() : CHANNELLEN;
+	for (size_t i = 0; i < size; ++i)
+		buffer[i] = irc_tolower(name[i], _mapping);
+	return std::string_view(buffer, size);
+}
+
+Channel* ChannelRegistry::find(std::string_view name) const
+{
+	if (name.size() > CHANNELLEN)
+		return NULL;
+	char buffer[CHANNELLEN];
+	return find_by_key(fold(name, buffer));
+}
+
+Channel* ChannelRegistry::find_by_key(std::string_view key) const
+{
+	auto it = _channels.find(key);
+	return (it == _channels.end()) ? NULL : it->second.get();
+}
+
+Channel* ChannelRegistry::find_or_create(std::string_view name, ClientTable& clients, bool& created)
+{
+	created = false;
+	if (Channel* channel = find(name))
+		return channel;
+	// Intern the name once: the channel, the members' reverse index and the
+	// outgoing messages all share this single copy
+	ChannelName interned = std::make_shared<const ChannelNameData>(ChannelNameData{std::string(name), irc_casefold(name, _mapping)});
+	std::unique_ptr<Channel> channel = std::make_unique<Channel>(interned, clients);
+	Channel* raw = channel.get();
+	_channels.emplace(std::string_view(interned->key), std::move(channel));
+	created = true;
+	++_generation;
+	return raw;
+}
+
+void ChannelRegistry::release_if_empty(Channel* channel)
+{
+	if (!channel || !channel->empty() || !channel->get_history().empty())
+		return ;
+	// Erase through the iterator: the key is a view into the channel being destroyed
+	auto it = _channels.find(std::string_view(channel->get_name_ref()->key));
+	if (it != _channels.end())
+	{
+		_history_bytes -= channel->get_history().bytes();
+		_history_entries -= channel->get_history().size();
+		_channels.erase(it);
+		++_generation;
+	}
+}
+
+size_t ChannelRegistry::size() const
+{
+	return _channels.size();
+}
+
+void ChannelRegistry::reserve(size_t channel_count)
+{
+	_channels.reserve(channel_count);
+}
+
+void ChannelRegistry::record_history(Channel& channel, const SharedBuffer& line, uint64_t time_ms)
+{
+	if (_history_limits.lines == 0)
+		return ;
+	// Keep the times of the channel in order even if the wall clock steps
+	// back, the history is searched by time
+	ChannelHistory& history = channel.get_history();
+	if (!history.empty() && time_ms < history.at(history.size() - 1).time_ms)
+		time_ms = history.at(history.size() - 1).time_ms;
+	++_generation;
+	size_t bytes_before = history.bytes();
+	size_t entries_before = history.size();
+	bool stored = history.append(HistoryEntry{++_last_msgid, time_ms, line}, _history_limits);
+	_history_bytes = _history_bytes - bytes_before + history.bytes();
+	_history_entries = _history_entries - entries_before + history.size();
+	if (!stored)
+		return ;
+	_history_order.emplace_back(channel.get_name_ref(), _last_msgid);
+	while (_history_bytes > _history_limits.total_bytes && !_history_order.empty())
+	{
+		if (is_live(_history_order.front()))
+		{
+			Channel* oldest = find_by_key(_history_order.front().first->key);
+			_history_bytes -= oldest->get_history().pop_oldest();
+			--_history_entries;
+			// Its last message, with nobody in it. Not the channel recorded
+			// into: the caller still holds it, and releases it if need be
+			if (oldest != &channel)
+				release_if_empty(oldest);
+		}
+		_history_order.pop_front();
+	}
+	if (_history_order.size() > 2 * _history_entries + 1024)
+		compact_history_order();
+}
+
+// A channel's history holds a contiguous run of its msgids: an entry is still
+// stored when the channel exists and its oldest message is not newer
+bool ChannelRegistry::is_live(const std::pair<ChannelName, uint64_t>& entry) const
+{
+	Channel* channel = find_by_key(entry.first->key);
+	return channel && !channel->get_history().empty() && channel->get_history().at(0).msgid <= entry.second;
+}
+
+// Amortized: runs once the stale entries outnumber the live ones
+void ChannelRegistry::compact_history_order()
+{
+	std::deque<std::pair<ChannelName, uint64_t>> live;
+	for (auto& entry : _history_order)
+	{
+		if (is_live(entry))
+			live.push_back(std::move(entry));
+	}
+	_history_order.swap(live);
+}
+
+size_t ChannelRegistry::history_bytes() const
+{
+	return _history_bytes;
+}
+
+const HistoryLimits& ChannelRegistry::history_limits() const
+{
+	return _history_limits;
+}
+
+uint64_t ChannelRegistry::generation() const
+{
+	return _generation;
+}
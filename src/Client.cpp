@@ -1,26 +1,34 @@
 #include "Client.hpp"
+#include <sys/uio.h> // For writev()
+#include <climits>   // For IOV_MAX
 
-Client::Client(Client&& other) : _socket(std::move(other._socket))
+// Built in place in its ClientTable slot (Server::add_client) and never
+// moved: the Client owns the socket from here on
+// CHANGED (tobias)
+Client::Client(int client_fd, EventLoop* event_loop, size_t recv_chunk_size, std::vector<int>* flush_list)
+	: _socket(client_fd), _event_loop(event_loop), _flush_list(flush_list), _recv_buffer(recv_chunk_size)
 {
-
+	// The socket comes from accept4() and is already non-blocking
+	// Remember where the client connects from, it is part of its prefix
+	sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	char host[INET_ADDRSTRLEN];
+	if (getpeername(_socket.get_fd(), reinterpret_cast<sockaddr*>(&addr), &addr_len) == 0
+		&& addr.sin_family == AF_INET && inet_ntop(AF_INET, &addr.sin_addr, host, sizeof(host)))
+		_hostname = host;
+	else
+		_hostname = "unknown";
+	update_prefix();
 }
 
-Client& Client::operator=(Client&& other) 
+void Client::update_prefix()
 {
-	if (this != &other) {
-		_socket = std::move(other._socket);
-	}
-	return *this;
+	_prefix = _nickname + "!" + _username + "@" + _hostname;
 }
 
-// CHANGED (tobias)
-Client::Client(std::unique_ptr<Socket> socket) : _socket(std::move(socket))
-{
-    if (_socket)
-		_socket->set_nonblocking();
-}
+int Client::get_fd() const { return _socket.get_fd(); }
 
-int Client::get_fd() const { return _socket->get_fd(); }
+size_t Client::get_recv_chunk_size() const { return _recv_buffer.chunk_size(); }
 
 bool Client::is_authenticated() const
 {
@@ -32,6 +40,26 @@ std::string const &Client::get_nickname() const
 	return _nickname;
 }
 
+std::string const &Client::get_username() const
+{
+	return _username;
+}
+
+std::string const &Client::get_realname() const
+{
+	return _realname;
+}
+
+std::string const &Client::get_hostname() const
+{
+	return _hostname;
+}
+
+std::string const &Client::get_prefix() const
+{
+	return _prefix;
+}
+
 void Client::set_passed_pass(std::string const &pass)
 {
 	_password = pass;
@@ -42,12 +70,14 @@ void Client::set_passed_nick(std::string const &nick)
 {
 	_nickname = nick;
 	passed_nick = true;
+	update_prefix();
 }
 
 void Client::set_passed_user(std::string const &user)
 {
 	_username = user;
 	passed_user = true;
+	update_prefix();
 }
 
 void Client::set_passed_realname(std::string const &realname)
@@ -56,11 +86,103 @@ void Client::set_passed_realname(std::string const &realname)
 	passed_realname = true;
 }
 
+const std::vector<ChannelName>& Client::get_channels() const
+{
+	return _channels;
+}
+
+void Client::add_channel(ChannelName const &channel_name)
+{
+	_channels.push_back(channel_name);
+}
+
+// A client is only in a handful of channels, a linear search is the cheapest here.
+// Names are interned, so comparing the pointers is enough
+void Client::remove_channel(ChannelName const &channel_name)
+{
+	for (size_t i = 0; i < _channels.size(); ++i)
+	{
+		if (_channels[i] == channel_name)
+		{
+			_channels[i] = std::move(_channels.back());
+			_channels.pop_back();
+			return ;
+		}
+	}
+}
+
 void Client::set_authenticated()
 {
 	authenticated = true;
 }
 
+bool Client::is_operator() const
+{
+	return _operator;
+}
+
+void Client::set_operator()
+{
+	_operator = true;
+}
+
+std::string const &Client::get_password() const
+{
+	return _password;
+}
+
+bool Client::is_link() const
+{
+	return _link_role != LINK_NONE;
+}
+
+LinkRole Client::get_link_role() const
+{
+	return _link_role;
+}
+
+void Client::set_link_role(LinkRole role)
+{
+	_link_role = role;
+}
+
+TimerNode& Client::get_timer()
+{
+	return _timer;
+}
+
+void Client::note_activity(uint64_t now_ms, bool is_command)
+{
+	_last_activity_ms = now_ms;
+	if (is_command)
+		_last_command_ms = now_ms;
+}
+
+uint64_t Client::get_last_activity() const
+{
+	return _last_activity_ms;
+}
+
+uint64_t Client::get_last_command() const
+{
+	return _last_command_ms;
+}
+
+uint64_t Client::get_ping_sent() const
+{
+	return _ping_sent_ms;
+}
+
+void Client::set_ping_sent(uint64_t now_ms)
+{
+	_ping_sent_ms = now_ms;
+}
+
+FloodControl& Client::get_flood()
+{
+	return _flood;
+}
+
 bool Client::get_passed_pass() const
 {
     return passed_pass;
@@ -78,26 +200,193 @@ bool Client::get_passed_realname() const
     return passed_realname;
 }
 
-// Send data to the client
+// Drop everything that is queued and shut the socket down.
+// shutdown() makes the event loop report a hangup for this fd, so the Server
+// cleans the client up from its normal disconnection path
+void Client::fail_send()
+{
+	_send_failed = true;
+	// A batched write may still point into the queue: it is freed with the
+	// Client, after the event loop submitted the write (EventLoop::remove)
+	if (!_send_in_flight)
+		_send_queue.clear();
+	_send_offset = 0;
+	_send_queue_bytes = 0;
+	::shutdown(_socket.get_fd(), SHUT_RDWR);
+}
+
+// Send data to the client.
+// The message is queued, and written with everything else queued for the
+// client in the same loop iteration (see Server::flush_clients). A partial
+// write or EAGAIN is normal backpressure and the rest goes out when the event
+// loop reports the socket as writable.
 void Client::send(std::string const &msg)
 {
-    ssize_t bytes_sent = ::send(_socket->get_fd(), msg.c_str(), msg.size(), 0);
-    if (bytes_sent == -1)
-    {
-        std::cerr << "send() failed for client FD " << _socket->get_fd() << ": " << std::strerror(errno) << std::endl;
-        throw std::runtime_error("send() failed");
-    }
-    if (static_cast<size_t>(bytes_sent) < msg.size())
-    {
-        std::cerr << "Warning: Partial send() for client FD " << _socket->get_fd() << std::endl;
-        throw std::runtime_error("Partial send(), incomplete message sent");
-    }
+	if (_send_failed || msg.empty())
+		return ;
+	send(make_shared_buffer(msg));
+}
+
+void Client::send(SharedBuffer const &msg)
+{
+	if (_send_failed || !msg || msg->empty())
+		return ;
+	if (_send_queue_bytes + msg->size() > (is_link() ? LINK_SEND_QUEUE_MAX : SEND_QUEUE_MAX))
+	{
+		// The client does not read fast enough: stop queueing for it
+		LOG_WARN("Send queue exceeded for client FD " << _socket.get_fd());
+		fail_send();
+		return ;
+	}
+	_send_queue.push_back(msg);
+	_send_queue_bytes += msg->size();
+	Metrics::instance().note_send_queue(_send_queue_bytes);
+	// Waiting for room in the socket, or for a write to complete: the event
+	// loop takes care of the rest
+	if (_write_interest || _send_in_flight)
+		return ;
+	if (!_flush_list || _send_queue_bytes >= SEND_CORK_MAX)
+		flush_send_queue();
+	else if (!_flush_queued)
+	{
+		_flush_queued = true;
+		_flush_list->push_back(_socket.get_fd());
+	}
+}
+
+bool Client::take_flush_queued()
+{
+	bool queued = _flush_queued;
+	_flush_queued = false;
+	return queued;
+}
+
+// Points iov at the first SEND_IOV_MAX queued messages, returns how many
+int Client::fill_send_iov(iovec* iov) const
+{
+	int iov_count = 0;
+	for (auto it = _send_queue.begin(); it != _send_queue.end() && iov_count < SEND_IOV_MAX; ++it, ++iov_count)
+	{
+		size_t skip = (iov_count == 0) ? _send_offset : 0;
+		iov[iov_count].iov_base = const_cast<char*>((*it)->data() + skip);
+		iov[iov_count].iov_len = (*it)->size() - skip;
+	}
+	return iov_count;
+}
+
+// Pops every fully written message, remembers how far we got in the last one.
+// Returns false on a partial write: the kernel buffer is full
+bool Client::consume_sent(size_t written)
+{
+	_send_queue_bytes -= written;
+	Metrics::instance().bytes_sent += written;
+	while (written > 0)
+	{
+		size_t left = _send_queue.front()->size() - _send_offset;
+		if (written < left)
+		{
+			_send_offset += written;
+			break;
+		}
+		written -= left;
+		_send_queue.pop_front();
+		_send_offset = 0;
+	}
+	return _send_offset == 0;
+}
+
+// Only ask for write events while something is waiting for room in the socket
+void Client::set_write_interest(bool want_write)
+{
+	if (want_write != _write_interest && _event_loop && !_send_failed)
+	{
+		_event_loop->modify(_socket.get_fd(), want_write ? (EVENT_READ | EVENT_WRITE) : EVENT_READ);
+		_write_interest = want_write;
+	}
+}
+
+// Write the queued messages with one writev() per batch of SEND_IOV_MAX messages.
+// With a batching event loop (io_uring) the writev is only submitted here and
+// goes out with every other client's in the loop's next wait(), see complete_send()
+bool Client::flush_send_queue()
+{
+	int fd = _socket.get_fd();
+	if (_event_loop && _event_loop->batches_sends())
+	{
+		if (!_send_in_flight && !_send_queue.empty() && !_send_failed)
+		{
+			iovec iov[SEND_IOV_MAX];
+			_event_loop->submit_send(fd, iov, fill_send_iov(iov));
+			++Metrics::instance().send_calls;
+			_send_in_flight = true;
+		}
+		return !_send_failed;
+	}
+	while (!_send_queue.empty() && !_send_failed)
+	{
+		iovec iov[SEND_IOV_MAX];
+		int iov_count = fill_send_iov(iov);
+		ssize_t bytes_sent = ::writev(fd, iov, iov_count);
+		++Metrics::instance().send_calls;
+		if (bytes_sent < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break; // The kernel buffer is full, wait for the next write event
+			if (errno == EINTR)
+				continue;
+			LOG_WARN("writev() failed for client FD " << fd << ": " << std::strerror(errno));
+			fail_send();
+			break;
+		}
+		if (!consume_sent(static_cast<size_t>(bytes_sent)))
+			break;
+	}
+	set_write_interest(!_send_queue.empty());
+	return !_send_failed;
+}
+
+bool Client::complete_send(int result)
+{
+	_send_in_flight = false;
+	if (_send_failed)
+		return false;
+	if (result == -EAGAIN || result == -EWOULDBLOCK || result == -EINTR)
+	{
+		// The socket is full: go on once it reports room again
+		set_write_interest(true);
+		return true;
+	}
+	if (result < 0)
+	{
+		LOG_WARN("writev() failed for client FD " << _socket.get_fd() << ": " << std::strerror(-result));
+		fail_send();
+		return false;
+	}
+	if (!consume_sent(static_cast<size_t>(result)))
+	{
+		set_write_interest(true);
+		return true;
+	}
+	// Everything went out: submit the rest of the queue with the next batch, if any
+	set_write_interest(false);
+	return flush_send_queue();
+}
+
+bool Client::has_pending_output() const
+{
+	return !_send_queue.empty();
+}
+
+bool Client::has_send_failed() const
+{
+	return _send_failed;
 }
 
-// Write data to the output buffer used for sending data to the server
-void Client::write_output_buffer(std::string const &data)
+// Read what the client sent directly into the receive buffer.
+// One call moves up to a whole chunk (16 KiB by default) instead of one byte
+ssize_t Client::read_from_socket()
 {
-	output_buffer += data;
+	return _recv_buffer.read_from(_socket.get_fd());
 }
 
 // std::string const &Client::get_read_buffer() const
@@ -110,16 +399,72 @@ void Client::write_output_buffer(std::string const &data)
 // 	return write_buffer;
 // }
 
-// Extract a line from the output buffer
-std::string Client::extract_output_line()
+// Extract a line from the receive buffer, without copying it
+bool Client::extract_output_line(std::string_view &line)
 {
-	size_t pos = output_buffer.find('\n');
-	if (pos == std::string::npos)
-		return "";
+	return _recv_buffer.next_line(line);
+}
+
+void Client::compact_input()
+{
+	_recv_buffer.compact();
+}
+
+void Client::unread_line(std::string_view line)
+{
+	_recv_buffer.unread(line);
+}
+
+size_t Client::get_input_size() const
+{
+	return _recv_buffer.size();
+}
 
-	std::string line = output_buffer.substr(0, pos);
-	output_buffer.erase(0, pos + 1);
-	if (!line.empty() && line.back() == '\r')
-		line.pop_back();
-	return line;
+size_t Client::take_overlong_lines()
+{
+	return _recv_buffer.take_overlong();
+}
+
+bool Client::is_input_queued() const
+{
+	return _input_queued;
+}
+
+void Client::set_input_queued(bool queued)
+{
+	_input_queued = queued;
+}
+
+bool Client::is_hung_up() const
+{
+	return _hung_up;
+}
+
+void Client::set_hung_up()
+{
+	_hung_up = true;
+}
+
+std::string_view Client::get_pending_input() const
+{
+	return std::string_view(_recv_buffer.data(), _recv_buffer.size());
+}
+
+std::string Client::get_pending_output() const
+{
+	std::string output;
+	output.reserve(_send_queue_bytes);
+	for (auto it = _send_queue.begin(); it != _send_queue.end(); ++it)
+		output.append(**it, it == _send_queue.begin() ? _send_offset : 0);
+	return output;
+}
+
+void Client::restore_input(std::string_view bytes)
+{
+	_recv_buffer.append(bytes);
+}
+
+bool Client::has_send_in_flight() const
+{
+	return _send_in_flight;
 }
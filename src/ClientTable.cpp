@@ -0,0 +1,90 @@
+#include "../includes/ClientTable.hpp"
+
+ClientTable::ClientTable() : _size(0)
+{
+}
+
+ClientTable::~ClientTable()
+{
+	for (std::unique_ptr<Slot[]>& chunk : _chunks)
+	{
+		if (!chunk)
+			continue;
+		for (size_t i = 0; i < CLIENT_CHUNK_SLOTS; ++i)
+		{
+			if (chunk[i].used)
+				client_in(chunk[i])->~Client();
+		}
+	}
+}
+
+ClientTable::Slot* ClientTable::slot(int fd) const
+{
+	if (fd < 0)
+		return NULL;
+	size_t chunk = static_cast<size_t>(fd) / CLIENT_CHUNK_SLOTS;
+	if (chunk >= _chunks.size() || !_chunks[chunk])
+		return NULL;
+	return &_chunks[chunk][static_cast<size_t>(fd) % CLIENT_CHUNK_SLOTS];
+}
+
+ClientTable::Slot& ClientTable::make_slot(int fd)
+{
+	if (fd < 0)
+		throw std::out_of_range("ClientTable: negative fd");
+	size_t chunk = static_cast<size_t>(fd) / CLIENT_CHUNK_SLOTS;
+	if (chunk >= _chunks.size())
+		_chunks.resize(chunk + 1);
+	if (!_chunks[chunk])
+		_chunks[chunk].reset(new Slot[CLIENT_CHUNK_SLOTS]()); // Zeroed: unused, generation 0
+	Slot& free_slot = _chunks[chunk][static_cast<size_t>(fd) % CLIENT_CHUNK_SLOTS];
+	if (free_slot.used)
+		throw std::logic_error("ClientTable: fd " + std::to_string(fd) + " is already in use");
+	return free_slot;
+}
+
+void ClientTable::erase(int fd)
+{
+	Slot* used_slot = slot(fd);
+	if (!used_slot || !used_slot->used)
+		return ;
+	// The destructor closes the socket
+	client_in(*used_slot)->~Client();
+	used_slot->used = false;
+	++used_slot->generation;
+	--_size;
+}
+
+Client* ClientTable::find(int fd) const
+{
+	Slot* used_slot = slot(fd);
+	return (used_slot && used_slot->used) ? client_in(*used_slot) : NULL;
+}
+
+Client* ClientTable::find(ClientHandle handle) const
+{
+	Slot* used_slot = slot(handle.fd);
+	if (!used_slot || !used_slot->used || used_slot->generation != handle.generation)
+		return NULL;
+	return client_in(*used_slot);
+}
+
+Client& ClientTable::at(int fd) const
+{
+	Client* client = find(fd);
+	if (!client)
+		throw std::out_of_range("ClientTable: no client on fd " + std::to_string(fd));
+	return *client;
+}
+
+ClientHandle ClientTable::handle_of(int fd) const
+{
+	Slot* used_slot = slot(fd);
+	ClientHandle handle = {fd, used_slot ? used_slot->generation : 0};
+	return handle;
+}
+
+size_t ClientTable::size() const
+{
+	return _size;
+}
@@ -0,0 +1,119 @@
+#include "../includes/Config.hpp"
+#include <cstdlib> // For getenv(), strtoul()
+#include <cstdint> // For UINT32_MAX
+#include "../includes/Network.hpp" // For Network::is_valid_server_name()
+
+// Reads a positive number (or 0 with allow_zero) from the environment, keeps
+// fallback when unset or invalid
+static size_t env_size(const char* name, size_t fallback, bool allow_zero = false)
+{
+	const char* value = std::getenv(name);
+	if (!value)
+		return fallback;
+	char* end = NULL;
+	unsigned long parsed = std::strtoul(value, &end, 10);
+	if (end == value || *end != '\0' || (parsed == 0 && !allow_zero))
+	{
+		LOG_WARN("Ignoring invalid " << name << "=" << value);
+		return fallback;
+	}
+	return static_cast<size_t>(parsed);
+}
+
+// Reads "lines/s:line burst:bytes/s:byte burst", keeps fallback when unset or invalid
+static FloodLimit env_flood_limit(const char* name, FloodLimit fallback)
+{
+	const char* value = std::getenv(name);
+	if (!value)
+		return fallback;
+	unsigned long fields[4];
+	const char* cursor = value;
+	for (int i = 0; i < 4; ++i)
+	{
+		char* end = NULL;
+		fields[i] = std::strtoul(cursor, &end, 10);
+		if (end == cursor || fields[i] > UINT32_MAX || *end != (i < 3 ? ':' : '\0'))
+		{
+			LOG_WARN("Ignoring invalid " << name << "=" << value);
+			return fallback;
+		}
+		cursor = end + 1;
+	}
+	FloodLimit limit = {static_cast<uint32_t>(fields[0]), static_cast<uint32_t>(fields[1]),
+		static_cast<uint32_t>(fields[2]), static_cast<uint32_t>(fields[3])};
+	return limit;
+}
+
+Config Config::from_environment()
+{
+	Config config;
+	if (const char* backend = std::getenv("IRCSERV_EVENT_BACKEND"))
+		config.event_backend = backend;
+	config.recv_chunk_size = env_size("IRCSERV_RECV_CHUNK_SIZE", config.recv_chunk_size);
+	config.listen_backlog = env_size("IRCSERV_LISTEN_BACKLOG", config.listen_backlog);
+	config.accept_batch = env_size("IRCSERV_ACCEPT_BATCH", config.accept_batch);
+	config.read_budget = env_size("IRCSERV_READ_BUDGET", config.read_budget);
+	config.line_budget = env_size("IRCSERV_LINE_BUDGET", config.line_budget);
+	config.registration_timeout = env_size("IRCSERV_REGISTRATION_TIMEOUT", config.registration_timeout);
+	config.ping_interval = env_size("IRCSERV_PING_INTERVAL", config.ping_interval);
+	config.ping_timeout = env_size("IRCSERV_PING_TIMEOUT", config.ping_timeout);
+	config.idle_timeout = env_size("IRCSERV_IDLE_TIMEOUT", config.idle_timeout);
+	static const char* const flood_variables[FLOOD_CLASS_COUNT] = {
+		"IRCSERV_FLOOD_DEFAULT", "IRCSERV_FLOOD_MESSAGE", "IRCSERV_FLOOD_CHANNEL", "IRCSERV_FLOOD_PING"};
+	for (int i = 0; i < FLOOD_CLASS_COUNT; ++i)
+		config.flood_limits[i] = env_flood_limit(flood_variables[i], config.flood_limits[i]);
+	config.flood_excess_timeout = env_size("IRCSERV_FLOOD_EXCESS_TIMEOUT", config.flood_excess_timeout);
+	config.flood_max_backlog = env_size("IRCSERV_FLOOD_MAX_BACKLOG", config.flood_max_backlog);
+	config.history_lines = env_size("IRCSERV_HISTORY_LINES", config.history_lines, true);
+	config.history_bytes = env_size("IRCSERV_HISTORY_BYTES", config.history_bytes);
+	config.history_total_bytes = env_size("IRCSERV_HISTORY_TOTAL_BYTES", config.history_total_bytes);
+	// The global cap must hold at least one full channel history
+	if (config.history_total_bytes < config.history_bytes)
+	{
+		LOG_WARN("IRCSERV_HISTORY_TOTAL_BYTES=" << config.history_total_bytes << " is below IRCSERV_HISTORY_BYTES="
+			<< config.history_bytes << ", using " << config.history_bytes);
+		config.history_total_bytes = config.history_bytes;
+	}
+	config.history_join_replay = env_size("IRCSERV_HISTORY_JOIN_REPLAY", config.history_join_replay, true);
+	if (size_t upgrade_fd = env_size(UPGRADE_FD_VARIABLE, 0))
+		config.upgrade_fd = static_cast<int>(upgrade_fd);
+	if (const char* casemapping = std::getenv("IRCSERV_CASEMAPPING"))
+	{
+		std::string value(casemapping);
+		if (value == "ascii")
+			config.casemapping = CASEMAPPING_ASCII;
+		else if (value != "rfc1459")
+			LOG_WARN("Unknown IRCSERV_CASEMAPPING '" << value << "', using rfc1459");
+	}
+	if (const char* server_name = std::getenv("IRCSERV_SERVER_NAME"))
+	{
+		if (Network::is_valid_server_name(server_name))
+			config.server_name = server_name;
+		else
+			LOG_WARN("Ignoring invalid IRCSERV_SERVER_NAME=" << server_name << " (a host name with a '.' is expected)");
+	}
+	if (const char* link_password = std::getenv("IRCSERV_LINK_PASSWORD"))
+		config.link_password = link_password;
+	if (const char* oper_password = std::getenv("IRCSERV_OPER_PASSWORD"))
+		config.oper_password = oper_password;
+	if (const char* snapshot_file = std::getenv("IRCSERV_SNAPSHOT_FILE"))
+		config.snapshot_file = snapshot_file;
+	config.snapshot_interval = env_size("IRCSERV_SNAPSHOT_INTERVAL", config.snapshot_interval);
+	if (const char* metrics_socket = std::getenv("IRCSERV_METRICS_SOCKET"))
+		config.metrics_socket = metrics_socket;
+	if (const char* log_file = std::getenv("IRCSERV_LOG_FILE"))
+		config.log_file = log_file;
+	if (const char* log_level = std::getenv("IRCSERV_LOG_LEVEL"))
+	{
+		std::string value(log_level);
+		if (value == "debug")
+			config.log_level = LOG_LEVEL_DEBUG;
+		else if (value == "warn")
+			config.log_level = LOG_LEVEL_WARN;
+		else if (value == "error")
+			config.log_level = LOG_LEVEL_ERROR;
+		else if (value != "info")
+			LOG_WARN("Unknown IRCSERV_LOG_LEVEL '" << value << "', using info");
+	}
+	return config;
+}
@@ -0,0 +1,104 @@
+#include "../includes/EpollLoop.hpp"
+
+#ifdef __linux__
+
+# include <unistd.h>  // For close()
+# include <cerrno>
+# include <cstring>   // For strerror
+# include <stdexcept>
+
+# define EPOLL_INITIAL_EVENTS 64 // Initial size of the epoll_wait() output buffer
+
+EpollLoop::EpollLoop() : _epoll_fd(-1), _events(EPOLL_INITIAL_EVENTS), _watched(0)
+{
+	_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (_epoll_fd < 0)
+		throw std::runtime_error(std::string("epoll_create1 failed: ") + std::strerror(errno));
+}
+
+EpollLoop::~EpollLoop()
+{
+	if (_epoll_fd >= 0)
+		close(_epoll_fd);
+}
+
+// Every fd is registered edge-triggered (EPOLLET): we are only woken up when
+// new data arrives, so readers must drain the socket until EAGAIN.
+// EPOLLRDHUP lets us see a half-closed peer without an extra recv().
+uint32_t EpollLoop::to_epoll_events(unsigned int events)
+{
+	uint32_t epoll_events = EPOLLET | EPOLLRDHUP;
+	if (events & EVENT_READ)
+		epoll_events |= EPOLLIN;
+	if (events & EVENT_WRITE)
+		epoll_events |= EPOLLOUT;
+	return epoll_events;
+}
+
+void EpollLoop::add(int fd, unsigned int events)
+{
+	epoll_event ev;
+	std::memset(&ev, 0, sizeof(ev));
+	ev.events = to_epoll_events(events);
+	ev.data.fd = fd;
+	if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		throw std::runtime_error(std::string("epoll_ctl ADD failed: ") + std::strerror(errno));
+	++_watched;
+}
+
+void EpollLoop::modify(int fd, unsigned int events)
+{
+	epoll_event ev;
+	std::memset(&ev, 0, sizeof(ev));
+	ev.events = to_epoll_events(events);
+	ev.data.fd = fd;
+	if (epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0)
+		throw std::runtime_error(std::string("epoll_ctl MOD failed: ") + std::strerror(errno));
+}
+
+void EpollLoop::remove(int fd)
+{
+	// The event argument is ignored for DEL but must be non-NULL on old kernels
+	epoll_event ev;
+	std::memset(&ev, 0, sizeof(ev));
+	if (epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, &ev) == 0 && _watched > 0)
+		--_watched;
+}
+
+int EpollLoop::wait(std::vector<IoEvent>& ready, int timeout_ms)
+{
+	ready.clear();
+	int num_events = epoll_wait(_epoll_fd, _events.data(), static_cast<int>(_events.size()), timeout_ms);
+	if (num_events <= 0)
+		return num_events;
+	for (int i = 0; i < num_events; ++i)
+	{
+		uint32_t revents = _events[i].events;
+		unsigned int events = 0;
+		if (revents & EPOLLIN)
+			events |= EVENT_READ;
+		if (revents & EPOLLOUT)
+			events |= EVENT_WRITE;
+		if (revents & (EPOLLHUP | EPOLLRDHUP))
+			events |= EVENT_HANGUP;
+		if (revents & EPOLLERR)
+			events |= EVENT_ERROR;
+		ready.push_back({_events[i].data.fd, events, 0});
+	}
+	// The buffer was full: there may be more ready fds, give the next call more room
+	if (static_cast<size_t>(num_events) == _events.size() && _events.size() < _watched)
+		_events.resize(_events.size() * 2);
+	return num_events;
+}
+
+bool EpollLoop::is_edge_triggered() const
+{
+	return true;
+}
+
+const char* EpollLoop::name() const
+{
+	return "epoll";
+}
+
+#endif
@@ -0,0 +1,39 @@
+#include "../includes/EventLoop.hpp"
+#include "../includes/PollLoop.hpp"
+#include "../includes/EpollLoop.hpp"
+#include "../includes/UringLoop.hpp"
+#include "../includes/Logger.hpp"
+#include <stdexcept>
+
+std::unique_ptr<EventLoop> EventLoop::create(const std::string& backend)
+{
+#ifdef IRCSERV_HAVE_IO_URING
+	if (backend == "io_uring")
+	{
+		try
+		{
+			return std::make_unique<UringLoop>();
+		}
+		catch (const std::exception& e)
+		{
+			LOG_WARN(e.what() << ", falling back to epoll");
+		}
+	}
+#endif
+#ifdef __linux__
+	if (backend == "epoll" || backend == "io_uring")
+	{
+		try
+		{
+			return std::make_unique<EpollLoop>();
+		}
+		catch (const std::exception& e)
+		{
+			LOG_WARN(e.what() << ", falling back to poll()");
+		}
+	}
+#endif
+	if (backend != "poll" && backend != "epoll" && backend != "io_uring")
+		LOG_WARN("Unknown event backend '" << backend << "', using poll()");
+	return std::make_unique<PollLoop>();
+}
@@ -0,0 +1,69 @@
+#include "../includes/FloodControl.hpp"
+
+TokenBucket::TokenBucket() : _milli_tokens(UINT64_MAX), _last_ms(0)
+{
+}
+
+void TokenBucket::refill(uint32_t rate, uint32_t burst, uint64_t now_ms)
+{
+	uint64_t capacity = static_cast<uint64_t>(burst) * 1000;
+	if (_milli_tokens < capacity && now_ms > _last_ms)
+	{
+		// A product too big for 64 bits is more than enough to fill up
+		uint64_t earned;
+		if (__builtin_mul_overflow(now_ms - _last_ms, static_cast<uint64_t>(rate), &earned) || earned >= capacity - _milli_tokens)
+			_milli_tokens = capacity;
+		else
+			_milli_tokens += earned;
+	}
+	if (_milli_tokens > capacity) // Also a brand new bucket
+		_milli_tokens = capacity;
+	_last_ms = now_ms;
+}
+
+uint64_t TokenBucket::wait_ms(uint32_t rate, uint32_t burst, uint64_t cost, uint64_t now_ms)
+{
+	if (rate == 0)
+		return 0;
+	refill(rate, burst, now_ms);
+	uint64_t milli_cost = cost * 1000;
+	// Something bigger than the burst would never fit: it only needs a full bucket
+	if (milli_cost > static_cast<uint64_t>(burst) * 1000)
+		milli_cost = static_cast<uint64_t>(burst) * 1000;
+	if (_milli_tokens >= milli_cost)
+		return 0;
+	// The one division, only for a line that is deferred anyway
+	return (milli_cost - _milli_tokens + rate - 1) / rate; // Rounded up
+}
+
+void TokenBucket::take(uint32_t rate, uint64_t cost)
+{
+	if (rate == 0)
+		return ;
+	uint64_t milli_cost = cost * 1000;
+	_milli_tokens = _milli_tokens > milli_cost ? _milli_tokens - milli_cost : 0;
+}
+
+FloodControl::FloodControl() : _throttled_since(0), _resume_at(0), _queued(false)
+{
+}
+
+uint64_t FloodControl::charge(const FloodLimit& limit, FloodClass flood_class, size_t bytes, uint64_t now_ms)
+{
+	TokenBucket& lines = _lines[flood_class];
+	TokenBucket& byte_bucket = _bytes[flood_class];
+	uint64_t line_wait = lines.wait_ms(limit.lines_per_second, limit.line_burst, 1, now_ms);
+	uint64_t byte_wait = byte_bucket.wait_ms(limit.bytes_per_second, limit.byte_burst, bytes, now_ms);
+	if (line_wait != 0 || byte_wait != 0)
+		return line_wait > byte_wait ? line_wait : byte_wait;
+	lines.take(limit.lines_per_second, 1);
+	byte_bucket.take(limit.bytes_per_second, bytes);
+	return 0;
+}
+
+void FloodControl::throttle(uint64_t now_ms, uint64_t resume_at)
+{
+	if (_throttled_since == 0)
+		_throttled_since = now_ms;
+	_resume_at = resume_at;
+}
@@ -0,0 +1,127 @@
+#include "../includes/History.hpp"
+#include <algorithm>
+#include <ctime>
+
+uint64_t history_clock_ms()
+{
+	timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return static_cast<uint64_t>(now.tv_sec) * 1000 + static_cast<uint64_t>(now.tv_nsec) / 1000000;
+}
+
+ChannelHistory::ChannelHistory() : _head(0), _count(0), _bytes(0)
+{
+}
+
+size_t ChannelHistory::size() const
+{
+	return _count;
+}
+
+size_t ChannelHistory::bytes() const
+{
+	return _bytes;
+}
+
+bool ChannelHistory::empty() const
+{
+	return _count == 0;
+}
+
+const HistoryEntry& ChannelHistory::at(size_t index) const
+{
+	return _slots[(_head + index) % _slots.size()];
+}
+
+bool ChannelHistory::append(HistoryEntry entry, const HistoryLimits& limits)
+{
+	size_t size = entry.line->size();
+	if (limits.lines == 0 || size > limits.bytes)
+		return false;
+	while (_count > 0 && (_count >= limits.lines || _bytes + size > limits.bytes))
+		pop_oldest();
+	if (_count < _slots.size())
+		_slots[(_head + _count) % _slots.size()] = std::move(entry);
+	else
+	{
+		// Full, but under the line cap: grow. The ring is unrolled first so
+		// the new slot lands after the newest entry
+		std::rotate(_slots.begin(), _slots.begin() + static_cast<std::ptrdiff_t>(_head), _slots.end());
+		_head = 0;
+		_slots.push_back(std::move(entry));
+	}
+	++_count;
+	_bytes += size;
+	return true;
+}
+
+void ChannelHistory::reserve(size_t lines)
+{
+	if (_head == 0)
+		_slots.reserve(lines);
+}
+
+size_t ChannelHistory::pop_oldest()
+{
+	HistoryEntry& oldest = _slots[_head];
+	size_t size = oldest.line->size();
+	oldest.line.reset(); // The slot may stay unused for long, do not pin the line
+	_head = (_head + 1) % _slots.size();
+	--_count;
+	_bytes -= size;
+	return size;
+}
+
+// The times never go down (see ChannelRegistry::record_history): binary searches
+size_t ChannelHistory::lower_bound(uint64_t time_ms) const
+{
+	size_t first = 0;
+	size_t last = _count;
+	while (first < last)
+	{
+		size_t middle = first + (last - first) / 2;
+		if (at(middle).time_ms < time_ms)
+			first = middle + 1;
+		else
+			last = middle;
+	}
+	return first;
+}
+
+size_t ChannelHistory::upper_bound(uint64_t time_ms) const
+{
+	size_t first = 0;
+	size_t last = _count;
+	while (first < last)
+	{
+		size_t middle = first + (last - first) / 2;
+		if (at(middle).time_ms <= time_ms)
+			first = middle + 1;
+		else
+			last = middle;
+	}
+	return first;
+}
+
+void ChannelHistory::select(HistorySelector selector, uint64_t time_ms, size_t limit, std::vector<SharedBuffer>& out) const
+{
+	size_t first;
+	size_t last;
+	if (selector == HISTORY_AFTER)
+	{
+		first = upper_bound(time_ms);
+		last = std::min(_count, first + limit);
+	}
+	else
+	{
+		if (selector == HISTORY_BEFORE)
+			last = lower_bound(time_ms);
+		else
+			last = _count;
+		first = (last > limit) ? last - limit : 0;
+		if (selector == HISTORY_LATEST && time_ms != 0)
+			first = std::max(first, upper_bound(time_ms));
+	}
+	for (size_t i = first; i < last; ++i)
+		out.push_back(at(i).line);
+}
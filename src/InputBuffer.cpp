@@ -0,0 +1,165 @@
+#include "../includes/InputBuffer.hpp"
+#include <sys/socket.h> // For recv()
+#include <cstring>      // For memmove(), memchr()
+#if defined(__AVX2__) || defined(__SSE2__)
+# include <immintrin.h> // For the SSE2 / AVX2 intrinsics
+#endif
+
+// Returns the first '\n' in [begin, end) or NULL.
+// Compares 32 (AVX2) or 16 (SSE2) bytes per instruction and builds a bitmask
+// of the matches; the tail and non-x86 builds use memchr().
+static const char* find_newline(const char* begin, const char* end)
+{
+	const char* p = begin;
+#if defined(__AVX2__)
+	const __m256i newline32 = _mm256_set1_epi8('\n');
+	for (; end - p >= 32; p += 32)
+	{
+		__m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+		unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, newline32)));
+		if (mask)
+			return p + __builtin_ctz(mask);
+	}
+#endif
+#if defined(__SSE2__)
+	const __m128i newline16 = _mm_set1_epi8('\n');
+	for (; end - p >= 16; p += 16)
+	{
+		__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline16)));
+		if (mask)
+			return p + __builtin_ctz(mask);
+	}
+#endif
+	if (p == end)
+		return NULL;
+	return static_cast<const char*>(std::memchr(p, '\n', end - p));
+}
+
+InputBuffer::InputBuffer(size_t chunk_size) : _start(0), _end(0), _scan(0), _chunk_size(chunk_size),
+	_discarding(false), _overlong(0)
+{
+	// The storage itself is only allocated on the first read, so idle
+	// connections that never send anything do not cost a whole chunk each
+}
+
+// Makes sure there are at least _chunk_size free bytes after _end
+void InputBuffer::reserve_chunk()
+{
+	if (_data.size() - _end >= _chunk_size)
+		return ;
+	// Slide the unread bytes back to the front before growing the storage
+	compact();
+	if (_data.size() - _end < _chunk_size)
+		_data.resize(_end + _chunk_size);
+}
+
+ssize_t InputBuffer::read_from(int fd)
+{
+	reserve_chunk();
+	ssize_t bytes_read = recv(fd, _data.data() + _end, _data.size() - _end, 0);
+	if (bytes_read > 0)
+		_end += static_cast<size_t>(bytes_read);
+	return bytes_read;
+}
+
+const char* InputBuffer::data() const
+{
+	return _data.data() + _start;
+}
+
+size_t InputBuffer::size() const
+{
+	return _end - _start;
+}
+
+bool InputBuffer::empty() const
+{
+	return _start == _end;
+}
+
+size_t InputBuffer::chunk_size() const
+{
+	return _chunk_size;
+}
+
+bool InputBuffer::next_line(std::string_view& line)
+{
+	while (_scan < _end)
+	{
+		const char* base = _data.data();
+		const char* newline = find_newline(base + _scan, base + _end);
+		if (!newline)
+		{
+			// MAX_LINE_LENGTH bytes without '\n' cannot end as a valid line anymore
+			if (_end - _start >= MAX_LINE_LENGTH)
+			{
+				if (!_discarding)
+					++_overlong;
+				_discarding = true;
+				_start = _end;
+			}
+			// Nothing yet: the next search only looks at the new bytes
+			_scan = _end;
+			return false;
+		}
+		size_t line_end = newline - base;
+		size_t line_start = _start;
+		_start = line_end + 1;
+		_scan = _start;
+		if (_discarding)
+		{
+			// Tail of a line already dropped
+			_discarding = false;
+			continue;
+		}
+		if (_start - line_start > MAX_LINE_LENGTH)
+		{
+			++_overlong;
+			continue;
+		}
+		if (line_end > line_start && base[line_end - 1] == '\r')
+			--line_end;
+		// Empty lines are silently ignored (RFC 1459, 2.3.1)
+		if (line_end == line_start)
+			continue;
+		line = std::string_view(base + line_start, line_end - line_start);
+		return true;
+	}
+	return false;
+}
+
+void InputBuffer::unread(std::string_view line)
+{
+	_start = line.data() - _data.data();
+	_scan = _start;
+}
+
+void InputBuffer::append(std::string_view bytes)
+{
+	compact();
+	if (_data.size() - _end < bytes.size())
+		_data.resize(_end + bytes.size());
+	std::memcpy(_data.data() + _end, bytes.data(), bytes.size());
+	_end += bytes.size();
+}
+
+size_t InputBuffer::take_overlong()
+{
+	size_t overlong = _overlong;
+	_overlong = 0;
+	return overlong;
+}
+
+void InputBuffer::compact()
+{
+	if (_start == 0)
+		return ;
+	// Every byte was handled: start again from the front for free
+	size_t unread = _end - _start;
+	if (unread > 0)
+		std::memmove(_data.data(), _data.data() + _start, unread);
+	_scan -= _start;
+	_start = 0;
+	_end = unread;
+}
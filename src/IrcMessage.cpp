@@ -0,0 +1,56 @@
+#include "../includes/IrcMessage.hpp"
+
+// Parameters are separated by one or more spaces
+static size_t skip_spaces(std::string_view line, size_t pos)
+{
+	while (pos < line.size() && line[pos] == ' ')
+		++pos;
+	return pos;
+}
+
+// Returns the end of the word starting at pos
+static size_t find_space(std::string_view line, size_t pos)
+{
+	size_t end = line.find(' ', pos);
+	return (end == std::string_view::npos) ? line.size() : end;
+}
+
+bool parse_irc_message(std::string_view line, IrcMessage& msg)
+{
+	msg.prefix = std::string_view();
+	msg.command = std::string_view();
+	msg.param_count = 0;
+	msg.has_trailing = false;
+
+	size_t pos = skip_spaces(line, 0);
+	// Optional prefix: ":name SPACE"
+	if (pos < line.size() && line[pos] == ':')
+	{
+		size_t end = find_space(line, pos);
+		msg.prefix = line.substr(pos + 1, end - pos - 1);
+		pos = skip_spaces(line, end);
+	}
+	if (pos >= line.size())
+		return false;
+
+	size_t end = find_space(line, pos);
+	msg.command = line.substr(pos, end - pos);
+	pos = skip_spaces(line, end);
+
+	while (pos < line.size() && msg.param_count < IRC_MAX_PARAMS)
+	{
+		// ":" starts the trailing param, and so does the 15th param even without ':'
+		if (line[pos] == ':' || msg.param_count == IRC_MAX_PARAMS - 1)
+		{
+			if (line[pos] == ':')
+				++pos;
+			msg.params[msg.param_count++] = line.substr(pos);
+			msg.has_trailing = true;
+			break;
+		}
+		end = find_space(line, pos);
+		msg.params[msg.param_count++] = line.substr(pos, end - pos);
+		pos = skip_spaces(line, end);
+	}
+	return true;
+}
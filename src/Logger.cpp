@@ -0,0 +1,208 @@
+#include "../includes/Logger.hpp"
+#include <unistd.h>  // For write(), isatty()
+#include <fcntl.h>   // For open()
+#include <ctime>     // For clock_gettime(), localtime_r()
+#include <cerrno>
+#include <cstring>
+#include <cstdio>    // For snprintf()
+#include <chrono>
+#include <iostream>
+
+#define LOG_WRITER_IDLE_MS 10 // How long the writer sleeps when the ring is empty
+#define LOG_BATCH_BYTES (64 * 1024) // A batch is written once it reaches this size
+
+static_assert((LOG_RING_SLOTS & (LOG_RING_SLOTS - 1)) == 0, "LOG_RING_SLOTS must be a power of two");
+
+static const char* const LEVEL_NAMES[] = {"DEBUG", "INFO ", "WARN ", "ERROR"};
+static const char* const LEVEL_COLORS[] = {"\033[34m", "\033[32m", "\033[33m", "\033[31m"};
+
+Logger::Logger()
+	: _slots(new Slot[LOG_RING_SLOTS]),
+	_head(0),
+	_tail(0),
+	_dropped(0),
+	_running(false),
+	_level(LOG_LEVEL_INFO),
+	_fd(STDERR_FILENO),
+	_owns_fd(false),
+	_colors(false)
+{
+}
+
+Logger::~Logger()
+{
+	stop();
+}
+
+Logger& Logger::instance()
+{
+	static Logger logger;
+	return logger;
+}
+
+void Logger::start(const std::string& path, LogLevel level)
+{
+	if (_running.load())
+		return ;
+	set_level(level);
+	if (!path.empty())
+	{
+		int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+		if (fd < 0)
+			std::cerr << "Warning: Cannot open log file " << path << ": " << std::strerror(errno) << ", logging to stderr" << std::endl;
+		else
+		{
+			_fd = fd;
+			_owns_fd = true;
+		}
+	}
+	_colors = isatty(_fd);
+	_running.store(true);
+	_writer = std::thread(&Logger::writer_loop, this);
+}
+
+void Logger::stop()
+{
+	if (_running.exchange(false) && _writer.joinable())
+		_writer.join();
+	// Whatever was logged after the writer stopped (or when it never started)
+	std::string batch;
+	while (drain(batch) > 0)
+	{
+		write_all(batch);
+		batch.clear();
+	}
+	if (_owns_fd)
+	{
+		close(_fd);
+		_fd = STDERR_FILENO;
+		_owns_fd = false;
+	}
+}
+
+void Logger::set_level(LogLevel level)
+{
+	_level.store(level, std::memory_order_relaxed);
+}
+
+uint64_t Logger::dropped() const
+{
+	return _dropped.load(std::memory_order_relaxed);
+}
+
+Logger::Slot* Logger::reserve()
+{
+	size_t head = _head.load(std::memory_order_relaxed);
+	if (head - _tail.load(std::memory_order_acquire) >= LOG_RING_SLOTS)
+	{
+		// Full: never block the event loop, count the loss instead
+		_dropped.fetch_add(1, std::memory_order_relaxed);
+		return NULL;
+	}
+	return &_slots[head & (LOG_RING_SLOTS - 1)];
+}
+
+void Logger::commit()
+{
+	// Publishes the slot returned by reserve() to the writer thread
+	_head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+// Formats every published record into batch. Returns the number of records
+size_t Logger::drain(std::string& batch)
+{
+	size_t tail = _tail.load(std::memory_order_relaxed);
+	size_t head = _head.load(std::memory_order_acquire);
+	size_t count = 0;
+	for (; tail != head && batch.size() < LOG_BATCH_BYTES; ++tail, ++count)
+	{
+		const Slot& slot = _slots[tail & (LOG_RING_SLOTS - 1)];
+		time_t seconds = static_cast<time_t>(slot.time_ms / 1000);
+		struct tm local;
+		localtime_r(&seconds, &local);
+		char stamp[32];
+		size_t stamp_len = std::strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+		batch.append(stamp, stamp_len);
+		char millis[8];
+		std::snprintf(millis, sizeof(millis), ".%03d ", static_cast<int>(slot.time_ms % 1000));
+		batch.append(millis);
+		if (_colors)
+			batch.append(LEVEL_COLORS[slot.level]);
+		batch.append(LEVEL_NAMES[slot.level]);
+		if (_colors)
+			batch.append("\033[0m");
+		batch.append(" ");
+		batch.append(slot.text, slot.length);
+		batch.append("\n");
+	}
+	_tail.store(tail, std::memory_order_release);
+	return count;
+}
+
+void Logger::write_all(const std::string& batch)
+{
+	size_t written = 0;
+	while (written < batch.size())
+	{
+		ssize_t n = write(_fd, batch.data() + written, batch.size() - written);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return ;
+		written += static_cast<size_t>(n);
+	}
+}
+
+void Logger::writer_loop()
+{
+	std::string batch;
+	uint64_t reported_drops = 0;
+	batch.reserve(LOG_BATCH_BYTES + LOG_RECORD_SIZE * 2);
+	while (_running.load(std::memory_order_relaxed))
+	{
+		size_t count = drain(batch);
+		uint64_t drops = dropped();
+		if (drops != reported_drops)
+		{
+			batch.append("[logger] " + std::to_string(drops - reported_drops) + " messages dropped (ring buffer full)\n");
+			reported_drops = drops;
+		}
+		if (!batch.empty())
+		{
+			// One write() for the whole batch
+			write_all(batch);
+			batch.clear();
+		}
+		if (count == 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(LOG_WRITER_IDLE_MS));
+	}
+}
+
+LogRecord::LogRecord(LogLevel level) : _slot(Logger::instance().reserve()), _length(0)
+{
+	if (!_slot)
+		return ;
+	timespec now;
+	clock_gettime(CLOCK_REALTIME_COARSE, &now);
+	_slot->time_ms = static_cast<int64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+	_slot->level = static_cast<uint8_t>(level);
+}
+
+LogRecord::~LogRecord()
+{
+	if (!_slot)
+		return ;
+	_slot->length = static_cast<uint16_t>(_length);
+	Logger::instance().commit();
+}
+
+void LogRecord::append(const char* data, size_t size)
+{
+	if (!_slot)
+		return ;
+	size_t room = LOG_RECORD_SIZE - _length;
+	if (size > room)
+		size = room;
+	std::memcpy(_slot->text + _length, data, size);
+	_length += size;
+}
@@ -0,0 +1,211 @@
+#include "../includes/Metrics.hpp"
+#include "../includes/Logger.hpp"
+#include <sys/socket.h>
+#include <sys/un.h>    // For sockaddr_un
+#include <unistd.h>
+#include <fcntl.h>
+#include <ctime>       // For clock_gettime()
+#include <cerrno>
+#include <cstring>
+#include <cstdio>      // For snprintf()
+#include <stdexcept>
+
+LatencyHistogram::LatencyHistogram() : _buckets(), _count(0), _sum(0), _max(0)
+{
+}
+
+size_t LatencyHistogram::bucket_index(uint64_t value)
+{
+	if (value < HISTOGRAM_SUB_BUCKETS)
+		return static_cast<size_t>(value);
+	unsigned int msb = 63 - __builtin_clzll(value);
+	unsigned int shift = msb - HISTOGRAM_SUB_BITS;
+	size_t sub = static_cast<size_t>(value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1);
+	return (shift + 1) * HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+uint64_t LatencyHistogram::bucket_upper_bound(size_t index)
+{
+	if (index < HISTOGRAM_SUB_BUCKETS)
+		return index;
+	unsigned int shift = static_cast<unsigned int>(index / HISTOGRAM_SUB_BUCKETS) - 1;
+	uint64_t sub = index % HISTOGRAM_SUB_BUCKETS;
+	uint64_t lower = (HISTOGRAM_SUB_BUCKETS + sub) << shift;
+	return lower + ((uint64_t(1) << shift) - 1);
+}
+
+void LatencyHistogram::record(uint64_t nanoseconds)
+{
+	++_buckets[bucket_index(nanoseconds)];
+	++_count;
+	_sum += nanoseconds;
+	if (nanoseconds > _max)
+		_max = nanoseconds;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const
+{
+	if (_count == 0)
+		return 0;
+	uint64_t rank = static_cast<uint64_t>(p * static_cast<double>(_count) + 0.5);
+	if (rank == 0)
+		rank = 1;
+	uint64_t seen = 0;
+	for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i)
+	{
+		seen += _buckets[i];
+		if (seen >= rank)
+		{
+			uint64_t bound = bucket_upper_bound(i);
+			return (bound < _max) ? bound : _max;
+		}
+	}
+	return _max;
+}
+
+Metrics::Metrics() : start_time_ns(now_ns())
+{
+}
+
+Metrics& Metrics::instance()
+{
+	static Metrics metrics;
+	return metrics;
+}
+
+uint64_t Metrics::now_ns()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + static_cast<uint64_t>(now.tv_nsec);
+}
+
+uint64_t Metrics::uptime_seconds() const
+{
+	return (now_ns() - start_time_ns) / 1000000000ULL;
+}
+
+static void append_metric(std::string& out, const char* name, const char* type, const char* help, uint64_t value)
+{
+	out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+	out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+	out.append(name).append(" ").append(std::to_string(value)).append("\n");
+}
+
+static void append_summary(std::string& out, const char* name, const char* help, const LatencyHistogram& histogram)
+{
+	static const double QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+	char line[128];
+
+	out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+	out.append("# TYPE ").append(name).append(" summary\n");
+	for (double quantile : QUANTILES)
+	{
+		std::snprintf(line, sizeof(line), "%s{quantile=\"%g\"} %.9f\n", name, quantile, histogram.percentile(quantile) / 1e9);
+		out.append(line);
+	}
+	std::snprintf(line, sizeof(line), "%s_sum %.9f\n", name, histogram.sum() / 1e9);
+	out.append(line);
+	out.append(name).append("_count ").append(std::to_string(histogram.count())).append("\n");
+}
+
+std::string Metrics::to_prometheus(size_t clients, size_t channels) const
+{
+	std::string out;
+	out.reserve(4096);
+	append_metric(out, "ircserv_uptime_seconds", "gauge", "Seconds since the server started.", uptime_seconds());
+	append_metric(out, "ircserv_clients", "gauge", "Connected clients.", clients);
+	append_metric(out, "ircserv_channels", "gauge", "Existing channels.", channels);
+	append_metric(out, "ircserv_bytes_received_total", "counter", "Bytes read from client sockets.", bytes_received);
+	append_metric(out, "ircserv_bytes_sent_total", "counter", "Bytes written to client sockets.", bytes_sent);
+	append_metric(out, "ircserv_send_calls_total", "counter", "Writes to client sockets (writev calls or io_uring sends).", send_calls);
+	append_metric(out, "ircserv_lines_parsed_total", "counter", "IRC lines parsed.", lines_parsed);
+	append_metric(out, "ircserv_accepts_total", "counter", "Connections accepted.", accepts);
+	append_metric(out, "ircserv_disconnects_total", "counter", "Clients disconnected.", disconnects);
+	append_metric(out, "ircserv_lines_deferred_total", "counter", "Lines deferred by flood control.", lines_deferred);
+	append_metric(out, "ircserv_excess_flood_disconnects_total", "counter", "Clients disconnected for flooding.", excess_flood_disconnects);
+	append_metric(out, "ircserv_lines_too_long_total", "counter", "Lines dropped for exceeding 512 bytes.", lines_too_long);
+	append_metric(out, "ircserv_input_yields_total", "counter", "Client turns cut short by the per-iteration input budgets.", input_yields);
+	append_metric(out, "ircserv_history_replayed_total", "counter", "Channel history lines replayed on JOIN or CHATHISTORY.", history_replayed);
+	append_metric(out, "ircserv_loop_iterations_total", "counter", "Event loop iterations.", loop_iterations);
+	append_metric(out, "ircserv_send_queue_high_water_bytes", "gauge", "Largest client send queue seen.", send_queue_high_water);
+
+	out.append("# HELP ircserv_commands_total Commands received, by command.\n");
+	out.append("# TYPE ircserv_commands_total counter\n");
+	for (size_t id = 0; id < CMD_COUNT; ++id)
+	{
+		const char* name = (id == CMD_UNKNOWN) ? "UNKNOWN" : COMMAND_TABLE[id].name;
+		out.append("ircserv_commands_total{command=\"").append(name).append("\"} ");
+		out.append(std::to_string(commands[id])).append("\n");
+	}
+	append_summary(out, "ircserv_command_latency_seconds", "Time from a line being received to its command being handled.", command_latency);
+	append_summary(out, "ircserv_loop_iteration_seconds", "Time spent handling the events of one loop iteration.", loop_latency);
+	return out;
+}
+
+MetricsListener::MetricsListener(const std::string& path) : _fd(-1), _path(path)
+{
+	sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path))
+		throw std::runtime_error("Metrics socket path too long: " + path);
+	std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+	_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (_fd < 0)
+		throw std::runtime_error(std::string("Metrics socket creation failed: ") + std::strerror(errno));
+	// A previous run may have left its socket file behind
+	unlink(path.c_str());
+	if (bind(_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(_fd, 8) < 0)
+	{
+		std::string error = std::strerror(errno);
+		close(_fd);
+		throw std::runtime_error("Metrics socket bind failed on " + path + ": " + error);
+	}
+	LOG_INFO("Metrics available on unix socket " << path);
+}
+
+MetricsListener::MetricsListener(const std::string& path, int fd) : _fd(fd), _path(path)
+{
+}
+
+void MetricsListener::hand_over()
+{
+	if (_fd >= 0)
+		close(_fd);
+	_fd = -1;
+}
+
+MetricsListener::~MetricsListener()
+{
+	if (_fd >= 0)
+	{
+		close(_fd);
+		unlink(_path.c_str());
+	}
+}
+
+int MetricsListener::get_fd() const
+{
+	return _fd;
+}
+
+void MetricsListener::serve(const std::string& payload)
+{
+	while (true)
+	{
+		int fd = accept4(_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				LOG_WARN("Metrics accept failed: " << std::strerror(errno));
+			return ;
+		}
+		// The dump is a few KB and the socket is fresh, one send() fits in its buffer
+		ssize_t sent = ::send(fd, payload.data(), payload.size(), MSG_NOSIGNAL);
+		if (sent < static_cast<ssize_t>(payload.size()))
+			LOG_WARN("Metrics dump truncated on FD " << fd);
+		close(fd);
+	}
+}
@@ -0,0 +1,157 @@
+#include "../includes/Network.hpp"
+#include "../includes/CaseMapping.hpp"
+#include <algorithm>
+#include <unordered_set>
+
+void RemoteUser::update_prefix()
+{
+	prefix = nickname + "!" + username + "@" + hostname;
+}
+
+void RemoteUser::remove_channel(const ChannelName& channel_name)
+{
+	auto it = std::find(channels.begin(), channels.end(), channel_name);
+	if (it != channels.end())
+	{
+		*it = std::move(channels.back());
+		channels.pop_back();
+	}
+}
+
+Network::Network() : _user_count(0)
+{
+}
+
+static bool same_server_name(std::string_view a, std::string_view b)
+{
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i < a.size(); ++i)
+	{
+		if (irc_tolower(a[i], CASEMAPPING_ASCII) != irc_tolower(b[i], CASEMAPPING_ASCII))
+			return false;
+	}
+	return true;
+}
+
+const std::vector<RemoteServer>& Network::get_servers() const
+{
+	return _servers;
+}
+
+// A network has a handful of servers: a linear scan is all it takes
+const RemoteServer* Network::find_server(std::string_view name) const
+{
+	for (const RemoteServer& server : _servers)
+	{
+		if (same_server_name(server.name, name))
+			return &server;
+	}
+	return NULL;
+}
+
+const RemoteServer* Network::find_link(int link_fd) const
+{
+	for (const RemoteServer& server : _servers)
+	{
+		if (server.link_fd == link_fd && server.hopcount == 1)
+			return &server;
+	}
+	return NULL;
+}
+
+void Network::add_server(const RemoteServer& server)
+{
+	_servers.push_back(server);
+}
+
+// The servers are in introduction order, so one pass finds the whole subtree:
+// a server is behind the removed one when its uplink was removed before it
+std::vector<std::string> Network::remove_servers(std::string_view name)
+{
+	std::vector<std::string> removed;
+	std::unordered_set<std::string> removed_folded;
+	std::vector<RemoteServer> kept;
+	for (RemoteServer& server : _servers)
+	{
+		if (same_server_name(server.name, name) || removed_folded.count(irc_casefold(server.uplink, CASEMAPPING_ASCII)))
+		{
+			removed_folded.insert(irc_casefold(server.name, CASEMAPPING_ASCII));
+			removed.push_back(std::move(server.name));
+		}
+		else
+			kept.push_back(std::move(server));
+	}
+	_servers.swap(kept);
+	return removed;
+}
+
+std::vector<std::string> Network::remove_link(int link_fd)
+{
+	std::vector<std::string> removed;
+	auto behind = [link_fd](const RemoteServer& server) { return server.link_fd == link_fd; };
+	for (const RemoteServer& server : _servers)
+	{
+		if (behind(server))
+			removed.push_back(server.name);
+	}
+	_servers.erase(std::remove_if(_servers.begin(), _servers.end(), behind), _servers.end());
+	return removed;
+}
+
+int Network::add_user(RemoteUser user)
+{
+	user.used = true;
+	user.update_prefix();
+	++_user_count;
+	if (!_free_ids.empty())
+	{
+		int id = _free_ids.back();
+		_free_ids.pop_back();
+		_users[REMOTE_ID_FIRST - id] = std::move(user);
+		return id;
+	}
+	_users.push_back(std::move(user));
+	return REMOTE_ID_FIRST - static_cast<int>(_users.size() - 1);
+}
+
+RemoteUser* Network::find_user(int id)
+{
+	if (!is_remote(id))
+		return NULL;
+	size_t index = static_cast<size_t>(REMOTE_ID_FIRST - id);
+	if (index >= _users.size() || !_users[index].used)
+		return NULL;
+	return &_users[index];
+}
+
+void Network::remove_user(int id)
+{
+	RemoteUser* user = find_user(id);
+	if (!user)
+		return ;
+	*user = RemoteUser();
+	user->used = false;
+	_free_ids.push_back(id);
+	--_user_count;
+}
+
+size_t Network::user_count() const
+{
+	return _user_count;
+}
+
+// hostname-like: letters, digits, '-' and '.', with at least one '.' so it
+// cannot be mistaken for a nickname in a message prefix
+bool Network::is_valid_server_name(std::string_view name)
+{
+	if (name.empty() || name.size() > 63 || name.find('.') == std::string_view::npos)
+		return false;
+	for (char c : name)
+	{
+		bool alnum = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+		if (!alnum && c != '-' && c != '.')
+			return false;
+	}
+	return true;
+}
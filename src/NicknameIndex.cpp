@@ -0,0 +1,56 @@
+#include "../includes/NicknameIndex.hpp"
+
+NicknameIndex::NicknameIndex(CaseMapping mapping) : _mapping(mapping)
+{
+}
+
+std::string_view NicknameIndex::fold(std::string_view name, char* buffer) const
+{
+	for (size_t i = 0; i < name.size(); ++i)
+		buffer[i] = irc_tolower(name[i], _mapping);
+	return std::string_view(buffer, name.size());
+}
+
+int NicknameIndex::find(std::string_view nickname) const
+{
+	if (nickname.size() > NICKLEN)
+		return -1;
+	char buffer[NICKLEN];
+	auto it = _fds.find(fold(nickname, buffer));
+	return (it == _fds.end()) ? -1 : it->second.fd;
+}
+
+bool NicknameIndex::insert(std::string_view nickname, int client_fd)
+{
+	if (nickname.size() > NICKLEN)
+		return false;
+	char buffer[NICKLEN];
+	std::string_view folded = fold(nickname, buffer);
+	auto it = _fds.find(folded);
+	// Re-inserting your own nick (e.g. "bob" -> "Bob") is fine
+	if (it != _fds.end())
+		return it->second.fd == client_fd;
+	// The key is copied once, here; the map key views the copy the entry owns
+	std::unique_ptr<const std::string> key = std::make_unique<const std::string>(folded);
+	std::string_view key_view(*key);
+	_fds.emplace(key_view, Entry{std::move(key), client_fd});
+	return true;
+}
+
+void NicknameIndex::erase(std::string_view nickname)
+{
+	if (nickname.size() > NICKLEN)
+		return ;
+	char buffer[NICKLEN];
+	_fds.erase(fold(nickname, buffer));
+}
+
+size_t NicknameIndex::size() const
+{
+	return _fds.size();
+}
+
+CaseMapping NicknameIndex::get_casemapping() const
+{
+	return _mapping;
+}
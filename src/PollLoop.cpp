@@ -0,0 +1,77 @@
+#include "../includes/PollLoop.hpp"
+#include <stdexcept>
+
+short PollLoop::to_poll_events(unsigned int events)
+{
+	short poll_events = 0;
+	if (events & EVENT_READ)
+		poll_events |= POLLIN;
+	if (events & EVENT_WRITE)
+		poll_events |= POLLOUT;
+	return poll_events;
+}
+
+void PollLoop::add(int fd, unsigned int events)
+{
+	if (_index.find(fd) != _index.end())
+		throw std::runtime_error("PollLoop: fd " + std::to_string(fd) + " is already registered");
+	_index[fd] = _pollfds.size();
+	_pollfds.push_back({fd, to_poll_events(events), 0});
+}
+
+void PollLoop::modify(int fd, unsigned int events)
+{
+	_pollfds[_index.at(fd)].events = to_poll_events(events);
+}
+
+void PollLoop::remove(int fd)
+{
+	auto it = _index.find(fd);
+	if (it == _index.end())
+		return ;
+	// Move the last entry into the hole so the removal stays O(1)
+	size_t pos = it->second;
+	_index.erase(it);
+	if (pos != _pollfds.size() - 1)
+	{
+		_pollfds[pos] = _pollfds.back();
+		_index[_pollfds[pos].fd] = pos;
+	}
+	_pollfds.pop_back();
+}
+
+int PollLoop::wait(std::vector<IoEvent>& ready, int timeout_ms)
+{
+	ready.clear();
+	int num_events = poll(_pollfds.data(), _pollfds.size(), timeout_ms);
+	if (num_events <= 0)
+		return num_events;
+	// poll() does not tell us which entries are ready, so we have to scan them
+	for (size_t i = 0; i < _pollfds.size() && static_cast<int>(ready.size()) < num_events; ++i)
+	{
+		short revents = _pollfds[i].revents;
+		if (revents == 0)
+			continue;
+		unsigned int events = 0;
+		if (revents & POLLIN)
+			events |= EVENT_READ;
+		if (revents & POLLOUT)
+			events |= EVENT_WRITE;
+		if (revents & POLLHUP)
+			events |= EVENT_HANGUP;
+		if (revents & (POLLERR | POLLNVAL))
+			events |= EVENT_ERROR;
+		ready.push_back({_pollfds[i].fd, events, 0});
+	}
+	return static_cast<int>(ready.size());
+}
+
+bool PollLoop::is_edge_triggered() const
+{
+	return false;
+}
+
+const char* PollLoop::name() const
+{
+	return "poll";
+}
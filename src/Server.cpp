@@ -1,29 +1,46 @@
 #include "../includes/Server.hpp"
+#include <climits> // For INT_MAX, PATH_MAX
+#include <sys/wait.h> // For waitpid()
+#include <fcntl.h> // For fcntl()
+#include <unistd.h> // For fork(), execve(), readlink(), environ
+#include <sys/syscall.h> // For __NR_close_range
 
-bool Server::_signal_received = false;
+volatile sig_atomic_t Server::_signal_received = 0;
+volatile sig_atomic_t Server::_upgrade_requested = 0;
 
 // Helper functions
-bool Server::is_duplicate_nickname(const std::string& nickname)
+bool Server::is_duplicate_nickname(std::string_view nickname, int client_fd)
 {
-	// Check if the nickname is already taken by another client
-	for (const auto& client : _clients)
+	// Check if the nickname is already taken by another client (one hash lookup, case-insensitive)
+	int owner_fd = _nicknames.find(nickname);
+	return owner_fd != -1 && owner_fd != client_fd;
+}
+
+// RFC 2812: nickname = ( letter / special ) *( letter / digit / special / "-" )
+bool Server::is_valid_nickname(std::string_view nickname)
+{
+	if (nickname.empty() || nickname.size() > NICKLEN)
+		return false;
+	for (size_t i = 0; i < nickname.size(); ++i)
 	{
-		if (client.second.get_nickname() == nickname)
-		{
-			return true;
-		}
+		char c = nickname[i];
+		bool letter = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+		bool special = c != '\0' && std::strchr("[]\\`_^{|}", c) != NULL;
+		bool digit_or_dash = (c >= '0' && c <= '9') || c == '-';
+		if (!letter && !special && !(i > 0 && digit_or_dash))
+			return false;
 	}
-	return false;
+	return true;
 }
 
 bool Server::valid_inputs(int port, const std::string& password)
 {
 	if (port <= 0 || port > MAX_PORT_NBR) {
-		std::cerr << "Error: Invalid port number." << std::endl;
+		LOG_ERROR("Invalid port number.");
 		return false;
 	}
 	if (password.empty()) {
-		std::cerr << "Error: Empty password provided." << std::endl;
+		LOG_ERROR("Empty password provided.");
 		return false;
 	}
 	return true;
@@ -57,15 +74,76 @@ sockaddr_in Server::create_sockaddr_in(int port)
 // }
 
 // Constructor: Sets up the server
-Server::Server(int port, const std::string& password)
-	: _listening_socket(), // Initialize the listening socket (calls Socket::Socket())
+Server::Server(int port, const std::string& password, const Config& config, const UpgradeState* upgrade)
+	: _listening_socket(upgrade ? Socket(upgrade->listening_fd) : Socket()), // Socket::Socket() creates a new socket
 	_port(port),
-	_password(password)
+	_password(password),
+	_event_loop(EventLoop::create(config.event_backend)),
+	_recv_chunk_size(config.recv_chunk_size),
+	_listen_backlog(static_cast<int>(std::min<size_t>(config.listen_backlog, INT_MAX))),
+	_accept_batch(config.accept_batch),
+	_accept_pending(false),
+	_accept_retry_ms(0),
+	_read_budget(config.read_budget),
+	_line_budget(config.line_budget),
+	_channels(config.casemapping, HistoryLimits{config.history_lines, config.history_bytes, config.history_total_bytes}),
+	_nicknames(config.casemapping),
+	_history_join_replay(config.history_join_replay),
+	_history_batch_id(0),
+	_oper_password(config.oper_password),
+	_server_name(config.server_name),
+	_link_password(config.link_password),
+	_now_ms(TimerWheel::monotonic_ms()),
+	_timers(_now_ms),
+	_registration_timeout_ms(config.registration_timeout * 1000),
+	_ping_interval_ms(config.ping_interval * 1000),
+	_ping_timeout_ms(config.ping_timeout * 1000),
+	_idle_timeout_ms(config.idle_timeout * 1000),
+	_flood_excess_timeout_ms(config.flood_excess_timeout * 1000),
+	_flood_max_backlog(config.flood_max_backlog),
+	_snapshot_path(config.snapshot_file),
+	_snapshot_temp_path(config.snapshot_file + ".tmp"),
+	_snapshot_interval_ms(config.snapshot_interval * 1000),
+	_next_snapshot_ms(_now_ms + _snapshot_interval_ms),
+	_snapshot_generation(0),
+	_snapshot_pid(-1)
 {
+	std::copy(config.flood_limits, config.flood_limits + FLOOD_CLASS_COUNT, _flood_limits);
 	if (!valid_inputs(port, password))
 		return;
+	if (upgrade)
+		LOG_INFO("Took over the listening socket on port " << _port);
+	else
+		bind_listening_socket();
+
+	// Register the listening socket with the event loop
+	// We are interested in read events (new connections)
+	_event_loop->add(_listening_socket.get_fd(), EVENT_READ);
+	LOG_INFO("Server initialized and listening (" << _event_loop->name() << " backend).");
+
+	if (upgrade && upgrade->metrics_fd >= 0 && !config.metrics_socket.empty())
+	{
+		_metrics_listener = std::make_unique<MetricsListener>(config.metrics_socket, upgrade->metrics_fd);
+		_event_loop->add(_metrics_listener->get_fd(), EVENT_READ);
+	}
+	else if (!config.metrics_socket.empty())
+	{
+		_metrics_listener = std::make_unique<MetricsListener>(config.metrics_socket);
+		_event_loop->add(_metrics_listener->get_fd(), EVENT_READ);
+	}
+	else if (upgrade && upgrade->metrics_fd >= 0)
+		close(upgrade->metrics_fd);
+	if (upgrade)
+		restore(*upgrade);
+	else if (!_snapshot_path.empty())
+		load_snapshot();
+	_snapshot_generation = _channels.generation();
+}
+
+void Server::bind_listening_socket()
+{
 	// Setup the server address structure
-	sockaddr_in server_addr = create_sockaddr_in(port);
+	sockaddr_in server_addr = create_sockaddr_in(_port);
 	// std::memset(&server_addr, 0, sizeof(server_addr));
 	// server_addr.sin_family = AF_INET;         // IPv4. 
 	// server_addr.sin_addr.s_addr = INADDR_ANY; // Listen on any available interface
@@ -80,28 +158,21 @@ Server::Server(int port, const std::string& password)
 	{
 		throw std::runtime_error(std::string("Socket bind failed: ") + std::strerror(errno));
 	}
-	std::cout << "Socket bound to port " << _port << std::endl;
+	LOG_DEBUG("Socket bound to port " << _port);
 
 	// Start listening
 	// When your server is busy processing one connection, new incoming connection requests from other clients don't get immediately rejected. 
 	// Instead, the operating system's TCP/IP stack queues them up to a certain limit. 
 	// The backlog argument suggests to the system how many pending connections it should queue.
-	// Once this queue is full, new connection attempts might be rejected or time out. 
-	// A value of 10 is a common, reasonable starting point for many servers.
-	// Very high-traffic servers might use larger values.
-	if (listen(_listening_socket.get_fd(), BACKLOG) < 0) //TODO: is 10 a good value for backlog?
+	// Once this queue is full, new connection attempts might be rejected or time out,
+	// and a client whose SYN was dropped only retries a second later: after a
+	// netsplit or a restart thousands of clients reconnect at once, so the
+	// queue has to be deep (IRCSERV_LISTEN_BACKLOG; the kernel caps it at net.core.somaxconn).
+	if (listen(_listening_socket.get_fd(), _listen_backlog) < 0)
 	{
 		throw std::runtime_error(std::string("Socket listen failed: ") + std::strerror(errno));
 	}
-	std::cout << "Server listening on port " << _port << std::endl;
-
-	// Add the listening socket to the pollfd vector
-	// For Block 1, this is the only FD we monitor initially
-	// listen_pfd.fd = _listening_socket.get_fd(); -> The file descriptor to monitor
-	// listen_pfd.events = POLLIN; // We are interested in read events (new connections)
-	// Initialize revents to 0
-	_pollfds.push_back({_listening_socket.get_fd(), POLLIN, 0});
-	std::cout << GREEN << "Server initialized and listening." << RESET << std::endl;
+	LOG_INFO("Server listening on port " << _port);
 }
 
 // Destructor (basic cleanup, although RAII handles most sockets)
@@ -109,14 +180,21 @@ Server::~Server()
 {
 	// The Socket destructor handles _listening_socket
 	// In later blocks, you'd iterate _clients and _channels here for cleanup
-	std::cout << "Server shutting down." << std::endl;
+	LOG_INFO("Server shutting down.");
 }
 
 void Server::handle_signal(int signum)
 {
-	// Handle the signal (e.g., SIGINT, SIGTERM)
-	std::cout << RED << "Signal " << signum << " received. Shutting down server." << RESET << std::endl;
-	_signal_received = true; // Set the flag to indicate a signal was received
+	// Only async-signal-safe work here: no logging, no allocation.
+	// The event loop reports the shutdown once wait() returns
+	(void)signum;
+	_signal_received = 1; // Set the flag to indicate a signal was received
+}
+
+void Server::handle_upgrade_signal(int signum)
+{
+	(void)signum;
+	_upgrade_requested = 1;
 }
 
 /*
@@ -137,475 +215,2176 @@ void Server::setup_signal_handlers()
 	// Register the handler for SIGINT (Ctrl+C)
 	if (sigaction(SIGINT, &sa, NULL) == -1)
 	{
-		std::cerr << RED << "Error: Could not set up SIGINT handler: " << std::strerror(errno) << RESET << std::endl;
+		LOG_ERROR("Could not set up SIGINT handler: " << std::strerror(errno));
 		exit(EXIT_FAILURE);
 	}
 	// Register the handler for SIGQUIT (Ctrl+\)
 	if (sigaction(SIGQUIT, &sa, NULL) == -1)
 	{
-		std::cerr << RED << "Error: Could not set up SIGQUIT handler: " << std::strerror(errno) << RESET << std::endl;
+		LOG_ERROR("Could not set up SIGQUIT handler: " << std::strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	// SIGUSR2: hot upgrade. SA_RESTART is left out on purpose, the loop's
+	// wait() must be interrupted to see the request
+	sa.sa_handler = Server::handle_upgrade_signal;
+	if (sigaction(SIGUSR2, &sa, NULL) == -1)
+	{
+		LOG_ERROR("Could not set up SIGUSR2 handler: " << std::strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	// Ignore SIGPIPE: writing to a peer that is gone must fail with EPIPE
+	// (handled in Client::flush_send_queue) instead of killing the server
+	sa.sa_handler = SIG_IGN;
+	if (sigaction(SIGPIPE, &sa, NULL) == -1)
+	{
+		LOG_ERROR("Could not ignore SIGPIPE: " << std::strerror(errno));
 		exit(EXIT_FAILURE);
 	}
 
-	std::cout << GREEN << "Signal handlers for SIGINT and SIGQUIT set up." << RESET << std::endl;
+	LOG_DEBUG("Signal handlers for SIGINT and SIGQUIT set up.");
 }
 
 void Server::handle_new_connection()
 {
-	// Accept a new connection
-    std::unique_ptr<Socket> client_socket = _listening_socket.accept();
-    if (!client_socket)
-    {
-        std::cerr << "Error accepting new connection: " << std::strerror(errno) << std::endl;
-        return ;
-    }
-    int client_fd = client_socket->get_fd();
-
-	// Create a new Client with the accepted socket and store the client in the clients map
-	// Client(std::move(client_socket)): Creates a temporary Client object that takes ownsership of the socket
-	// _client.emplace(...): Inserts the client in the map and therefore the client is accessible even after the function returns
-	_clients.emplace(client_fd, Client(std::move(client_socket)));
-	std::cout << "New connection accepted on FD " << client_fd << std::endl;
-
-    // std::cout << "Was it inserted? " << (a.second ? "Yes" : "No") << std::endl;
-	// Add the new client socket to the pollfd vector
-	// We are interested in read events (client data) -> POLLIN
-	// Initialize revents to 0
-	_pollfds.push_back({client_fd, POLLIN, 0});
-	try
+	// Accept the pending connections until EAGAIN: an edge-triggered backend
+	// only wakes us up once for the whole accept queue. A connect storm is
+	// taken in batches of _accept_batch so the connected clients are still
+	// served in between; _accept_pending makes run() come back for the rest
+	// without waiting for an event that would never come
+	_accept_pending = false;
+	for (size_t accepted = 0; accepted < _accept_batch; ++accepted)
 	{
-		_clients.at(client_fd).send("Welcome to the server Abdallah!! How are you?!\r\n");
+		int client_fd = _listening_socket.accept();
+		if (client_fd >= 0)
+		{
+			add_client(client_fd);
+			continue;
+		}
+		// The accept queue is empty
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return ;
+		// Out of fds or memory: the rest of the queue waits, see pause_accepting()
+		if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+		{
+			pause_accepting();
+			return ;
+		}
+		// Only this connection failed (aborted before we got to it, a network
+		// error...) or a signal came: the next one in the queue may be fine
+		if (errno != ECONNABORTED && errno != EINTR)
+			LOG_WARN("Error accepting new connection: " << std::strerror(errno));
 	}
-	catch (const std::exception& e)
+	_accept_pending = true;
+}
+
+// The pending connections cannot be taken for now, and the listening socket
+// would keep reporting them (on every wait() with poll()): it is taken out of
+// the event loop until run() calls resume_accepting(), ACCEPT_RETRY_MS later
+void Server::pause_accepting()
+{
+	if (_accept_retry_ms == 0)
+	{
+		LOG_WARN("Cannot accept new connections: " << std::strerror(errno) << ", retrying in " << ACCEPT_RETRY_MS << " ms");
+		_event_loop->remove(_listening_socket.get_fd());
+	}
+	_accept_retry_ms = _now_ms + ACCEPT_RETRY_MS;
+}
+
+// Watches the listening socket again and goes through the accept queue: with
+// an edge-triggered backend nothing would report what queued up meanwhile
+void Server::resume_accepting()
+{
+	_accept_retry_ms = 0;
+	_event_loop->add(_listening_socket.get_fd(), EVENT_READ);
+	handle_new_connection();
+}
+
+void Server::add_client(int client_fd)
+{
+	// Build the Client in place in its fd slot; it owns the socket from now on
+	// and is accessible even after the function returns
+	Client& client = _clients.emplace(client_fd, client_fd, _event_loop.get(), _recv_chunk_size, &_flush_list);
+	LOG_INFO("New connection accepted on FD " << client_fd);
+	++Metrics::instance().accepts;
+
+	// Register the new client socket with the event loop
+	// We are interested in read events (client data). Write events are only
+	// requested by the Client while its send queue is not empty
+	_event_loop->add(client_fd, EVENT_READ);
+	client.send("Welcome to the server Abdallah!! How are you?!\r\n");
+	// PASS / NICK / USER must be done before this fires
+	client.note_activity(_now_ms, true);
+	client.get_timer().owner = client_fd;
+	_timers.schedule(client.get_timer(), _now_ms, _registration_timeout_ms);
+	LOG_DEBUG("New client added to the event loop.");
+}
+
+// Removes the client from every channel it is in, using its reverse index:
+// O(channels of the client), no scan over all the channels.
+// The other members get one QUIT each, even if they share several channels with it
+void Server::leave_all_channels(int client_fd, const std::string& reason)
+{
+	Client& client = _clients.at(client_fd);
+	std::vector<int> recipients;
+	for (const ChannelName& channel_name : client.get_channels())
 	{
-		std::cerr << "Error sending message: " << e.what() << std::endl;
+		Channel* channel = _channels.find_by_key(channel_name->key);
+		if (!channel)
+			continue;
+		channel->remove_client(client_fd);
+		const std::vector<int>& members = channel->get_clients();
+		recipients.insert(recipients.end(), members.begin(), members.end());
+		_channels.release_if_empty(channel);
+	}
+	if (!client.is_authenticated() || recipients.empty())
 		return ;
+	std::sort(recipients.begin(), recipients.end());
+	recipients.erase(std::unique(recipients.begin(), recipients.end()), recipients.end());
+	SharedBuffer quit_message = make_shared_buffer(":" + client.get_prefix() + " QUIT :" + reason + "\r\n");
+	for (int member_fd : recipients)
+	{
+		if (Client* member = _clients.find(member_fd))
+			member->send(quit_message);
 	}
-	std::cout << GREEN << "New client added to poll list." << RESET << std::endl;
 }
 
-void Server::handle_disconnection(size_t& index)
+void Server::handle_disconnection(int client_fd, const std::string& reason)
 {
 	// Handle disconnection of a client
-	std::cout << "Client on FD " << _pollfds[index].fd << " disconnected." << std::endl;
+	LOG_INFO("Client on FD " << client_fd << " disconnected (" << reason << ").");
+	++Metrics::instance().disconnects;
+
+	// Its last words (an ERROR, a reply) are still corked: write what the
+	// socket takes. Before the removal, a partial write asks for write events
+	if (Client* client = _clients.find(client_fd))
+	{
+		if (client->take_flush_queued())
+			client->flush_send_queue();
+	}
+
+	// Stop watching the fd first: epoll needs it to still be open
+	_event_loop->remove(client_fd);
 
-    //ADDED (tobias): Remove the client from the _clients map
-    // _clients.erase(client_fd);
-	_clients.erase(_pollfds[index].fd);
+	// Free the nickname for the next client and leave the channels, so no
+	// channel keeps a stale fd that a future client could reuse
+	if (Client* client = _clients.find(client_fd))
+	{
+		if (client->is_link())
+		{
+			// A netsplit: everything behind the link is gone
+			if (client->is_authenticated())
+				drop_link(client_fd, reason);
+		}
+		else
+		{
+			leave_all_channels(client_fd, reason);
+			if (client->get_passed_nick())
+				_nicknames.erase(client->get_nickname());
+			if (client->is_authenticated())
+				send_to_links(make_shared_buffer(":" + client->get_prefix() + " QUIT :" + reason + "\r\n"), -1);
+		}
+	}
 
-	// Remove the client socket from the pollfd vector
-	close(_pollfds[index].fd);
-	_pollfds.erase(_pollfds.begin() + index); // Remove from pollfd vector
-	--index;
-	std::cout << GREEN << "Client removed from poll list." << RESET << std::endl;
+    //ADDED (tobias): Remove the client from the _clients table
+	// The Socket destructor closes the fd, the slot's generation moves on
+	_clients.erase(client_fd);
+	LOG_DEBUG("Client removed from the event loop.");
 }
 
-int Server::parse_pass(std::string pass, int client_fd)
+int Server::parse_pass(std::string_view pass, int client_fd)
 {
-    if (!_clients.at(client_fd).get_passed_pass())
+    Client& client = _clients.at(client_fd);
+    if (!client.get_passed_pass())
     {
-        if (pass == _password)
+        // The link password is accepted too: the connection may be a server,
+        // which says so with SERVER (see try_complete_registration for users)
+        if (pass == _password || (!_link_password.empty() && pass == _link_password))
         {
-            _clients.at(client_fd).set_passed_pass(pass);
-            std::cout << GREEN << "Client FD " << client_fd << " passed authentication with PASS command.\n" << RESET;
+            client.set_passed_pass(std::string(pass));
+            LOG_DEBUG("Client FD " << client_fd << " passed authentication with PASS command.");
         }
         else
         {
-            std::cerr << RED << "Client FD " << client_fd << " failed authentication with PASS command.\n" << RESET;
-			try
-			{
-				_clients.at(client_fd).send(std::string(RED) + "ERROR: Invalid password\r\n" + RESET);
-			}
-			catch (const std::exception& e)
-			{
-				std::cerr << "Error sending message: " << e.what() << std::endl;
-			}
+            LOG_INFO("Client FD " << client_fd << " failed authentication with PASS command.");
+			client.send(std::string(RED) + "ERROR: Invalid password\r\n" + RESET);
             return -1;
         }
     }
     else
     {
-        std::cerr << RED << "Client FD " << client_fd << " already passed authentication with PASS command.\n" << RESET;
-		try
-		{
-			_clients.at(client_fd).send(std::string(RED) + "ERROR: Already authenticated with PASS\r\n" + RESET);
-		}
-		catch (const std::exception& e)
-		{
-			std::cerr << "Error sending message: " << e.what() << std::endl;
-		}
+        LOG_DEBUG("Client FD " << client_fd << " already passed authentication with PASS command.");
+		client.send(std::string(RED) + "ERROR: Already authenticated with PASS\r\n" + RESET);
         return -1;
     }
     return (1);
 }
 
-int Server::parse_nick(std::string nick, int client_fd)
+// Handles both the first NICK of the registration and later nickname changes
+int Server::parse_nick(std::string_view nick, int client_fd)
 {
-    if (!_clients.at(client_fd).get_passed_nick())
+    Client& client = _clients.at(client_fd);
+    if (!is_valid_nickname(nick) || is_duplicate_nickname(nick, client_fd))
+    {
+        LOG_DEBUG("Client FD " << client_fd << " failed authentication with NICK command.");
+		client.send(std::string(RED) + "ERROR: Invalid nickname or a duplicate. Try it with another nickname\r\n" + RESET);
+        return -1;
+    }
+    std::string old_nickname = client.get_nickname();
+    std::string old_prefix = client.get_prefix();
+    if (client.get_passed_nick())
+        _nicknames.erase(old_nickname);
+    _nicknames.insert(nick, client_fd);
+    client.set_passed_nick(std::string(nick));
+    if (client.is_authenticated())
     {
-        if (is_duplicate_nickname(nick) || nick.find_first_of(" \n\r\v\t\f") != std::string::npos)
+        // Nickname change of a registered client
+        LOG_DEBUG("Client FD " << client_fd << " changed nickname from " << old_nickname << " to " << nick);
+        // Once to the client and to everyone sharing a channel with it
+        SharedBuffer nick_message = make_shared_buffer(":" + old_prefix + " NICK :" + client.get_nickname() + "\r\n");
+        std::vector<int> recipients(1, client_fd);
+        for (const ChannelName& channel_name : client.get_channels())
         {
-            std::cerr << RED << "Client FD " << client_fd << " failed authentication with NICK command.\n" << RESET;
-			try
-			{
-				_clients.at(client_fd).send(std::string(RED) + "ERROR: Invalid nickname or a duplicate. Try it with another nickname\r\n" + RESET);
-			}
-			catch (const std::exception& e)
-			{
-				std::cerr << "Error sending message: " << e.what() << std::endl;
-			}
-            return -1;
+            if (Channel* channel = _channels.find_by_key(channel_name->key))
+                recipients.insert(recipients.end(), channel->get_clients().begin(), channel->get_clients().end());
+        }
+        std::sort(recipients.begin(), recipients.end());
+        recipients.erase(std::unique(recipients.begin(), recipients.end()), recipients.end());
+        for (int member_fd : recipients)
+        {
+            if (Client* member = _clients.find(member_fd))
+                member->send(nick_message);
         }
-        _clients.at(client_fd).set_passed_nick(nick);
-        std::cout << GREEN << "Client FD " << client_fd << " passed authentication with NICK command.\n" << RESET;
+        send_to_links(nick_message, -1);
     }
     else
-    {
-        std::cerr << RED << "Client FD " << client_fd << " already passed authentication with NICK command.\n" << RESET;
-		try
-		{
-			_clients.at(client_fd).send(std::string(RED) + "ERROR: Already authenticated with NICK\r\n" + RESET);
-		}
-		catch (const std::exception& e)
-		{
-			std::cerr << "Error sending message: " << e.what() << std::endl;
-		}
-        return -1;
-    }
+        LOG_DEBUG("Client FD " << client_fd << " passed authentication with NICK command.");
     return (1);
 }
 
-int Server::parse_user(std::string user, int client_fd)
+// USER <username> 0 * :realname
+int Server::parse_user(const IrcMessage& msg, int client_fd)
 {
-    if (!_clients.at(client_fd).get_passed_user())
+    Client& client = _clients.at(client_fd);
+    if (!client.get_passed_user())
     {
-        std::istringstream iss(user);
-        std::string username, hostname, servername, real;
-        iss >> username >> hostname >> servername;
-        std::getline(iss >> std::ws, real);
-        if (real.empty() || real[0] != ':' || hostname != "0" || servername != "*")
+        if (msg.param_count != 4 || !msg.has_trailing || msg.params[1] != "0" || msg.params[2] != "*")
         {
-            std::cerr << RED << "Client FD " << client_fd << " failed authentication with USER command.\n" << RESET;
-			try
-			{
-				_clients.at(client_fd).send(std::string(RED) + "ERROR: Invalid USER command format. Use: USER <username> 0 * :realname\r\n" + RESET);
-			}
-			catch (const std::exception& e)
-			{
-				std::cerr << "Error sending message: " << e.what() << std::endl;
-			}       
+            LOG_DEBUG("Client FD " << client_fd << " failed authentication with USER command.");
+			client.send(std::string(RED) + "ERROR: Invalid USER command format. Use: USER <username> 0 * :realname\r\n" + RESET);
             return -1;
         }
-        _clients.at(client_fd).set_passed_user(username);
-        _clients.at(client_fd).set_passed_realname(real.substr(1));
-        std::cout << GREEN << "Client FD " << client_fd << " passed authentication with NICK command.\n" << RESET;
+        client.set_passed_user(std::string(msg.params[0]));
+        client.set_passed_realname(std::string(msg.params[3]));
+        LOG_DEBUG("Client FD " << client_fd << " passed authentication with USER command.");
     }
     else
     {
-        std::cerr << RED << "Client FD " << client_fd << " already passed authentication with USER command.\n" << RESET;
-		try
-		{
-			_clients.at(client_fd).send(std::string(RED) + "ERROR: Already authenticated with USER\r\n" + RESET);
-		}
-		catch (const std::exception& e)
-		{
-			std::cerr << "Error sending message: " << e.what() << std::endl;
-			return -1;
-		}        
+        LOG_DEBUG("Client FD " << client_fd << " already passed authentication with USER command.");
+		client.send(std::string(RED) + "ERROR: Already authenticated with USER\r\n" + RESET);
+        return -1;
     }
     return (1);
 }
 
-void Server::handle_authentication(size_t &index, int client_fd, const std::vector<std::string> &lines)
+// Once PASS, NICK and USER went through, the client is registered
+void Server::try_complete_registration(int client_fd)
 {
-    std::cout << "Handling authentication for client FD " << client_fd << std::endl;
-    for (auto &line : lines)
-    {
-        std::cout << "Processing line: " << line << std::endl;
-        std::string command;
-        std::istringstream ss(line);
-        ss >> command;
-        std::cout << "Command: " << command << std::endl;
-        if (command == "PASS")
-        {
-            std::string password;
-            std::getline(ss >> std::ws, password);
-            if (parse_pass(password, client_fd) == -1)
-            {
-                handle_disconnection(index);
-                return ;
-            }
-        }
-        else if (command == "NICK")
-        {
-            std::string nickname;
-            std::getline(ss >> std::ws, nickname);
-            if (parse_nick(nickname, client_fd) == -1)
-                continue;
-        }
-        else if (command == "USER")
-        {
-            std::string user;
-            std::getline(ss >> std::ws, user);
-            if (parse_user(user, client_fd) == -1)
-                continue;
-        }
-        else
-        {
-            std::cerr << RED << "Client FD " << client_fd << " sent an invalid command: " << command << RESET << std::endl;
-			try
-			{
-				_clients.at(client_fd).send(std::string(RED) + "ERROR: Invalid command. Use PASS, NICK, or USER.\r\n" + RESET);
-			}
-			catch (const std::exception& e)
-			{
-				std::cerr << "Error sending message: " << e.what() << std::endl;
-				continue;
-			}
-        }
-    }
-    if (_clients.at(client_fd).get_passed_pass() &&
-        _clients.at(client_fd).get_passed_nick() &&
-        _clients.at(client_fd).get_passed_user())
+    Client& client = _clients.at(client_fd);
+    if (client.is_authenticated() || !client.get_passed_pass() || !client.get_passed_nick() || !client.get_passed_user())
+        return ;
+    if (client.get_password() != _password)
     {
-        _clients.at(client_fd).set_authenticated();
-        std::cout << GREEN << "Client FD " << client_fd << " successfully authenticated." << RESET << std::endl;
-		try
-		{
-			_clients.at(client_fd).send(std::string(GREEN) + "Welcome to the server, " + _clients.at(client_fd).get_nickname() + "!\r\n" + RESET);
-		}
-		catch (const std::exception& e)
-		{
-			std::cerr << "Error sending message: " << e.what() << std::endl;
-			return ;
-		}
+        // Gave the link password, then registered as a user
+        client.send(std::string(RED) + "ERROR: Invalid password\r\n" + RESET);
+        return ;
     }
+    client.set_authenticated();
+    // Registered: the registration deadline becomes the keepalive check
+    _timers.schedule(client.get_timer(), _now_ms, _ping_interval_ms);
+    LOG_INFO("Client FD " << client_fd << " registered as " << client.get_nickname());
+	client.send(std::string(GREEN) + "Welcome to the server, " + client.get_nickname() + "!\r\n" + RESET);
+	// The rest of the network learns about the new user
+	send_to_links(make_shared_buffer(user_introduction(client.get_nickname(), 1, client.get_username(),
+		client.get_hostname(), _server_name, client.get_realname())), -1);
 }
 
-void Server::process_client_data(size_t& index, int client_fd)
+// One turn of a client: reads at most _read_budget bytes and handles at most
+// _line_budget lines. Whatever is left (the socket was not drained, lines are
+// still buffered) is queued for the next iteration, behind the other clients,
+// so one fast sender cannot hold the loop. With the edge-triggered backend no
+// new event comes for data already waiting in the socket: the queue is what
+// brings us back to it. After a hangup the peer sends nothing more, so the
+// budgets are lifted: the socket is read up to the end of the stream and
+// every line pipelined before it is handled
+void Server::process_client_data(int client_fd)
 {
-	// std::cout << "\nprocessing data...\n";
-	char buffer[2];
-	ssize_t bytes_read;
-	while ((bytes_read = recv(client_fd, buffer, sizeof(buffer) - 1, 0)) > 0)
+	Client& client = _clients.at(client_fd);
+	bool hangup = client.is_hung_up();
+	Metrics& metrics = Metrics::instance();
+	size_t chunk_size = client.get_recv_chunk_size();
+	ssize_t bytes_read = 1; // Neither EOF nor an error seen
+	bool drained = false;
+	// With a budget's worth of input still buffered the socket waits: the
+	// buffer stays bounded and TCP pushes back on the sender
+	if (hangup || client.get_input_size() < _read_budget)
 	{
-		// Write to the buffer which is used to store data the client sends
-		_clients.at(client_fd).write_output_buffer(std::string(buffer, bytes_read));
+		size_t total = 0;
+		// Each recv() lands directly in the client's receive buffer, up to a whole chunk at a time
+		while ((bytes_read = client.read_from_socket()) > 0)
+		{
+			metrics.bytes_received += static_cast<uint64_t>(bytes_read);
+			total += static_cast<size_t>(bytes_read);
+			if (hangup)
+				continue;
+			// A short read means the socket is drained: skip the extra recv() that
+			// would only return EAGAIN (new data will trigger a new event anyway)
+			if (static_cast<size_t>(bytes_read) < chunk_size)
+			{
+				drained = true;
+				break;
+			}
+			if (total >= _read_budget)
+				break;
+		}
+		if (bytes_read <= 0)
+			drained = true;
 	}
-	if (bytes_read == 0)
+	// A hung up peer that is drained will not be reported again: treat it as the end of the stream
+	if (hangup && bytes_read < 0 && (errno == EWOULDBLOCK || errno == EAGAIN))
+		bytes_read = 0;
+	if (bytes_read < 0 && errno != EWOULDBLOCK && errno != EAGAIN && errno != EINTR)
 	{
-		std::cout << "Client disconnected (recv returned 0)" << std::endl;
-		handle_disconnection(index);
+		LOG_WARN("recv() failed on FD " << client_fd << ": " << std::strerror(errno));
+		handle_disconnection(client_fd, std::string("Read error: ") + std::strerror(errno));
 		return ;
 	}
-	else if (bytes_read < 0 && errno != EWOULDBLOCK && errno != EAGAIN)
-	{
-		std::cerr << "recv() failed: " << std::strerror(errno) << std::endl;
-		handle_disconnection(index);
+	// The lines that came before the end of the stream are all handled,
+	// unless flood control defers them
+	if (!dispatch_buffered_lines(client_fd, bytes_read == 0 ? SIZE_MAX : _line_budget))
 		return ;
-	}
-	std::string line;
-	std::vector<std::string> lines;
-	while (!(line = _clients.at(client_fd).extract_output_line()).empty())
+	if (bytes_read == 0)
 	{
-		lines.push_back(line);
-	}
-	// If there are no complete lines => just return
-	if (lines.empty())
+		// Deferred lines are still owed: run_throttled_clients() comes back,
+		// reads the end of the stream again and closes once they are handled
+		if (client.get_flood().is_throttled())
+			return ;
+		LOG_DEBUG("Client FD " << client_fd << " closed the connection (recv returned 0)");
+		handle_disconnection(client_fd);
 		return ;
-	for (const std::string& line : lines)
-	{
-		std::cout << "Client sent: " << line << std::endl;
 	}
-	// handle authentication. Check if the client sent PASS, NICK, USER commands. If not, send an error message back.
-	if (!_clients.at(client_fd).is_authenticated())
-	{
-		handle_authentication(index, client_fd, lines);
+	// A throttled client is resumed by run_throttled_clients(), reads included
+	if (!drained && !client.get_flood().is_throttled())
+		queue_input(client_fd);
+}
+
+// Puts the client at the back of the clients served on the next iteration
+void Server::queue_input(int client_fd)
+{
+	Client& client = _clients.at(client_fd);
+	if (client.is_input_queued())
 		return ;
-	}
-	// If the client is authenticated, process the command
-	handle_client_command(index, client_fd, lines);
-	// Forward the data to every other client, who joined the channel if the client is ready authenticated
+	client.set_input_queued(true);
+	++Metrics::instance().input_yields;
+	_input_pending.push_back(_clients.handle_of(client_fd));
 }
 
-int Server::handle_client_command(size_t &index, int client_fd, const std::vector<std::string>& lines)
+// Gives the clients queued on the previous iteration their turn, in order.
+// run() moved them to _input_resuming before handling the events, and their
+// read events were skipped: each client gets one turn per iteration
+void Server::run_pending_input()
 {
-    std::cout << "Handling command for client FD " << client_fd << std::endl;
-    for (auto &line : lines)
-    {
-        std::cout << "Processing line: " << line << std::endl;
-        std::string command;
-        std::istringstream ss(line);
-        ss >> command;
-        std::cout << "Command: " << command << std::endl;
-		if (command == "JOIN")
-		{
-			// Client wants to join a channel.
-			std::string channel_name;
-			std::getline(ss >> std::ws, channel_name);
-			if (channel_name.empty() || channel_name.size() < 2 || channel_name[0] != '#')
-			{
-				std::cerr << RED << "Client FD " << client_fd << " sent an invalid JOIN command: " << channel_name << RESET << std::endl;
-				try
-				{
-					_clients.at(client_fd).send(std::string(RED) + "ERROR: Invalid channel name. Use #channel_name.\r\n" + RESET);
-				}
-				catch (const std::exception& e)
-				{
-					std::cerr << "Error sending message: " << e.what() << std::endl;
-				}
-				continue;
-			}
-			channel_name.erase(0, 1); // Remove the '#' from the channel name
-			// Check if the channel already exists
-			auto it = _channels.find(channel_name);
-			if (it == _channels.end())
-			{
-				// Channel doesnt exist => create it
-				_channels.emplace(channel_name, Channel(channel_name, _clients));
-				std::cout << GREEN << "Channel " << channel_name << " was created!" << RESET << std::endl;
-			}
-			// Add the client to the channel
-			_channels.at(channel_name).add_client(client_fd);
-			try
-			{
-			    _clients.at(client_fd).send(std::string(GREEN) + "You have joined channel: " + channel_name + "\r\n" + RESET);
-			}
-			catch (const std::exception& e)
-			{
-			    std::cerr << "Error sending message: " << e.what() << std::endl;
-				return -1;
-			}
-			std::string message = "Client FD " + std::to_string(client_fd) + " has joined the channel: " + channel_name + "\r\n";
-			std::cout << GREEN << message << RESET << std::endl;
-			// Notify other clients in the channel (forward a message to all other clients in the channel)
-			_channels.at(channel_name).broadcast_message(message, client_fd);
-		}
-		else if (command == "PART")
-		{
+	for (const ClientHandle& handle : _input_resuming)
+	{
+		Client* client = _clients.find(handle);
+		if (!client)
+			continue;
+		client->set_input_queued(false);
+		process_client_data(handle.fd);
+	}
+	_input_resuming.clear();
+}
 
-		}
-		else if (command == "PRIVMSG")
+// Frames the complete lines of the receive buffer and dispatches them one by
+// one, until none is left, max_lines were handled or flood control defers
+// one. The lines are views into the receive buffer, nothing is copied.
+// Returns false when the client was disconnected
+bool Server::dispatch_buffered_lines(int client_fd, size_t max_lines)
+{
+	Client& client = _clients.at(client_fd);
+	Metrics& metrics = Metrics::instance();
+	FloodControl& flood = client.get_flood();
+	std::string_view line;
+	uint64_t received_at = Metrics::now_ns();
+	bool deferred = false;
+	size_t handled = 0;
+	// Lines too long are dropped by the framing; the 417 goes out where they were
+	auto report_overlong = [&]() {
+		if (size_t overlong = client.take_overlong_lines())
 		{
-
+			metrics.lines_too_long += overlong;
+			send_numeric(client_fd, "417", ":Input line was too long");
 		}
-		else if (command == "QUIT")
+	};
+	while (handled < max_lines && client.extract_output_line(line))
+	{
+		report_overlong();
+		LOG_DEBUG("FD " << client_fd << " sent: " << line);
+		DispatchResult result = dispatch_command(client_fd, line);
+		// The command disconnected the client (QUIT, wrong PASS...): its buffer is gone
+		if (result == DISPATCH_DISCONNECTED)
+			return false;
+		if (result == DISPATCH_DEFERRED)
 		{
-			handle_disconnection(index);
-			return 0;
+			// Stays in the buffer, with everything after it, until the bucket refills
+			client.unread_line(line);
+			deferred = true;
+			break ;
 		}
-		else if (command == "NICK")
+		// Includes the time the line waited behind the previous ones of the batch
+		metrics.command_latency.record(Metrics::now_ns() - received_at);
+		++handled;
+	}
+	report_overlong();
+	// Out of budget, the rest of the lines wait for the next turn
+	if (handled == max_lines)
+		queue_input(client_fd);
+	if (!deferred)
+		flood.unthrottle();
+	else
+	{
+		++metrics.lines_deferred;
+		if (_now_ms - flood.throttled_since() >= _flood_excess_timeout_ms || client.get_input_size() > _flood_max_backlog)
 		{
-			std::string nickname;
-			std::getline(ss >> std::ws, nickname);
-			if (parse_nick(nickname, client_fd) == -1)
-				continue;
+			++metrics.excess_flood_disconnects;
+			close_link(client_fd, "Excess Flood");
+			return false;
 		}
-		else if (command == "USER")
+		if (!flood.is_queued())
 		{
-			std::string user;
-			std::getline(ss >> std::ws, user);
-			if (parse_user(user, client_fd) == -1)
-				continue;
+			flood.set_queued(true);
+			_throttled.push_back(_clients.handle_of(client_fd));
 		}
-		else
+	}
+	// The handled lines are dropped from the buffer in one go
+	client.compact_input();
+	return true;
+}
+
+// Gives the throttled clients whose buckets have refilled another go at
+// their buffered lines, and at their socket: a throttled client is not
+// queued for its next read, so with edge triggering data may be waiting there
+void Server::run_throttled_clients()
+{
+	if (_throttled.empty())
+		return ;
+	// Dispatching may throttle clients again, which appends to _throttled
+	_resuming.swap(_throttled);
+	for (const ClientHandle& handle : _resuming)
+	{
+		Client* client = _clients.find(handle);
+		if (!client)
+			continue;
+		FloodControl& flood = client->get_flood();
+		flood.set_queued(false);
+		if (!flood.is_throttled())
+			continue;
+		if (flood.resume_at() > _now_ms)
 		{
-			std::cerr << RED << "Client FD " << client_fd << " sent an invalid command: " << command << RESET << std::endl;
-			try
-			{
-				_clients.at(client_fd).send(std::string(RED) + "ERROR: Invalid command. Use JOIN, PART, PRIVMSG, QUIT, NICK, or USER.\r\n" + RESET);
-			}
-			catch (const std::exception& e)
-			{
-			    std::cerr << "Error sending message: " << e.what() << std::endl;
-				continue;
-			}
+			flood.set_queued(true);
+			_throttled.push_back(handle);
+			continue;
 		}
+		process_client_data(handle.fd);
 	}
-	return 1;
+	_resuming.clear();
 }
 
-// The main server loop for Block 1
-void Server::run()
+// End of an iteration: every client that was sent something gets one write
+// with all of it (writev over the queued messages), instead of one write per
+// message as they were produced. A client dropped while flushing sends QUITs,
+// which extend the list; those are written in the same pass
+void Server::flush_clients()
 {
-	std::cout << "Entering server loop..." << std::endl;
-	while (true)
+	for (size_t i = 0; i < _flush_list.size(); ++i)
 	{
-		// Block indefinitely (-1 timeout) waiting for events on file descriptors in _pollfds
-		int num_events = poll(_pollfds.data(), _pollfds.size(), -1); // C++11 data() needed, or &(_pollfds[0]) for C++98
+		int client_fd = _flush_list[i];
+		Client* client = _clients.find(client_fd);
+		if (!client || !client->take_flush_queued())
+			continue;
+		if (!client->flush_send_queue())
+			handle_disconnection(client_fd);
+	}
+	_flush_list.clear();
+}
 
-		if (_signal_received)
-			break;
+// Startup without a hot upgrade: the channels and history of the last run.
+// A corrupt snapshot is reported and the server starts with what it read
+void Server::load_snapshot()
+{
+	uint64_t start_ns = Metrics::now_ns();
+	try
+	{
+		size_t channel_count = Snapshot::load(_snapshot_path, _channels, _clients);
+		LOG_INFO("Loaded " << channel_count << " channels and " << _channels.history_bytes() << " bytes of history from "
+			<< _snapshot_path << " in " << (Metrics::now_ns() - start_ns) / 1000 << " us");
+	}
+	catch (const std::exception& e)
+	{
+		LOG_ERROR("Snapshot not loaded: " << e.what());
+	}
+}
 
-		if (num_events < 0)
+// In the snapshot child: every client, link and listening socket, and the
+// event loop's fd, were inherited. Holding them would keep a peer the parent
+// drops half-open until the child exits, so they are closed before writing
+static void close_inherited_fds()
+{
+#ifdef __NR_close_range
+	if (syscall(__NR_close_range, 3U, ~0U, 0U) == 0)
+		return ;
+#endif
+	long max_fd = sysconf(_SC_OPEN_MAX);
+	for (int fd = 3; fd < (max_fd > 0 ? max_fd : 1024); ++fd)
+		close(fd);
+}
+
+// Every IRCSERV_SNAPSHOT_INTERVAL seconds, when the channels changed, a
+// forked child writes the snapshot: fork() copies the page tables and the
+// pages are only copied when the event loop writes to them, so the loop goes
+// on while the child serializes. The child reports errno as its exit status
+void Server::run_snapshot()
+{
+	if (_snapshot_pid > 0)
+	{
+		int status;
+		pid_t done = waitpid(_snapshot_pid, &status, WNOHANG);
+		if (done == 0)
+			return ; // Still writing
+		if (done == _snapshot_pid && WIFEXITED(status) && WEXITSTATUS(status) == 0)
+			LOG_DEBUG("Snapshot written to " << _snapshot_path);
+		else
 		{
-			// Handle poll errors, ignoring EINTR which means interrupted by signal
-			if (errno == EINTR)
-				continue; // Signal received, poll again
-			throw std::runtime_error(std::string("Poll failed: ") + std::strerror(errno));
+			LOG_ERROR("Snapshot to " << _snapshot_path << " failed: "
+				<< (done == _snapshot_pid && WIFEXITED(status) ? std::strerror(WEXITSTATUS(status)) : "child killed"));
+			_snapshot_generation = UINT64_MAX; // Try again at the next interval
 		}
-		if (num_events == 0)
-		{
-			// Timeout occurred (shouldn't happen with -1 timeout), poll again
+		_snapshot_pid = -1;
+	}
+	if (_snapshot_path.empty() || _now_ms < _next_snapshot_ms)
+		return ;
+	_next_snapshot_ms = _now_ms + _snapshot_interval_ms;
+	if (_channels.generation() == _snapshot_generation)
+		return ;
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		LOG_ERROR("Snapshot: fork failed: " << std::strerror(errno));
+		return ;
+	}
+	if (pid == 0)
+	{
+		close_inherited_fds();
+		_exit(Snapshot::write(_snapshot_path.c_str(), _snapshot_temp_path.c_str(), _channels) ? 0 : (errno & 0xff ? errno & 0xff : 1));
+	}
+	_snapshot_pid = pid;
+	_snapshot_generation = _channels.generation();
+}
+
+// On shutdown: the last changes are written by this process, after the
+// child still writing an older snapshot (if any) is done
+void Server::write_final_snapshot()
+{
+	if (_snapshot_path.empty())
+		return ;
+	if (_snapshot_pid > 0)
+		waitpid(_snapshot_pid, NULL, 0);
+	_snapshot_pid = -1;
+	if (Snapshot::write(_snapshot_path.c_str(), _snapshot_temp_path.c_str(), _channels))
+		LOG_INFO("Snapshot written to " << _snapshot_path);
+	else
+		LOG_ERROR("Snapshot to " << _snapshot_path << " failed: " << std::strerror(errno));
+}
+
+// How long the event loop may block: until the next timer, the next
+// throttled client that can resume or the end of an accept pause, whichever
+// comes first. Not at all when the accept queue was left non-empty
+int Server::next_wait_ms()
+{
+	if (_accept_pending || !_input_pending.empty())
+		return 0;
+	uint64_t now_ms = TimerWheel::monotonic_ms();
+	int wait_ms = _timers.next_timeout_ms(now_ms);
+	if (_accept_retry_ms != 0)
+	{
+		int until_accept = _accept_retry_ms > now_ms ? static_cast<int>(_accept_retry_ms - now_ms) : 0;
+		if (wait_ms < 0 || until_accept < wait_ms)
+			wait_ms = until_accept;
+	}
+	if (!_snapshot_path.empty())
+	{
+		int until_snapshot = _next_snapshot_ms > now_ms ? static_cast<int>(_next_snapshot_ms - now_ms) : 0;
+		if (wait_ms < 0 || until_snapshot < wait_ms)
+			wait_ms = until_snapshot;
+	}
+	for (const ClientHandle& handle : _throttled)
+	{
+		Client* client = _clients.find(handle);
+		if (!client)
 			continue;
-		}
+		uint64_t resume_at = client->get_flood().resume_at();
+		int until_resume = resume_at > now_ms ? static_cast<int>(resume_at - now_ms) : 0;
+		if (wait_ms < 0 || until_resume < wait_ms)
+			wait_ms = until_resume;
+	}
+	return wait_ms;
+}
 
-		// --- Handle events ---
-		// For Block 1, we only care about the listening socket
-		// In Block 2, you will iterate through all entries in _pollfds
-		// to check client sockets as well.
+// Parses one line, charges it to the client's flood buckets and runs its
+// handler from the command table.
+Server::DispatchResult Server::dispatch_command(int client_fd, std::string_view line)
+{
+	IrcMessage msg;
+	if (!parse_irc_message(line, msg))
+		return DISPATCH_DONE;
+	Client& client = _clients.at(client_fd);
+	unsigned int state = client.is_authenticated() ? STATE_REGISTERED : STATE_UNREGISTERED;
+	CommandId id = lookup_command(msg.command);
+	const CommandSpec& spec = COMMAND_TABLE[id];
+	if (client.is_link())
+		return dispatch_link_command(client_fd, line, msg, id) ? DISPATCH_DONE : DISPATCH_DISCONNECTED;
+	// Before anything else is done or counted: a deferred line is parsed
+	// again when it comes back out of the buffer. "\r\n" counts too
+	FloodControl& flood = client.get_flood();
+	if (uint64_t wait_ms = flood.charge(_flood_limits[spec.flood_class], spec.flood_class, line.size() + 2, _now_ms))
+	{
+		flood.throttle(_now_ms, _now_ms + wait_ms);
+		return DISPATCH_DEFERRED;
+	}
+	Metrics& metrics = Metrics::instance();
+	++metrics.lines_parsed;
+	++metrics.commands[id];
+	client.note_activity(_now_ms, id != CMD_PING && id != CMD_PONG);
+	if (!(spec.allowed_states & state))
+	{
+		LOG_DEBUG("Client FD " << client_fd << " sent an invalid command: " << msg.command);
+		if (state == STATE_UNREGISTERED)
+			client.send(std::string(RED) + "ERROR: Invalid command. Use PASS, NICK, or USER.\r\n" + RESET);
+		else
+			client.send(std::string(RED) + "ERROR: Invalid command. Use JOIN, PART, PRIVMSG, NOTICE, QUIT, NICK, USER, PING, PONG, OPER, STATS, CHATHISTORY, LINKS, CONNECT or SQUIT.\r\n" + RESET);
+		return DISPATCH_DONE;
+	}
+	if (msg.param_count < spec.min_params)
+	{
+		client.send(std::string(RED) + "ERROR: Not enough parameters for " + spec.name + "\r\n" + RESET);
+		return DISPATCH_DONE;
+	}
+	if (!(this->*_command_handlers[id])(client_fd, msg))
+		return DISPATCH_DISCONNECTED;
+	if (state == STATE_UNREGISTERED)
+		try_complete_registration(client_fd);
+	return DISPATCH_DONE;
+}
 
-		// Check the listening socket (it's always the first one we added)
-		// Make sure _pollfds is not empty before accessing _pollfds[0]
-		if (!_pollfds.empty() && _pollfds[0].fd == _listening_socket.get_fd())
-		{
-			if (_pollfds[0].revents & POLLIN)
-			{
-				// A new connection is ready to be accepted
-				// std::cout << "Event on listening socket (FD " << _listening_socket.get_fd() << "): New connection pending." << std::endl;
-				// In Block 2, you will call handle_new_connection() here
-				handle_new_connection();
-				num_events--; // Decrement counter as we've handled one event
-
-				// ADDED (tobias): Print all connected clients fds (for debugging)
-				// std::cout << "\nCurrently connected clients:" << std::endl;
-				// for (const auto& pair : _clients) {
-				//     const Client& client = pair.second;
-                //     int fd = client.get_fd();
-				//     std::cout << "Client FD: " << fd << std::endl;
-				// }
-				// std::cout << "\nCurrrent _pollfds:" << std::endl;
-				// for (const auto& p : _pollfds) {
-				//     std::cout << "poll FD: " << p.fd << std::endl;
-				// }
-                // std::cout << "test: " << _clients.at(4).get_fd() << std::endl;
-			}
-		}
-		// Entering the loop to check for events on client sockets like sending data, disconnections, errors...
-		for (size_t i = 1; i < _pollfds.size(); ++i)
+// Handlers of the command table, indexed by CommandId
+const Server::CommandHandler Server::_command_handlers[CMD_COUNT] = {
+	NULL, // CMD_UNKNOWN is never dispatched (allowed in no state)
+	&Server::handle_pass,
+	&Server::handle_nick,
+	&Server::handle_user,
+	&Server::handle_join,
+	&Server::handle_part,
+	&Server::handle_privmsg,
+	&Server::handle_quit,
+	&Server::handle_notice,
+	&Server::handle_oper,
+	&Server::handle_stats,
+	&Server::handle_ping,
+	&Server::handle_pong,
+	&Server::handle_chathistory,
+	&Server::handle_server,
+	&Server::handle_squit,
+	&Server::handle_connect,
+	&Server::handle_links,
+	NULL, // CMD_KILL, CMD_NJOIN and CMD_ERROR only come from servers
+	NULL,
+	NULL,
+};
+
+bool Server::handle_pass(int client_fd, const IrcMessage& msg)
+{
+	if (parse_pass(msg.params[0], client_fd) == -1)
+	{
+		handle_disconnection(client_fd);
+		return false;
+	}
+	return true;
+}
+
+bool Server::handle_nick(int client_fd, const IrcMessage& msg)
+{
+	parse_nick(msg.params[0], client_fd);
+	return true;
+}
+
+bool Server::handle_user(int client_fd, const IrcMessage& msg)
+{
+	parse_user(msg, client_fd);
+	return true;
+}
+
+// JOIN <channel>{,<channel>}
+bool Server::handle_join(int client_fd, const IrcMessage& msg)
+{
+	Client& client = _clients.at(client_fd);
+	std::string_view channels = msg.params[0];
+	while (!channels.empty())
+	{
+		size_t comma = channels.find(',');
+		std::string_view channel_name = channels.substr(0, comma);
+		channels = (comma == std::string_view::npos) ? std::string_view() : channels.substr(comma + 1);
+		if (!ChannelRegistry::is_valid_name(channel_name))
+		{
+			LOG_DEBUG("Client FD " << client_fd << " sent an invalid JOIN command: " << channel_name);
+			client.send(std::string(RED) + "ERROR: Invalid channel name. Use #channel_name.\r\n" + RESET);
+			continue;
+		}
+		// One hash lookup, the channel is created if it does not exist yet
+		bool created;
+		Channel* channel = _channels.find_or_create(channel_name, _clients, created);
+		if (created)
+			LOG_DEBUG("Channel " << channel->get_name() << " was created!");
+		// Add the client to the channel (and the channel to the client's reverse index)
+		if (!channel->add_client(client_fd))
+			continue;
+		client.add_channel(channel->get_name_ref());
+		// Every member, the joiner included, gets the same JOIN line, and so
+		// does every linked server: they all keep the memberships
+		SharedBuffer join_message = make_shared_buffer(":" + client.get_prefix() + " JOIN " + channel->get_name() + "\r\n");
+		channel->broadcast_message(join_message, -1);
+		send_to_links(join_message, -1);
+		// What was said recently, as the members got it
+		if (_history_join_replay > 0)
+			replay_history(client_fd, *channel, HISTORY_LATEST, 0, _history_join_replay);
+	}
+	return true;
+}
+
+// PART <channel>{,<channel>} [:<reason>]
+bool Server::handle_part(int client_fd, const IrcMessage& msg)
+{
+	Client& client = _clients.at(client_fd);
+	std::string_view channels = msg.params[0];
+	std::string reason = (msg.param_count > 1) ? std::string(msg.params[1]) : client.get_nickname();
+	while (!channels.empty())
+	{
+		size_t comma = channels.find(',');
+		std::string_view target = channels.substr(0, comma);
+		channels = (comma == std::string_view::npos) ? std::string_view() : channels.substr(comma + 1);
+		if (target.empty())
+			continue;
+		Channel* channel = _channels.find(target);
+		if (!channel)
+		{
+			send_numeric(client_fd, "403", std::string(target) + " :No such channel");
+			continue;
+		}
+		if (!channel->has_client(client_fd))
+		{
+			send_numeric(client_fd, "442", std::string(target) + " :You're not on that channel");
+			continue;
+		}
+		// Everybody in the channel sees the PART, the leaving client included
+		SharedBuffer part_message = make_shared_buffer(":" + client.get_prefix() + " PART " + channel->get_name() + " :" + reason + "\r\n");
+		channel->broadcast_message(part_message, -1);
+		send_to_links(part_message, -1);
+		channel->remove_client(client_fd);
+		client.remove_channel(channel->get_name_ref());
+		// The last one out destroys the channel
+		_channels.release_if_empty(channel);
+	}
+	return true;
+}
+
+// Numeric reply, e.g. ":ircserv.local 401 bob alice :No such nick/channel"
+void Server::send_numeric(int client_fd, const char* code, const std::string& text)
+{
+	Client& client = _clients.at(client_fd);
+	const std::string& nickname = client.get_nickname();
+	client.send(":" + _server_name + " " + code + " " + (nickname.empty() ? "*" : nickname) + " " + text + "\r\n");
+}
+
+bool Server::handle_privmsg(int client_fd, const IrcMessage& msg)
+{
+	deliver_message(client_fd, msg, "PRIVMSG", false);
+	return true;
+}
+
+// NOTICE works like PRIVMSG but never triggers an error reply (RFC 2812, 3.3.2)
+bool Server::handle_notice(int client_fd, const IrcMessage& msg)
+{
+	deliver_message(client_fd, msg, "NOTICE", true);
+	return true;
+}
+
+// PRIVMSG / NOTICE <target>{,<target>} :<text>
+// Each target is resolved with one hash lookup (nickname index or channel registry),
+// the outgoing line is built once per target and queued by pointer on every
+// recipient's send queue. The sender never gets its own channel message back.
+// The same line goes to the linked servers: once per link leading to remote
+// members of the channel, or to the link leading to a remote recipient
+void Server::deliver_message(int client_fd, const IrcMessage& msg, const char* command, bool is_notice)
+{
+	if (msg.param_count == 0 || msg.params[0].empty())
+	{
+		if (!is_notice)
+			send_numeric(client_fd, "411", std::string(":No recipient given (") + command + ")");
+		return ;
+	}
+	if (msg.param_count < 2 || msg.params[1].empty())
+	{
+		if (!is_notice)
+			send_numeric(client_fd, "412", ":No text to send");
+		return ;
+	}
+	const std::string& prefix = _clients.at(client_fd).get_prefix();
+	std::string_view targets = msg.params[0];
+	std::string_view text = msg.params[1];
+	while (!targets.empty())
+	{
+		size_t comma = targets.find(',');
+		std::string_view target = targets.substr(0, comma);
+		targets = (comma == std::string_view::npos) ? std::string_view() : targets.substr(comma + 1);
+		if (target.empty())
+			continue;
+
+		std::string line;
+		line.reserve(prefix.size() + target.size() + text.size() + 16);
+		line.append(":").append(prefix).append(" ").append(command).append(" ");
+		line.append(target).append(" :").append(text).append("\r\n");
+
+		if (target[0] == '#')
+		{
+			Channel* channel = _channels.find(target);
+			if (!channel)
+			{
+				if (!is_notice)
+					send_numeric(client_fd, "401", std::string(target) + " :No such nick/channel");
+				continue;
+			}
+			if (!channel->has_client(client_fd))
+			{
+				if (!is_notice)
+					send_numeric(client_fd, "404", std::string(target) + " :Cannot send to channel");
+				continue;
+			}
+			SharedBuffer message = make_shared_buffer(std::move(line));
+			channel->broadcast_message(message, client_fd);
+			send_to_channel_links(*channel, message, -1);
+			_channels.record_history(*channel, message, history_clock_ms());
+		}
+		else
+		{
+			int target_fd = _nicknames.find(target);
+			if (RemoteUser* remote = _network.find_user(target_fd))
+			{
+				_clients.at(remote->link_fd).send(make_shared_buffer(std::move(line)));
+				continue;
+			}
+			Client* recipient = _clients.find(target_fd);
+			if (!recipient || !recipient->is_authenticated())
+			{
+				if (!is_notice)
+					send_numeric(client_fd, "401", std::string(target) + " :No such nick/channel");
+				continue;
+			}
+			recipient->send(make_shared_buffer(std::move(line)));
+		}
+	}
+}
+
+// Queues the selected history of channel for the client: the stored buffers
+// themselves, no line is formatted again
+void Server::replay_history(int client_fd, const Channel& channel, HistorySelector selector, uint64_t time_ms, size_t limit)
+{
+	std::vector<SharedBuffer> lines;
+	channel.get_history().select(selector, time_ms, limit, lines);
+	Client& client = _clients.at(client_fd);
+	for (const SharedBuffer& line : lines)
+		client.send(line);
+	Metrics::instance().history_replayed += lines.size();
+}
+
+// "timestamp=YYYY-MM-DDThh:mm:ss[.sss]Z" -> milliseconds since the epoch, 0 when invalid
+static uint64_t parse_history_timestamp(std::string_view selector)
+{
+	static const std::string_view prefix = "timestamp=";
+	if (selector.substr(0, prefix.size()) != prefix)
+		return 0;
+	std::string value(selector.substr(prefix.size()));
+	tm time = {};
+	int milliseconds = 0;
+	int consumed = 0;
+	if (std::sscanf(value.c_str(), "%4d-%2d-%2dT%2d:%2d:%2d%n", &time.tm_year, &time.tm_mon, &time.tm_mday,
+			&time.tm_hour, &time.tm_min, &time.tm_sec, &consumed) != 6)
+		return 0;
+	const char* rest = value.c_str() + consumed;
+	if (*rest == '.')
+	{
+		int digits = 0;
+		for (++rest; *rest >= '0' && *rest <= '9'; ++rest, ++digits)
+		{
+			if (digits < 3)
+				milliseconds = milliseconds * 10 + (*rest - '0');
+		}
+		for (; digits < 3; ++digits)
+			milliseconds *= 10;
+	}
+	if (std::strcmp(rest, "Z") != 0)
+		return 0;
+	time.tm_year -= 1900;
+	time.tm_mon -= 1;
+	time_t seconds = timegm(&time);
+	if (seconds <= 0)
+		return 0;
+	return static_cast<uint64_t>(seconds) * 1000 + static_cast<uint64_t>(milliseconds);
+}
+
+// CHATHISTORY LATEST <#channel> <* | timestamp=...> <limit>
+// CHATHISTORY BEFORE|AFTER <#channel> <timestamp=...> <limit>
+// IRCv3 draft/chathistory for the channels the client is on. This server
+// negotiates no capabilities, so the lines come without message tags; a
+// BATCH pair marks where the reply starts and ends
+bool Server::handle_chathistory(int client_fd, const IrcMessage& msg)
+{
+	Client& client = _clients.at(client_fd);
+	std::string subcommand(msg.params[0]);
+	for (char& c : subcommand)
+		c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+	HistorySelector selector;
+	if (subcommand == "LATEST")
+		selector = HISTORY_LATEST;
+	else if (subcommand == "BEFORE")
+		selector = HISTORY_BEFORE;
+	else if (subcommand == "AFTER")
+		selector = HISTORY_AFTER;
+	else
+	{
+		client.send(":" + _server_name + " FAIL CHATHISTORY INVALID_PARAMS " + subcommand + " :Unknown subcommand\r\n");
+		return true;
+	}
+	Channel* channel = _channels.find(msg.params[1]);
+	if (!channel || !channel->has_client(client_fd))
+	{
+		client.send(":" + _server_name + " FAIL CHATHISTORY INVALID_TARGET " + subcommand + " " + std::string(msg.params[1])
+			+ " :Messages could not be retrieved\r\n");
+		return true;
+	}
+	// "*" (no bound) is for LATEST only
+	uint64_t time_ms = 0;
+	bool valid_selector = (selector == HISTORY_LATEST && msg.params[2] == "*");
+	if (!valid_selector)
+	{
+		time_ms = parse_history_timestamp(msg.params[2]);
+		valid_selector = (time_ms != 0);
+	}
+	char* end = NULL;
+	std::string limit_param(msg.params[3]);
+	unsigned long limit = std::strtoul(limit_param.c_str(), &end, 10);
+	if (!valid_selector || *end != '\0' || limit == 0)
+	{
+		client.send(":" + _server_name + " FAIL CHATHISTORY INVALID_PARAMS " + subcommand + " :Invalid selector or limit\r\n");
+		return true;
+	}
+	if (limit > CHATHISTORY_MAX)
+		limit = CHATHISTORY_MAX;
+	std::string reference = std::to_string(++_history_batch_id);
+	client.send(":" + _server_name + " BATCH +" + reference + " chathistory " + channel->get_name() + "\r\n");
+	replay_history(client_fd, *channel, selector, time_ms, limit);
+	client.send(":" + _server_name + " BATCH -" + reference + "\r\n");
+	return true;
+}
+
+// QUIT [:<reason>]
+bool Server::handle_quit(int client_fd, const IrcMessage& msg)
+{
+	std::string reason = (msg.param_count > 0) ? "Quit: " + std::string(msg.params[0]) : "Client Quit";
+	handle_disconnection(client_fd, reason);
+	return false;
+}
+
+// OPER <name> <password>
+// There is a single operator password (IRCSERV_OPER_PASSWORD), the name is not checked
+bool Server::handle_oper(int client_fd, const IrcMessage& msg)
+{
+	Client& client = _clients.at(client_fd);
+	if (_oper_password.empty())
+	{
+		send_numeric(client_fd, "491", ":No O-lines for your host");
+		return true;
+	}
+	if (msg.params[1] != _oper_password)
+	{
+		LOG_WARN("Client FD " << client_fd << " failed OPER as " << msg.params[0]);
+		send_numeric(client_fd, "464", ":Password incorrect");
+		return true;
+	}
+	client.set_operator();
+	LOG_INFO("Client FD " << client_fd << " (" << client.get_nickname() << ") is now an operator");
+	send_numeric(client_fd, "381", ":You are now an IRC operator");
+	return true;
+}
+
+// STATS [<query>], operators only
+//   m: how many times each command was used (212 RPL_STATSCOMMANDS)
+//   u: uptime (242 RPL_STATSUPTIME)
+//   anything else: counters and latency percentiles (249 RPL_STATSDEBUG)
+bool Server::handle_stats(int client_fd, const IrcMessage& msg)
+{
+	Client& client = _clients.at(client_fd);
+	if (!client.is_operator())
+	{
+		send_numeric(client_fd, "481", ":Permission Denied- You're not an IRC operator");
+		return true;
+	}
+	const Metrics& metrics = Metrics::instance();
+	char query = (msg.param_count > 0 && !msg.params[0].empty()) ? msg.params[0][0] : '*';
+	if (query == 'm')
+	{
+		for (size_t id = 1; id < CMD_COUNT; ++id)
+		{
+			if (metrics.commands[id] > 0)
+				send_numeric(client_fd, "212", std::string(COMMAND_TABLE[id].name) + " " + std::to_string(metrics.commands[id]));
+		}
+	}
+	else if (query == 'u')
+	{
+		uint64_t uptime = metrics.uptime_seconds();
+		char text[64];
+		std::snprintf(text, sizeof(text), ":Server Up %llu days %llu:%02llu:%02llu",
+			static_cast<unsigned long long>(uptime / 86400), static_cast<unsigned long long>(uptime / 3600 % 24),
+			static_cast<unsigned long long>(uptime / 60 % 60), static_cast<unsigned long long>(uptime % 60));
+		send_numeric(client_fd, "242", text);
+	}
+	else
+	{
+		send_numeric(client_fd, "249", ":clients " + std::to_string(_clients.size()) + " channels " + std::to_string(_channels.size())
+			+ " accepts " + std::to_string(metrics.accepts) + " disconnects " + std::to_string(metrics.disconnects));
+		send_numeric(client_fd, "249", ":bytes_in " + std::to_string(metrics.bytes_received) + " bytes_out " + std::to_string(metrics.bytes_sent)
+			+ " send_calls " + std::to_string(metrics.send_calls) + " lines " + std::to_string(metrics.lines_parsed) + " sendq_high_water " + std::to_string(metrics.send_queue_high_water)
+			+ " deferred " + std::to_string(metrics.lines_deferred) + " excess_flood " + std::to_string(metrics.excess_flood_disconnects)
+			+ " too_long " + std::to_string(metrics.lines_too_long) + " input_yields " + std::to_string(metrics.input_yields));
+		const LatencyHistogram* histograms[] = {&metrics.command_latency, &metrics.loop_latency};
+		const char* names[] = {"command_latency", "loop_iteration"};
+		for (size_t i = 0; i < 2; ++i)
+		{
+			const LatencyHistogram& histogram = *histograms[i];
+			char text[160];
+			std::snprintf(text, sizeof(text), ":%s_us count %llu p50 %.1f p90 %.1f p99 %.1f p999 %.1f max %.1f", names[i],
+				static_cast<unsigned long long>(histogram.count()), histogram.percentile(0.5) / 1e3, histogram.percentile(0.9) / 1e3,
+				histogram.percentile(0.99) / 1e3, histogram.percentile(0.999) / 1e3, histogram.max() / 1e3);
+			send_numeric(client_fd, "249", text);
+		}
+		send_numeric(client_fd, "249", ":loop_iterations " + std::to_string(metrics.loop_iterations));
+	}
+	send_numeric(client_fd, "219", std::string(1, query) + " :End of STATS report");
+	return true;
+}
+
+// PING <token>: answered right away, registered or not
+bool Server::handle_ping(int client_fd, const IrcMessage& msg)
+{
+	_clients.at(client_fd).send(":" + _server_name + " PONG " + _server_name + " :" + std::string(msg.params[0]) + "\r\n");
+	return true;
+}
+
+// PONG: the answer to our keepalive PING. Receiving the line is all that
+// matters (dispatch_command already recorded it), see handle_client_timer
+bool Server::handle_pong(int client_fd, const IrcMessage& msg)
+{
+	(void)client_fd;
+	(void)msg;
+	return true;
+}
+
+// SERVER <name> <hopcount> :<info>
+// From a connection that is not registered yet: another server linking to us
+// (after PASS with the link password). See accept_link()
+bool Server::handle_server(int client_fd, const IrcMessage& msg)
+{
+	Client& client = _clients.at(client_fd);
+	if (client.get_passed_nick() || client.get_passed_user())
+	{
+		close_link(client_fd, "Not a server");
+		return false;
+	}
+	client.set_link_role(LINK_INCOMING);
+	return accept_link(client_fd, msg);
+}
+
+// SQUIT <server> [:<reason>], operators only: closes one of our links
+bool Server::handle_squit(int client_fd, const IrcMessage& msg)
+{
+	Client& client = _clients.at(client_fd);
+	if (!client.is_operator())
+	{
+		send_numeric(client_fd, "481", ":Permission Denied- You're not an IRC operator");
+		return true;
+	}
+	const RemoteServer* server = _network.find_server(msg.params[0]);
+	if (!server || server->hopcount != 1)
+	{
+		send_numeric(client_fd, "402", std::string(msg.params[0]) + " :No such server");
+		return true;
+	}
+	std::string reason = (msg.param_count > 1) ? std::string(msg.params[1]) : "SQUIT by " + client.get_nickname();
+	LOG_INFO(client.get_nickname() << " closes the link to " << server->name << " (" << reason << ")");
+	close_link(server->link_fd, reason);
+	return true;
+}
+
+// CONNECT <address> <port>, operators only: links us to the server listening
+// there. The address is an IPv4 literal, so nothing blocks on a DNS lookup.
+// The connect() is non-blocking: PASS and SERVER wait in the send queue until
+// the socket is writable, a refused connection fails the first write
+bool Server::handle_connect(int client_fd, const IrcMessage& msg)
+{
+	Client& client = _clients.at(client_fd);
+	if (!client.is_operator())
+	{
+		send_numeric(client_fd, "481", ":Permission Denied- You're not an IRC operator");
+		return true;
+	}
+	if (_link_password.empty())
+	{
+		send_numeric(client_fd, "NOTICE", ":*** Links are disabled (no IRCSERV_LINK_PASSWORD)");
+		return true;
+	}
+	std::string address(msg.params[0]);
+	std::string port_param(msg.params[1]);
+	char* end = NULL;
+	unsigned long port = std::strtoul(port_param.c_str(), &end, 10);
+	sockaddr_in peer;
+	std::memset(&peer, 0, sizeof(peer));
+	peer.sin_family = AF_INET;
+	peer.sin_port = htons(static_cast<uint16_t>(port));
+	if (port == 0 || port > MAX_PORT_NBR || *end != '\0' || inet_pton(AF_INET, address.c_str(), &peer.sin_addr) != 1)
+	{
+		send_numeric(client_fd, "NOTICE", ":*** CONNECT needs an IPv4 address and a port");
+		return true;
+	}
+	int link_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (link_fd < 0 || (connect(link_fd, reinterpret_cast<sockaddr*>(&peer), sizeof(peer)) < 0 && errno != EINPROGRESS))
+	{
+		send_numeric(client_fd, "NOTICE", ":*** Connect to " + address + " failed: " + std::strerror(errno));
+		if (link_fd >= 0)
+			close(link_fd);
+		return true;
+	}
+	Client& link = _clients.emplace(link_fd, link_fd, _event_loop.get(), _recv_chunk_size, &_flush_list);
+	link.set_link_role(LINK_OUTGOING);
+	_event_loop->add(link_fd, EVENT_READ);
+	link.send("PASS " + _link_password + "\r\nSERVER " + _server_name + " 1 :" SERVER_INFO "\r\n");
+	// The handshake has the registration timeout to complete
+	link.note_activity(_now_ms, true);
+	link.get_timer().owner = link_fd;
+	_timers.schedule(link.get_timer(), _now_ms, _registration_timeout_ms);
+	LOG_INFO(client.get_nickname() << " connects us to " << address << ":" << port << " (FD " << link_fd << ")");
+	send_numeric(client_fd, "NOTICE", ":*** Connecting to " + address + ":" + std::to_string(port));
+	return true;
+}
+
+// LINKS: every server of the network (364 RPL_LINKS), us included
+bool Server::handle_links(int client_fd, const IrcMessage& msg)
+{
+	(void)msg;
+	send_numeric(client_fd, "364", _server_name + " " + _server_name + " :0 " SERVER_INFO);
+	for (const RemoteServer& server : _network.get_servers())
+		send_numeric(client_fd, "364", server.name + " " + server.uplink + " :" + std::to_string(server.hopcount) + " " + server.info);
+	send_numeric(client_fd, "365", "* :End of LINKS list");
+	return true;
+}
+
+// Server-to-server protocol.
+// A simplified RFC 2813: servers are named, users are known by nickname
+// (no unique ids), and the servers form a spanning tree, so a message
+// reaches every server by being forwarded on every link but the one it came
+// from. Every server knows every user and channel membership; the messages
+// of users carry their full "nick!user@host" prefix, so a relayed line is
+// delivered to the local clients as is.
+//
+//   PASS <link password>                    \ handshake, sent by both sides
+//   SERVER <name> 1 :<info>                 /
+//   :<uplink> SERVER <name> <hops> :<info>  a server behind the link
+//   NICK <nick> <hops> <user> <host> <server> :<realname>  a user
+//   :<server> NJOIN <#channel> :<nick>,<nick>...            burst of members
+//   :<prefix> NICK|JOIN|PART|QUIT|PRIVMSG|NOTICE ...        as users send them
+//   :<server> SQUIT <server> :<reason>      a netsplit
+//   :<server> KILL <nick> :<reason>         a nickname collision
+//
+// Nickname collisions are settled RFC 1459 style: both sides refuse the other
+// one's user and KILL it, so both users are disconnected.
+const Server::CommandHandler Server::_link_handlers[CMD_COUNT] = {
+	NULL, // CMD_UNKNOWN
+	&Server::link_pass,
+	&Server::link_nick,
+	NULL, // CMD_USER
+	&Server::link_join,
+	&Server::link_part,
+	&Server::link_message, // CMD_PRIVMSG
+	&Server::link_quit,
+	&Server::link_message, // CMD_NOTICE
+	NULL, // CMD_OPER
+	NULL, // CMD_STATS
+	&Server::link_ping,
+	&Server::handle_pong, // Any line already counts as activity
+	NULL, // CMD_CHATHISTORY
+	&Server::link_server,
+	&Server::link_squit,
+	NULL, // CMD_CONNECT
+	NULL, // CMD_LINKS
+	&Server::link_kill,
+	&Server::link_njoin,
+	&Server::link_error,
+};
+
+// Links are not flood limited (a server relays the traffic of many users)
+// and never get an error reply: anything unexpected is dropped
+bool Server::dispatch_link_command(int link_fd, std::string_view line, const IrcMessage& msg, CommandId id)
+{
+	Client& link = _clients.at(link_fd);
+	Metrics& metrics = Metrics::instance();
+	++metrics.lines_parsed;
+	++metrics.commands[id];
+	link.note_activity(_now_ms, true);
+	// Before the handshake is over only PASS, SERVER and ERROR mean something
+	// (the other side's greeting to users is ignored, for one)
+	if (!link.is_authenticated() && id != CMD_PASS && id != CMD_SERVER && id != CMD_ERROR)
+		return true;
+	CommandHandler handler = _link_handlers[id];
+	if (!handler || msg.param_count < COMMAND_TABLE[id].min_params)
+	{
+		LOG_DEBUG("Ignoring from link FD " << link_fd << ": " << line);
+		return true;
+	}
+	_link_line = line;
+	return (this->*handler)(link_fd, msg);
+}
+
+// Both sides end the handshake here, when the other one's SERVER comes:
+// check it, answer with our own PASS / SERVER if we did not start the link,
+// then send everything we know (the burst)
+bool Server::accept_link(int link_fd, const IrcMessage& msg)
+{
+	Client& link = _clients.at(link_fd);
+	std::string name(msg.params[0]);
+	std::string info = (msg.param_count > 2) ? std::string(msg.params[2]) : std::string();
+	if (_link_password.empty() || !link.get_passed_pass() || link.get_password() != _link_password)
+	{
+		LOG_WARN("Link from FD " << link_fd << " refused: bad password");
+		close_link(link_fd, "Bad link password");
+		return false;
+	}
+	if (!Network::is_valid_server_name(name))
+	{
+		close_link(link_fd, "Bad server name");
+		return false;
+	}
+	if (name == _server_name || _network.find_server(name))
+	{
+		LOG_WARN("Link from FD " << link_fd << " refused: " << name << " is already on the network");
+		close_link(link_fd, "Server " + name + " already exists");
+		return false;
+	}
+	link.set_authenticated();
+	if (link.get_link_role() == LINK_INCOMING)
+		link.send("PASS " + _link_password + "\r\nSERVER " + _server_name + " 1 :" SERVER_INFO "\r\n");
+	_network.add_server(RemoteServer{name, _server_name, info, 1, link_fd});
+	_links.push_back(link_fd);
+	_timers.schedule(link.get_timer(), _now_ms, _ping_interval_ms);
+	LOG_INFO("Linked to " << name << " (FD " << link_fd << ")");
+	send_burst(link_fd);
+	send_to_links(make_shared_buffer(":" + _server_name + " SERVER " + name + " 2 :" + info + "\r\n"), link_fd);
+	return true;
+}
+
+std::string Server::user_introduction(const std::string& nickname, unsigned int hopcount, const std::string& username,
+	const std::string& hostname, const std::string& server, const std::string& realname)
+{
+	return "NICK " + nickname + " " + std::to_string(hopcount) + " " + username + " " + hostname + " " + server
+		+ " :" + realname + "\r\n";
+}
+
+// Everything the new link does not know yet: the servers, the users, then the
+// channel memberships as NJOIN lines (one per channel, instead of one JOIN per
+// member). Queued as one buffer
+void Server::send_burst(int link_fd)
+{
+	std::string burst;
+	for (const RemoteServer& server : _network.get_servers())
+	{
+		if (server.link_fd != link_fd)
+			burst += ":" + server.uplink + " SERVER " + server.name + " " + std::to_string(server.hopcount + 1) + " :" + server.info + "\r\n";
+	}
+	_clients.for_each([this, &burst](int, const Client& client) {
+		if (client.is_authenticated() && !client.is_link())
+			burst += user_introduction(client.get_nickname(), 1, client.get_username(), client.get_hostname(), _server_name, client.get_realname());
+	});
+	_network.for_each_user([link_fd, &burst](int, const RemoteUser& user) {
+		if (user.link_fd != link_fd)
+			burst += user_introduction(user.nickname, user.hopcount + 1, user.username, user.hostname, user.server, user.realname);
+	});
+	_channels.for_each([this, link_fd, &burst](const Channel& channel) {
+		std::string head = ":" + _server_name + " NJOIN " + channel.get_name() + " :";
+		std::string line = head;
+		for (int member : channel.get_clients())
+		{
+			const std::string* nickname = NULL;
+			if (RemoteUser* user = _network.find_user(member))
+				nickname = (user->link_fd != link_fd) ? &user->nickname : NULL;
+			else if (Client* client = _clients.find(member))
+				nickname = client->is_authenticated() ? &client->get_nickname() : NULL;
+			if (!nickname)
+				continue;
+			// Keep every line under the 512 bytes limit
+			if (line.size() + nickname->size() + 3 > MAX_LINE_LENGTH)
+			{
+				line.pop_back(); // The last ','
+				burst += line + "\r\n";
+				line = head;
+			}
+			line += *nickname + ",";
+		}
+		if (line.size() > head.size())
+		{
+			line.pop_back();
+			burst += line + "\r\n";
+		}
+	});
+	LOG_DEBUG("Burst of " << burst.size() << " bytes to link FD " << link_fd);
+	_clients.at(link_fd).send(burst);
+}
+
+// Our link link_fd is gone: so is every server and user behind it. The rest
+// of the network learns it with one SQUIT
+void Server::drop_link(int link_fd, const std::string& reason)
+{
+	_links.erase(std::remove(_links.begin(), _links.end(), link_fd), _links.end());
+	const RemoteServer* server = _network.find_link(link_fd);
+	if (!server)
+		return ;
+	std::string name = server->name;
+	LOG_INFO("Netsplit: lost the link to " << name << " (" << reason << ")");
+	split_servers(_network.remove_link(link_fd), _server_name + " " + name);
+	send_to_links(make_shared_buffer(":" + _server_name + " SQUIT " + name + " :" + reason + "\r\n"), link_fd);
+}
+
+// The users of the servers that split off quit, with the usual
+// "<server> <server>" netsplit reason
+void Server::split_servers(const std::vector<std::string>& servers, const std::string& reason)
+{
+	std::vector<int> split_users;
+	_network.for_each_user([&servers, &split_users](int id, const RemoteUser& user) {
+		for (const std::string& server : servers)
+		{
+			if (server == user.server)
+			{
+				split_users.push_back(id);
+				break ;
+			}
+		}
+	});
+	for (int id : split_users)
+	{
+		RemoteUser* user = _network.find_user(id);
+		remove_remote_user(id, make_shared_buffer(":" + user->prefix + " QUIT :" + reason + "\r\n"));
+	}
+	LOG_INFO("Netsplit: " << servers.size() << " servers and " << split_users.size() << " users left");
+}
+
+// Same as leave_all_channels() + the nickname release, for a remote user
+void Server::remove_remote_user(int id, const SharedBuffer& quit_message)
+{
+	RemoteUser* user = _network.find_user(id);
+	if (!user)
+		return ;
+	std::vector<int> recipients;
+	for (const ChannelName& channel_name : user->channels)
+	{
+		Channel* channel = _channels.find_by_key(channel_name->key);
+		if (!channel)
+			continue;
+		channel->remove_client(id);
+		const std::vector<int>& members = channel->get_clients();
+		recipients.insert(recipients.end(), members.begin(), members.end());
+		_channels.release_if_empty(channel);
+	}
+	std::sort(recipients.begin(), recipients.end());
+	recipients.erase(std::unique(recipients.begin(), recipients.end()), recipients.end());
+	for (int member_fd : recipients)
+	{
+		if (Client* member = _clients.find(member_fd))
+			member->send(quit_message);
+	}
+	_nicknames.erase(user->nickname);
+	_network.remove_user(id);
+}
+
+// The remote user a message from link_fd comes from: the nickname part of
+// its prefix, which must be a user reached through that very link.
+// -1 when it is not (unknown, or a message that took the wrong way)
+int Server::link_source(int link_fd, const IrcMessage& msg)
+{
+	std::string_view nickname = msg.prefix.substr(0, msg.prefix.find('!'));
+	int id = _nicknames.find(nickname);
+	RemoteUser* user = _network.find_user(id);
+	if (!user || user->link_fd != link_fd)
+	{
+		LOG_DEBUG("Ignoring " << msg.command << " from unknown source " << msg.prefix << " on link FD " << link_fd);
+		return -1;
+	}
+	return id;
+}
+
+// To every link but except_link (the one the message came from, -1 for none)
+void Server::send_to_links(const SharedBuffer& message, int except_link)
+{
+	for (int link_fd : _links)
+	{
+		if (link_fd != except_link)
+			_clients.at(link_fd).send(message);
+	}
+}
+
+// A channel message crosses each link leading to members of the channel
+// once, however many members are behind it. The remote members sort first
+// in the member list (negative ids), so only they are looked at
+void Server::send_to_channel_links(const Channel& channel, const SharedBuffer& message, int except_link)
+{
+	int targets[16];
+	size_t target_count = 0;
+	for (int member : channel.get_clients())
+	{
+		if (!Network::is_remote(member))
+			break ;
+		RemoteUser* user = _network.find_user(member);
+		if (!user || user->link_fd == except_link || std::find(targets, targets + target_count, user->link_fd) != targets + target_count)
+			continue;
+		if (target_count == sizeof(targets) / sizeof(targets[0]))
+		{
+			// A hub with that many links: fall back to all of them
+			send_to_links(message, except_link);
+			return ;
+		}
+		targets[target_count++] = user->link_fd;
+	}
+	for (size_t i = 0; i < target_count; ++i)
+		_clients.at(targets[i]).send(message);
+}
+
+// PASS <password>: the server we connected to answers our PASS with its own
+bool Server::link_pass(int link_fd, const IrcMessage& msg)
+{
+	Client& link = _clients.at(link_fd);
+	if (!link.is_authenticated())
+		link.set_passed_pass(std::string(msg.params[0]));
+	return true;
+}
+
+// SERVER <name> 1 :<info>: the answer to the SERVER we sent on CONNECT.
+// :<uplink> SERVER <name> <hopcount> :<info>: a server behind the link
+bool Server::link_server(int link_fd, const IrcMessage& msg)
+{
+	if (!_clients.at(link_fd).is_authenticated())
+		return accept_link(link_fd, msg);
+	std::string name(msg.params[0]);
+	const RemoteServer* uplink = _network.find_server(msg.prefix);
+	if (!uplink || uplink->link_fd != link_fd || !Network::is_valid_server_name(name))
+	{
+		LOG_DEBUG("Ignoring SERVER " << name << " from link FD " << link_fd);
+		return true;
+	}
+	if (name == _server_name || _network.find_server(name))
+	{
+		// Reachable two ways: a loop in the tree, break it
+		LOG_WARN("Server " << name << " introduced again by link FD " << link_fd << ", closing the link");
+		close_link(link_fd, "Server " + name + " already exists");
+		return false;
+	}
+	unsigned int hopcount = static_cast<unsigned int>(std::strtoul(std::string(msg.params[1]).c_str(), NULL, 10));
+	std::string info(msg.params[2]);
+	_network.add_server(RemoteServer{name, std::string(msg.prefix), info, hopcount, link_fd});
+	LOG_INFO("Server " << name << " joined the network behind " << msg.prefix);
+	send_to_links(make_shared_buffer(":" + std::string(msg.prefix) + " SERVER " + name + " " + std::to_string(hopcount + 1)
+		+ " :" + info + "\r\n"), link_fd);
+	return true;
+}
+
+// :<server> SQUIT <server> :<reason>: a netsplit further down the tree
+bool Server::link_squit(int link_fd, const IrcMessage& msg)
+{
+	const RemoteServer* server = _network.find_server(msg.params[0]);
+	if (!server || server->link_fd != link_fd)
+		return true;
+	if (server->hopcount == 1)
+	{
+		// The other end of this very link is leaving
+		close_link(link_fd, "SQUIT");
+		return false;
+	}
+	std::string reason = server->uplink + " " + server->name;
+	split_servers(_network.remove_servers(msg.params[0]), reason);
+	send_to_links(make_shared_buffer(std::string(_link_line) + "\r\n"), link_fd);
+	return true;
+}
+
+// NICK <nick> <hopcount> <user> <host> <server> :<realname>: a new user.
+// :<prefix> NICK <newnick>: a nickname change
+bool Server::link_nick(int link_fd, const IrcMessage& msg)
+{
+	Client& link = _clients.at(link_fd);
+	std::string nickname(msg.params[0]);
+	int owner = _nicknames.find(nickname);
+	if (msg.param_count >= 6)
+	{
+		const RemoteServer* server = _network.find_server(msg.params[4]);
+		if (!server || server->link_fd != link_fd)
+			return true;
+		if (owner != -1 || !is_valid_nickname(nickname))
+		{
+			// The other side refuses ours the same way: both users go
+			LOG_INFO("Nickname collision on " << nickname << " with link FD " << link_fd);
+			link.send(":" + _server_name + " KILL " + nickname + " :" + _server_name + " (Nick collision)\r\n");
+			return true;
+		}
+		RemoteUser user;
+		user.nickname = nickname;
+		user.hopcount = static_cast<unsigned int>(std::strtoul(std::string(msg.params[1]).c_str(), NULL, 10));
+		user.username = std::string(msg.params[2]);
+		user.hostname = std::string(msg.params[3]);
+		user.server = server->name;
+		user.realname = std::string(msg.params[5]);
+		user.link_fd = link_fd;
+		send_to_links(make_shared_buffer(user_introduction(user.nickname, user.hopcount + 1, user.username,
+			user.hostname, user.server, user.realname)), link_fd);
+		_nicknames.insert(nickname, _network.add_user(std::move(user)));
+		return true;
+	}
+	int id = link_source(link_fd, msg);
+	if (id == -1)
+		return true;
+	RemoteUser& user = *_network.find_user(id);
+	if ((owner != -1 && owner != id) || !is_valid_nickname(nickname))
+	{
+		// The other side knows the user as nickname now, the rest of the
+		// network still under the old one
+		link.send(":" + _server_name + " KILL " + nickname + " :" + _server_name + " (Nick collision)\r\n");
+		send_to_links(make_shared_buffer(":" + _server_name + " KILL " + user.nickname + " :" + _server_name + " (Nick collision)\r\n"), link_fd);
+		remove_remote_user(id, make_shared_buffer(":" + user.prefix + " QUIT :Killed (" + _server_name + " (Nick collision))\r\n"));
+		return true;
+	}
+	// The local clients sharing a channel with the user see the change
+	SharedBuffer nick_message = make_shared_buffer(":" + user.prefix + " NICK :" + nickname + "\r\n");
+	std::vector<int> recipients;
+	for (const ChannelName& channel_name : user.channels)
+	{
+		if (Channel* channel = _channels.find_by_key(channel_name->key))
+			recipients.insert(recipients.end(), channel->get_clients().begin(), channel->get_clients().end());
+	}
+	std::sort(recipients.begin(), recipients.end());
+	recipients.erase(std::unique(recipients.begin(), recipients.end()), recipients.end());
+	for (int member_fd : recipients)
+	{
+		if (Client* member = _clients.find(member_fd))
+			member->send(nick_message);
+	}
+	send_to_links(nick_message, link_fd);
+	_nicknames.erase(user.nickname);
+	_nicknames.insert(nickname, id);
+	user.nickname = nickname;
+	user.update_prefix();
+	return true;
+}
+
+// :<prefix> JOIN <#channel>
+bool Server::link_join(int link_fd, const IrcMessage& msg)
+{
+	int id = link_source(link_fd, msg);
+	if (id == -1 || !ChannelRegistry::is_valid_name(msg.params[0]))
+		return true;
+	bool created;
+	Channel* channel = _channels.find_or_create(msg.params[0], _clients, created);
+	if (!channel->add_client(id))
+		return true;
+	_network.find_user(id)->channels.push_back(channel->get_name_ref());
+	// The line is already what the local members expect
+	SharedBuffer join_message = make_shared_buffer(std::string(_link_line) + "\r\n");
+	channel->broadcast_message(join_message, -1);
+	send_to_links(join_message, link_fd);
+	return true;
+}
+
+// :<server> NJOIN <#channel> :<nick>,<nick>...: members sent in a burst.
+// Forwarded with the members that were accepted only
+bool Server::link_njoin(int link_fd, const IrcMessage& msg)
+{
+	if (!ChannelRegistry::is_valid_name(msg.params[0]))
+		return true;
+	bool created;
+	Channel* channel = _channels.find_or_create(msg.params[0], _clients, created);
+	std::string accepted;
+	std::string_view nicknames = msg.params[1];
+	while (!nicknames.empty())
+	{
+		size_t comma = nicknames.find(',');
+		std::string_view nickname = nicknames.substr(0, comma);
+		nicknames = (comma == std::string_view::npos) ? std::string_view() : nicknames.substr(comma + 1);
+		int id = _nicknames.find(nickname);
+		RemoteUser* user = _network.find_user(id);
+		if (!user || user->link_fd != link_fd || !channel->add_client(id))
+			continue;
+		user->channels.push_back(channel->get_name_ref());
+		channel->broadcast_message(":" + user->prefix + " JOIN " + channel->get_name() + "\r\n", -1);
+		accepted += (accepted.empty() ? "" : ",") + user->nickname;
+	}
+	if (accepted.empty())
+	{
+		_channels.release_if_empty(channel);
+		return true;
+	}
+	send_to_links(make_shared_buffer(":" + std::string(msg.prefix) + " NJOIN " + channel->get_name() + " :" + accepted + "\r\n"), link_fd);
+	return true;
+}
+
+// :<prefix> PART <#channel> :<reason>
+bool Server::link_part(int link_fd, const IrcMessage& msg)
+{
+	int id = link_source(link_fd, msg);
+	if (id == -1)
+		return true;
+	Channel* channel = _channels.find(msg.params[0]);
+	if (!channel || !channel->remove_client(id))
+		return true;
+	_network.find_user(id)->remove_channel(channel->get_name_ref());
+	SharedBuffer part_message = make_shared_buffer(std::string(_link_line) + "\r\n");
+	channel->broadcast_message(part_message, -1);
+	send_to_links(part_message, link_fd);
+	_channels.release_if_empty(channel);
+	return true;
+}
+
+// :<prefix> PRIVMSG|NOTICE <target> :<text>
+// The line is relayed as is: to the local members of a channel and on to
+// the other links leading to members, or toward a single recipient
+bool Server::link_message(int link_fd, const IrcMessage& msg)
+{
+	int id = link_source(link_fd, msg);
+	if (id == -1 || msg.param_count < 2 || msg.params[0].find(',') != std::string_view::npos)
+		return true;
+	std::string_view target = msg.params[0];
+	SharedBuffer message = make_shared_buffer(std::string(_link_line) + "\r\n");
+	if (target[0] == '#')
+	{
+		Channel* channel = _channels.find(target);
+		if (!channel || !channel->has_client(id))
+			return true;
+		channel->broadcast_message(message, id);
+		send_to_channel_links(*channel, message, link_fd);
+		_channels.record_history(*channel, message, history_clock_ms());
+		return true;
+	}
+	int target_id = _nicknames.find(target);
+	if (RemoteUser* remote = _network.find_user(target_id))
+	{
+		if (remote->link_fd != link_fd)
+			_clients.at(remote->link_fd).send(message);
+	}
+	else if (Client* recipient = _clients.find(target_id))
+	{
+		if (recipient->is_authenticated())
+			recipient->send(message);
+	}
+	return true;
+}
+
+// :<prefix> QUIT :<reason>
+bool Server::link_quit(int link_fd, const IrcMessage& msg)
+{
+	int id = link_source(link_fd, msg);
+	if (id == -1)
+		return true;
+	SharedBuffer quit_message = make_shared_buffer(std::string(_link_line) + "\r\n");
+	send_to_links(quit_message, link_fd);
+	remove_remote_user(id, quit_message);
+	return true;
+}
+
+// :<source> KILL <nick> :<reason>: forwarded everywhere, so every server
+// forgets the user and its own server disconnects it
+bool Server::link_kill(int link_fd, const IrcMessage& msg)
+{
+	int id = _nicknames.find(msg.params[0]);
+	std::string reason = "Killed (" + std::string(msg.params[1]) + ")";
+	if (RemoteUser* user = _network.find_user(id))
+	{
+		send_to_links(make_shared_buffer(std::string(_link_line) + "\r\n"), link_fd);
+		remove_remote_user(id, make_shared_buffer(":" + user->prefix + " QUIT :" + reason + "\r\n"));
+	}
+	else if (Client* client = _clients.find(id))
+	{
+		if (client->is_authenticated() && !client->is_link())
+		{
+			LOG_INFO("Client FD " << id << " (" << client->get_nickname() << ") " << reason);
+			close_link(id, reason);
+		}
+	}
+	return true;
+}
+
+// PING <token>: from the other server's keepalive
+bool Server::link_ping(int link_fd, const IrcMessage& msg)
+{
+	_clients.at(link_fd).send(":" + _server_name + " PONG " + _server_name + " :" + std::string(msg.params[0]) + "\r\n");
+	return true;
+}
+
+// ERROR :<reason>: the other side is closing the link (or refused it)
+bool Server::link_error(int link_fd, const IrcMessage& msg)
+{
+	LOG_WARN("Link FD " << link_fd << " sent ERROR: " << (msg.param_count > 0 ? msg.params[0] : std::string_view()));
+	return true;
+}
+
+// Tells the client why it is dropped, then disconnects it
+void Server::close_link(int client_fd, const std::string& reason)
+{
+	Client& client = _clients.at(client_fd);
+	client.send("ERROR :Closing Link: " + client.get_hostname() + " (" + reason + ")\r\n");
+	handle_disconnection(client_fd, reason);
+}
+
+// Fires the timers that are due on the cached clock of this iteration
+void Server::run_timers()
+{
+	_expired_timers.clear();
+	_timers.advance(_now_ms, _expired_timers);
+	for (int client_fd : _expired_timers)
+		handle_client_timer(client_fd);
+}
+
+// Each client has a single timer, what it means depends on the client's state:
+//   not registered yet: the registration deadline
+//   PING sent: the PONG deadline
+//   otherwise: the keepalive / idle check.
+// Lines only update timestamps; the timer is re-armed here when it fires,
+// not on every line
+void Server::handle_client_timer(int client_fd)
+{
+	Client* client = _clients.find(client_fd);
+	if (!client)
+		return ;
+	if (!client->is_authenticated())
+	{
+		close_link(client_fd, "Registration timeout");
+		return ;
+	}
+	// Links are kept alive by PING like clients, but never reaped for idling
+	uint64_t idle_timeout_ms = client->is_link() ? 0 : _idle_timeout_ms;
+	if (idle_timeout_ms != 0 && _now_ms - client->get_last_command() >= idle_timeout_ms)
+	{
+		close_link(client_fd, "Idle timeout");
+		return ;
+	}
+	if (client->get_ping_sent() != 0)
+	{
+		if (client->get_last_activity() < client->get_ping_sent())
 		{
-			if (_pollfds[i].revents & POLLHUP)
+			close_link(client_fd, "Ping timeout: " + std::to_string((_now_ms - client->get_ping_sent()) / 1000) + " seconds");
+			return ;
+		}
+		client->set_ping_sent(0);
+	}
+	uint64_t silence = _now_ms - client->get_last_activity();
+	if (silence >= _ping_interval_ms)
+	{
+		client->send("PING :" + _server_name + "\r\n");
+		client->set_ping_sent(_now_ms);
+		_timers.schedule(client->get_timer(), _now_ms, _ping_timeout_ms);
+		return ;
+	}
+	// Heard from recently: look again once the interval since the last line is over
+	uint64_t next_check = _ping_interval_ms - silence;
+	if (idle_timeout_ms != 0 && idle_timeout_ms - (_now_ms - client->get_last_command()) < next_check)
+		next_check = idle_timeout_ms - (_now_ms - client->get_last_command());
+	_timers.schedule(client->get_timer(), _now_ms, next_check);
+}
+
+// Hands the listening socket and every client over to a new ircserv process,
+// which carries on serving them: clients see no disconnection, and what was
+// received but not handled, or queued but not sent, travels with them.
+// Returns true once the new process took over (this one must exit), false
+// when the upgrade failed and this process goes on serving
+bool Server::hot_upgrade()
+{
+	LOG_INFO("Hot upgrade requested");
+	if (!settle_sends())
+	{
+		LOG_ERROR("Hot upgrade aborted: writes still in flight");
+		return false;
+	}
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0)
+	{
+		LOG_ERROR("Hot upgrade aborted: socketpair failed: " << std::strerror(errno));
+		return false;
+	}
+	pid_t pid = spawn_successor(fds[1]);
+	close(fds[1]);
+	bool taken_over = false;
+	if (pid > 0)
+	{
+		try
+		{
+			snapshot().send(fds[0]);
+			taken_over = UpgradeState::wait_for_acknowledgement(fds[0], UPGRADE_ACK_TIMEOUT_MS);
+		}
+		catch (const std::exception& e)
+		{
+			LOG_ERROR("Hot upgrade: " << e.what());
+		}
+	}
+	close(fds[0]);
+	if (!taken_over)
+	{
+		LOG_ERROR("Hot upgrade failed, going on with this process");
+		if (pid > 0)
+		{
+			kill(pid, SIGKILL);
+			waitpid(pid, NULL, 0);
+		}
+		// Readiness events may have been dropped while settling the sends:
+		// read every client and accept once so edge-triggered backends do not stall
+		_accept_pending = true;
+		std::vector<int> client_fds;
+		_clients.for_each([&client_fds](int fd, Client&) { client_fds.push_back(fd); });
+		for (int client_fd : client_fds)
+		{
+			if (_clients.find(client_fd))
+				process_client_data(client_fd);
+		}
+		return false;
+	}
+	// The sockets are the new process' now: our copies are simply closed when
+	// we exit, nothing is sent to the clients
+	if (_metrics_listener)
+		_metrics_listener->hand_over();
+	LOG_INFO("Hot upgrade done, process " << pid << " took over " << _clients.size() << " clients");
+	return true;
+}
+
+// With a batching backend, writes may be queued or in flight: the queue they
+// point into is handed over too, so they would go out twice. Let them complete.
+// Only the send completions are used, the readiness events of these waits are dropped
+bool Server::settle_sends()
+{
+	if (!_event_loop->batches_sends())
+		return true;
+	for (int round = 0; round < 100; ++round)
+	{
+		bool in_flight = false;
+		_clients.for_each([&in_flight](int, Client& client) { in_flight = in_flight || client.has_send_in_flight(); });
+		if (!in_flight)
+			return true;
+		if (_event_loop->wait(_ready_events, 10) < 0)
+			continue;
+		for (const IoEvent& event : _ready_events)
+		{
+			if (!(event.events & EVENT_SENT))
+				continue;
+			if (Client* client = _clients.find(event.fd))
+				client->complete_send(event.result);
+		}
+	}
+	return false;
+}
+
+// Clients (the broken ones aside), nicknames and channel memberships. The
+// channels are rebuilt from the members' own channel lists
+UpgradeState Server::snapshot() const
+{
+	UpgradeState state;
+	state.listening_fd = _listening_socket.get_fd();
+	state.metrics_fd = _metrics_listener ? _metrics_listener->get_fd() : -1;
+	std::unordered_map<const ChannelNameData*, uint32_t> channel_index;
+	_clients.for_each([&state, &channel_index](int fd, const Client& client) {
+		// Links are not handed over: they close with this process, and the
+		// other servers see a netsplit
+		if (client.has_send_failed() || client.is_link())
+			return ;
+		uint32_t index = static_cast<uint32_t>(state.clients.size());
+		UpgradeClient entry;
+		entry.fd = fd;
+		entry.nickname = client.get_nickname();
+		entry.username = client.get_username();
+		entry.realname = client.get_realname();
+		entry.passed_pass = client.get_passed_pass();
+		entry.passed_nick = client.get_passed_nick();
+		entry.passed_user = client.get_passed_user();
+		entry.authenticated = client.is_authenticated();
+		entry.is_operator = client.is_operator();
+		entry.pending_input = std::string(client.get_pending_input());
+		entry.pending_output = client.get_pending_output();
+		state.clients.push_back(std::move(entry));
+		for (const ChannelName& name : client.get_channels())
+		{
+			auto inserted = channel_index.emplace(name.get(), static_cast<uint32_t>(state.channels.size()));
+			if (inserted.second)
+				state.channels.push_back(UpgradeChannel{name->name, {}, {}});
+			state.channels[inserted.first->second].members.push_back(index);
+		}
+	});
+	// Channels with no local member keep their history too (restored from a
+	// snapshot, or with remote members only)
+	_channels.for_each([&state, &channel_index](const Channel& channel) {
+		if (!channel.get_history().empty() && !channel_index.count(channel.get_name_ref().get()))
+			state.channels.push_back(UpgradeChannel{channel.get_name(), {}, {}});
+	});
+	for (UpgradeChannel& entry : state.channels)
+	{
+		const ChannelHistory& history = _channels.find(entry.name)->get_history();
+		for (size_t i = 0; i < history.size(); ++i)
+			entry.history.push_back(UpgradeMessage{history.at(i).time_ms, *history.at(i).line});
+	}
+	return state;
+}
+
+// New process side: rebuilds the clients, nicknames and channels the old
+// process handed over. Timers and flood buckets start afresh
+void Server::restore(const UpgradeState& state)
+{
+	for (const UpgradeClient& entry : state.clients)
+	{
+		Client& client = _clients.emplace(entry.fd, entry.fd, _event_loop.get(), _recv_chunk_size, &_flush_list);
+		_event_loop->add(entry.fd, EVENT_READ);
+		if (entry.passed_pass)
+			client.set_passed_pass(_password);
+		if (entry.passed_nick)
+		{
+			client.set_passed_nick(entry.nickname);
+			_nicknames.insert(entry.nickname, entry.fd);
+		}
+		if (entry.passed_user)
+		{
+			client.set_passed_user(entry.username);
+			client.set_passed_realname(entry.realname);
+		}
+		if (entry.authenticated)
+			client.set_authenticated();
+		if (entry.is_operator)
+			client.set_operator();
+		client.note_activity(_now_ms, true);
+		client.get_timer().owner = entry.fd;
+		_timers.schedule(client.get_timer(), _now_ms, entry.authenticated ? _ping_interval_ms : _registration_timeout_ms);
+		if (!entry.pending_output.empty())
+			client.send(entry.pending_output);
+		if (!entry.pending_input.empty())
+		{
+			client.restore_input(entry.pending_input);
+			_inherited_input.push_back(_clients.handle_of(entry.fd));
+		}
+	}
+	for (const UpgradeChannel& entry : state.channels)
+	{
+		bool created;
+		Channel* channel = _channels.find_or_create(entry.name, _clients, created);
+		for (uint32_t member : entry.members)
+		{
+			int client_fd = state.clients[member].fd;
+			if (channel->add_client(client_fd))
+				_clients.at(client_fd).add_channel(channel->get_name_ref());
+		}
+		for (const UpgradeMessage& message : entry.history)
+			_channels.record_history(*channel, make_shared_buffer(message.line), message.time_ms);
+		_channels.release_if_empty(channel);
+	}
+	LOG_INFO("Took over " << state.clients.size() << " clients and " << state.channels.size() << " channels");
+}
+
+// fork + exec of the ircserv binary installed at our own path, with the
+// same arguments and IRCSERV_UPGRADE_FD pointing at socket_fd. After a deploy
+// replaced the file, /proc/self/exe reads "<path> (deleted)": the path is
+// what we want, it is the new binary. Returns the child's pid, -1 on failure
+pid_t Server::spawn_successor(int socket_fd) const
+{
+	char path_buffer[PATH_MAX];
+	ssize_t length = readlink("/proc/self/exe", path_buffer, sizeof(path_buffer) - 1);
+	if (length < 0)
+	{
+		LOG_ERROR("Hot upgrade: readlink(/proc/self/exe) failed: " << std::strerror(errno));
+		return -1;
+	}
+	std::string path(path_buffer, static_cast<size_t>(length));
+	const std::string deleted = " (deleted)";
+	if (path.size() > deleted.size() && path.compare(path.size() - deleted.size(), deleted.size(), deleted) == 0)
+		path.erase(path.size() - deleted.size());
+
+	// Everything is prepared before fork(): the child only calls
+	// async-signal-safe functions (the logger thread is not copied)
+	std::string port = std::to_string(_port);
+	std::string upgrade_variable = std::string(UPGRADE_FD_VARIABLE "=") + std::to_string(socket_fd);
+	std::vector<char*> argv = {const_cast<char*>(path.c_str()), const_cast<char*>(port.c_str()),
+		const_cast<char*>(_password.c_str()), NULL};
+	std::vector<char*> envp;
+	for (char** variable = environ; *variable; ++variable)
+	{
+		if (std::strncmp(*variable, UPGRADE_FD_VARIABLE "=", sizeof(UPGRADE_FD_VARIABLE)) != 0)
+			envp.push_back(*variable);
+	}
+	envp.push_back(const_cast<char*>(upgrade_variable.c_str()));
+	envp.push_back(NULL);
+
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		LOG_ERROR("Hot upgrade: fork failed: " << std::strerror(errno));
+		return -1;
+	}
+	if (pid == 0)
+	{
+		// socket_fd is close-on-exec like everything else: keep this one
+		fcntl(socket_fd, F_SETFD, 0);
+		execve(argv[0], argv.data(), envp.data());
+		_exit(127);
+	}
+	LOG_INFO("Hot upgrade: started " << path << " as process " << pid);
+	return pid;
+}
+
+// The main server loop
+void Server::run()
+{
+	LOG_DEBUG("Entering server loop...");
+	int listening_fd = _listening_socket.get_fd();
+	// Lines the previous process received but did not handle (hot upgrade)
+	for (ClientHandle handle : _inherited_input)
+	{
+		if (_clients.find(handle))
+			dispatch_buffered_lines(handle.fd, _line_budget);
+	}
+	_inherited_input.clear();
+	flush_clients();
+	while (true)
+	{
+		// Block until at least one fd is ready, the next timer is due or a
+		// throttled client may go on (indefinitely when none of those is pending).
+		// Only the ready fds are returned, so idle clients cost nothing here
+		int num_events = _event_loop->wait(_ready_events, next_wait_ms());
+		_now_ms = TimerWheel::monotonic_ms();
+
+		if (_signal_received)
+		{
+			LOG_INFO("Signal received. Shutting down server.");
+			write_final_snapshot();
+			break;
+		}
+		if (_upgrade_requested)
+		{
+			_upgrade_requested = 0;
+			if (hot_upgrade())
+				break;
+			// Going on: the replies to the input handled by the failed attempt
+			// are corked, write them before waiting again
+			flush_clients();
+			continue; // _ready_events was reused while settling the sends
+		}
+
+		if (num_events < 0)
+		{
+			// Handle wait errors, ignoring EINTR which means interrupted by signal
+			if (errno == EINTR)
+				continue; // Signal received, wait again
+			throw std::runtime_error(std::string("Event loop wait failed: ") + std::strerror(errno));
+		}
+
+		// --- Handle events ---
+		uint64_t iteration_start = Metrics::now_ns();
+		// Tag every event with the connection it was reported for: a client
+		// disconnected earlier in this batch may have its fd reused by a new
+		// accept before its own stale events are reached
+		_ready_handles.clear();
+		for (const IoEvent& event : _ready_events)
+			_ready_handles.push_back(_clients.handle_of(event.fd));
+		// Clients with input left over from the last iteration are served after
+		// the events; the ones queued from now on wait for the next iteration
+		_input_resuming.swap(_input_pending);
+		for (size_t i = 0; i < _ready_events.size(); ++i)
+		{
+			const IoEvent& event = _ready_events[i];
+			if (_metrics_listener && event.fd == _metrics_listener->get_fd())
+			{
+				_metrics_listener->serve(Metrics::instance().to_prometheus(_clients.size(), _channels.size()));
+				continue;
+			}
+			if (event.fd == listening_fd)
+			{
+				if (event.events & EVENT_ERROR)
+				{
+					// Errors on the listening socket are rare but fatal
+					LOG_ERROR("Error event on listening socket (FD " << listening_fd << ").");
+					throw std::runtime_error("Fatal error on listening socket.");
+				}
+				// One or more new connections are ready to be accepted
+				handle_new_connection();
+				continue;
+			}
+			// The client may already be gone (disconnected earlier in this batch)
+			Client* client = _clients.find(_ready_handles[i]);
+			if (!client)
+				continue;
+			// A write handed to a batching backend (io_uring) completed
+			if ((event.events & EVENT_SENT) && !client->complete_send(event.result))
 			{
-				std::cout << "Event on client socket (FD " << _pollfds[i].fd << "): Disconnection detected." << std::endl;
-				// handle disconnection
-				handle_disconnection(i);
-				--num_events;
+				handle_disconnection(event.fd);
+				continue;
 			}
-			else if (_pollfds[i].revents & POLLIN)
+			// The socket has room again: push out what is waiting in the send queue
+			if ((event.events & EVENT_WRITE) && !client->flush_send_queue())
 			{
-				std::cout << "Event on client socket (FD " << _pollfds[i].fd << "): Data ready to read." << std::endl;
-				process_client_data(i, _pollfds[i].fd);
-				--num_events;
+				handle_disconnection(event.fd);
+				continue;
 			}
-			else if (_pollfds[i].revents & (POLLERR | POLLNVAL))
+			if (event.events & EVENT_ERROR)
+			{
+				LOG_DEBUG("Event on client socket (FD " << event.fd << "): Socket error.");
+				handle_disconnection(event.fd);
+				continue;
+			}
+			// Edge-triggered backends report a hangup once: remember it, so
+			// whichever turn reads next goes on to the end of the stream
+			if (event.events & EVENT_HANGUP)
+				client->set_hung_up();
+			// Queued clients read in run_pending_input(), where the end of the
+			// stream shows up as recv() returning 0
+			if (client->is_input_queued())
+				continue;
+			if (event.events & (EVENT_READ | EVENT_HANGUP))
 			{
-				// Check for errors on listening socket (rare but possible)
-				std::cerr << "Error event on listening socket (FD " << _listening_socket.get_fd() << ")." << std::endl;
-				// Depending on the error, you might want to exit or try to recover
-				throw std::runtime_error("Fatal error on listening socket.");
+				LOG_DEBUG("Event on client socket (FD " << event.fd << "): Data ready to read.");
+				// After a hangup, reads and handles everything that is left, then
+				// closes on the final recv() == 0 (later, if flood control defers lines)
+				process_client_data(event.fd);
 			}
 		}
-		// If num_events > 0 here, it means other events occurred (on client sockets),
-		// but we don't handle them in Block 1.
+		if (_accept_retry_ms != 0 && _now_ms >= _accept_retry_ms)
+			resume_accepting();
+		else if (_accept_pending)
+			handle_new_connection();
+		run_pending_input();
+		run_throttled_clients();
+		run_timers();
+		run_snapshot();
+		flush_clients();
+		Metrics& metrics = Metrics::instance();
+		++metrics.loop_iterations;
+		metrics.loop_latency.record(Metrics::now_ns() - iteration_start);
 	}
 }
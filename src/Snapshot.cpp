@@ -0,0 +1,223 @@
+#include "../includes/Snapshot.hpp"
+#include <sys/mman.h> // For mmap()
+#include <sys/stat.h> // For fstat()
+#include <fcntl.h>    // For open()
+#include <unistd.h>   // For write(), fsync(), close()
+#include <cstdio>     // For rename()
+#include <cerrno>
+#include <cstring>    // For memcpy(), strerror()
+#include <stdexcept>
+#include <algorithm>  // For std::min
+
+#define SNAPSHOT_MAGIC 0x53435249U // "IRCS"
+#define SNAPSHOT_VERSION 1U
+
+// Buffered writer over a fixed array: no allocation at all
+class SnapshotWriter
+{
+	private:
+		int _fd;
+		size_t _used;
+		bool _ok;
+		char _buffer[SNAPSHOT_BUFFER_SIZE];
+
+	public:
+		explicit SnapshotWriter(int fd) : _fd(fd), _used(0), _ok(true) {}
+
+		bool flush()
+		{
+			const char* data = _buffer;
+			while (_ok && _used > 0)
+			{
+				ssize_t written = ::write(_fd, data, _used);
+				if (written < 0 && errno == EINTR)
+					continue;
+				if (written <= 0)
+				{
+					_ok = false;
+					break ;
+				}
+				data += written;
+				_used -= static_cast<size_t>(written);
+			}
+			_used = 0;
+			return _ok;
+		}
+
+		void put(const void* data, size_t size)
+		{
+			const char* bytes = static_cast<const char*>(data);
+			while (size > 0 && _ok)
+			{
+				if (_used == sizeof(_buffer))
+					flush();
+				size_t chunk = std::min(size, sizeof(_buffer) - _used);
+				std::memcpy(_buffer + _used, bytes, chunk);
+				_used += chunk;
+				bytes += chunk;
+				size -= chunk;
+			}
+		}
+
+		void put_u32(uint32_t value) { put(&value, sizeof(value)); }
+		void put_u64(uint64_t value) { put(&value, sizeof(value)); }
+		void put_string(const char* data, size_t size)
+		{
+			put_u32(static_cast<uint32_t>(size));
+			put(data, size);
+		}
+};
+
+// A channel nobody is in and nothing was said in would come back empty
+static bool worth_keeping(const Channel& channel)
+{
+	return !channel.empty() || !channel.get_history().empty();
+}
+
+bool Snapshot::write(const char* path, const char* temp_path, const ChannelRegistry& channels)
+{
+	int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return false;
+	uint32_t channel_count = 0;
+	channels.for_each([&channel_count](const Channel& channel) {
+		if (worth_keeping(channel))
+			++channel_count;
+	});
+	SnapshotWriter writer(fd);
+	writer.put_u32(SNAPSHOT_MAGIC);
+	writer.put_u32(SNAPSHOT_VERSION);
+	writer.put_u32(channel_count);
+	channels.for_each([&writer](const Channel& channel) {
+		if (!worth_keeping(channel))
+			return ;
+		writer.put_string(channel.get_name().data(), channel.get_name().size());
+		const ChannelHistory& history = channel.get_history();
+		writer.put_u32(static_cast<uint32_t>(history.size()));
+		for (size_t i = 0; i < history.size(); ++i)
+		{
+			const HistoryEntry& entry = history.at(i);
+			writer.put_u64(entry.time_ms);
+			writer.put_string(entry.line->data(), entry.line->size());
+		}
+	});
+	bool ok = writer.flush() && fsync(fd) == 0;
+	int saved_errno = errno;
+	close(fd);
+	if (ok && std::rename(temp_path, path) == 0)
+		return true;
+	if (ok)
+		saved_errno = errno;
+	unlink(temp_path);
+	errno = saved_errno;
+	return false;
+}
+
+// Bounds-checked reads straight from the mapping
+class SnapshotReader
+{
+	private:
+		const char* _data;
+		size_t _size;
+		size_t _offset;
+
+		void need(size_t size) const
+		{
+			if (_size - _offset < size)
+				throw std::runtime_error("Snapshot truncated");
+		}
+
+	public:
+		SnapshotReader(const char* data, size_t size) : _data(data), _size(size), _offset(0) {}
+
+		uint32_t u32()
+		{
+			uint32_t value;
+			need(sizeof(value));
+			std::memcpy(&value, _data + _offset, sizeof(value));
+			_offset += sizeof(value);
+			return value;
+		}
+
+		uint64_t u64()
+		{
+			uint64_t value;
+			need(sizeof(value));
+			std::memcpy(&value, _data + _offset, sizeof(value));
+			_offset += sizeof(value);
+			return value;
+		}
+
+		std::string_view string()
+		{
+			uint32_t size = u32();
+			need(size);
+			std::string_view value(_data + _offset, size);
+			_offset += size;
+			return value;
+		}
+};
+
+// The messages are loaded channel after channel: after a restart the global
+// history cap drops them in that order rather than strictly oldest first
+static size_t load_channels(SnapshotReader& reader, ChannelRegistry& channels, ClientTable& clients)
+{
+	if (reader.u32() != SNAPSHOT_MAGIC || reader.u32() != SNAPSHOT_VERSION)
+		throw std::runtime_error("Snapshot has an unknown format");
+	uint32_t channel_count = reader.u32();
+	channels.reserve(channels.size() + channel_count);
+	for (uint32_t i = 0; i < channel_count; ++i)
+	{
+		std::string_view name = reader.string();
+		if (!ChannelRegistry::is_valid_name(name))
+			throw std::runtime_error("Snapshot has a bad channel name");
+		bool created;
+		Channel* channel = channels.find_or_create(name, clients, created);
+		uint32_t message_count = reader.u32();
+		channel->get_history().reserve(std::min<size_t>(message_count, channels.history_limits().lines));
+		for (uint32_t j = 0; j < message_count; ++j)
+		{
+			uint64_t time_ms = reader.u64();
+			std::string_view line = reader.string();
+			channels.record_history(*channel, make_shared_buffer(std::string(line)), time_ms);
+		}
+		// Kept for its members only: they are gone
+		channels.release_if_empty(channel);
+	}
+	return channel_count;
+}
+
+size_t Snapshot::load(const std::string& path, ChannelRegistry& channels, ClientTable& clients)
+{
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		if (errno == ENOENT)
+			return 0;
+		throw std::runtime_error("Cannot open snapshot " + path + ": " + std::strerror(errno));
+	}
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) < 0 || file_stat.st_size == 0)
+	{
+		close(fd);
+		throw std::runtime_error("Snapshot " + path + " is empty or unreadable");
+	}
+	size_t size = static_cast<size_t>(file_stat.st_size);
+	void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED)
+		throw std::runtime_error("Cannot map snapshot " + path + ": " + std::strerror(errno));
+	madvise(mapping, size, MADV_SEQUENTIAL);
+	try
+	{
+		SnapshotReader reader(static_cast<const char*>(mapping), size);
+		size_t channel_count = load_channels(reader, channels, clients);
+		munmap(mapping, size);
+		return channel_count;
+	}
+	catch (...)
+	{
+		munmap(mapping, size);
+		throw;
+	}
+}
@@ -0,0 +1,165 @@
+#include "../includes/TimerWheel.hpp"
+#include <ctime> // For clock_gettime()
+
+#define TIMER_MASK (TIMER_SLOTS - 1)
+#define TIMER_MAX_TICKS ((uint64_t(1) << (TIMER_LEVEL_BITS * TIMER_LEVELS)) - 1)
+
+TimerNode::~TimerNode()
+{
+	unlink();
+}
+
+void TimerNode::unlink()
+{
+	if (!wheel)
+		return ;
+	prev->next = next;
+	next->prev = prev;
+	--wheel->_armed;
+	prev = NULL;
+	next = NULL;
+	wheel = NULL;
+}
+
+TimerWheel::TimerWheel(uint64_t now_ms) : _start_ms(now_ms), _current_tick(0), _armed(0)
+{
+	for (size_t level = 0; level < TIMER_LEVELS; ++level)
+	{
+		for (size_t i = 0; i < TIMER_SLOTS; ++i)
+		{
+			_slots[level][i].prev = &_slots[level][i];
+			_slots[level][i].next = &_slots[level][i];
+		}
+	}
+}
+
+TimerWheel::~TimerWheel()
+{
+	// Detach whatever is still armed so the nodes do not point at a dead wheel
+	for (size_t level = 0; level < TIMER_LEVELS; ++level)
+	{
+		for (size_t i = 0; i < TIMER_SLOTS; ++i)
+		{
+			TimerNode& head = _slots[level][i];
+			while (!slot_empty(head))
+				head.next->unlink();
+		}
+	}
+}
+
+uint64_t TimerWheel::monotonic_ms()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return static_cast<uint64_t>(now.tv_sec) * 1000 + static_cast<uint64_t>(now.tv_nsec) / 1000000;
+}
+
+// Links node into the slot matching its expiry, relative to the current tick
+void TimerWheel::insert(TimerNode& node)
+{
+	uint64_t delta = node.expires - _current_tick;
+	size_t level = 0;
+	while (level + 1 < TIMER_LEVELS && delta >= (uint64_t(1) << (TIMER_LEVEL_BITS * (level + 1))))
+		++level;
+	TimerNode& head = _slots[level][(node.expires >> (TIMER_LEVEL_BITS * level)) & TIMER_MASK];
+	node.prev = head.prev;
+	node.next = &head;
+	head.prev->next = &node;
+	head.prev = &node;
+	node.wheel = this;
+	++_armed;
+}
+
+void TimerWheel::schedule(TimerNode& node, uint64_t now_ms, uint64_t delay_ms)
+{
+	node.unlink();
+	uint64_t now_tick = (now_ms > _start_ms) ? (now_ms - _start_ms) / TIMER_TICK_MS : 0;
+	// With nothing armed there is nothing to fire or cascade on the way: catch up
+	if (_armed == 0 && now_tick > _current_tick)
+		_current_tick = now_tick;
+	if (now_tick < _current_tick)
+		now_tick = _current_tick;
+	uint64_t ticks = (delay_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+	if (ticks == 0)
+		ticks = 1;
+	// The distance from _current_tick is what has to fit in the wheel
+	if (now_tick - _current_tick + ticks > TIMER_MAX_TICKS)
+		ticks = TIMER_MAX_TICKS - (now_tick - _current_tick);
+	node.expires = now_tick + ticks;
+	insert(node);
+}
+
+void TimerWheel::cancel(TimerNode& node)
+{
+	node.unlink();
+}
+
+// Moves every timer of a higher-level slot down to where it belongs now
+void TimerWheel::cascade(size_t level, size_t index)
+{
+	TimerNode& head = _slots[level][index];
+	while (!slot_empty(head))
+	{
+		TimerNode& node = *head.next;
+		node.unlink();
+		insert(node);
+	}
+}
+
+void TimerWheel::advance(uint64_t now_ms, std::vector<int>& expired_owners)
+{
+	uint64_t target = (now_ms - _start_ms) / TIMER_TICK_MS;
+	if (_armed == 0)
+	{
+		// Nothing to fire or cascade: jump straight there
+		if (target > _current_tick)
+			_current_tick = target;
+		return ;
+	}
+	while (_current_tick < target)
+	{
+		++_current_tick;
+		// Level 0 wrapped around: bring the next slot of the level above down, and so on
+		size_t index = _current_tick & TIMER_MASK;
+		for (size_t level = 1; level < TIMER_LEVELS && index == 0; ++level)
+		{
+			index = (_current_tick >> (TIMER_LEVEL_BITS * level)) & TIMER_MASK;
+			cascade(level, index);
+		}
+		TimerNode& head = _slots[0][_current_tick & TIMER_MASK];
+		while (!slot_empty(head))
+		{
+			TimerNode& node = *head.next;
+			node.unlink();
+			expired_owners.push_back(node.owner);
+		}
+		if (_armed == 0 && _current_tick < target)
+			_current_tick = target;
+	}
+}
+
+int TimerWheel::next_timeout_ms(uint64_t now_ms) const
+{
+	if (_armed == 0)
+		return -1;
+	// The first armed slot of level 0 within one turn gives the exact deadline;
+	// otherwise wake up for the next cascade, at most one level-0 turn away
+	uint64_t ticks = TIMER_SLOTS - (_current_tick & TIMER_MASK);
+	for (uint64_t ahead = 1; ahead <= TIMER_SLOTS; ++ahead)
+	{
+		if (!slot_empty(_slots[0][(_current_tick + ahead) & TIMER_MASK]))
+		{
+			ticks = ahead;
+			break;
+		}
+	}
+	uint64_t deadline_ms = _start_ms + (_current_tick + ticks) * TIMER_TICK_MS;
+	if (deadline_ms <= now_ms)
+		return 0;
+	return static_cast<int>(deadline_ms - now_ms);
+}
+
+size_t TimerWheel::size() const
+{
+	return _armed;
+}
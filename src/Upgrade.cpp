@@ -0,0 +1,290 @@
+#include "../includes/Upgrade.hpp"
+#include <sys/socket.h> // For sendmsg(), recvmsg(), SCM_RIGHTS
+#include <poll.h>       // For poll()
+#include <unistd.h>     // For close()
+#include <cerrno>
+#include <cstring>      // For memcpy(), strerror()
+#include <stdexcept>
+#include <algorithm>  // For std::min
+
+#define UPGRADE_MAGIC 0x49524355U // "IRCU"
+#define UPGRADE_VERSION 2U
+
+// Little helpers for the blob: fixed-size integers in host order (both
+// processes run on the same machine) and length-prefixed strings
+static void put_u32(std::string& out, uint32_t value)
+{
+	out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void put_u64(std::string& out, uint64_t value)
+{
+	out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void put_string(std::string& out, const std::string& value)
+{
+	put_u32(out, static_cast<uint32_t>(value.size()));
+	out.append(value);
+}
+
+class BlobReader
+{
+	private:
+		const std::string& _blob;
+		size_t _offset;
+
+		void need(size_t size) const
+		{
+			if (_blob.size() - _offset < size)
+				throw std::runtime_error("Upgrade state truncated");
+		}
+
+	public:
+		explicit BlobReader(const std::string& blob) : _blob(blob), _offset(0) {}
+
+		uint32_t u32()
+		{
+			uint32_t value;
+			need(sizeof(value));
+			std::memcpy(&value, _blob.data() + _offset, sizeof(value));
+			_offset += sizeof(value);
+			return value;
+		}
+
+		uint64_t u64()
+		{
+			uint64_t value;
+			need(sizeof(value));
+			std::memcpy(&value, _blob.data() + _offset, sizeof(value));
+			_offset += sizeof(value);
+			return value;
+		}
+
+		std::string string()
+		{
+			uint32_t size = u32();
+			need(size);
+			std::string value(_blob, _offset, size);
+			_offset += size;
+			return value;
+		}
+};
+
+static void write_all(int fd, const char* data, size_t size)
+{
+	while (size > 0)
+	{
+		ssize_t written = ::send(fd, data, size, MSG_NOSIGNAL);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			throw std::runtime_error(std::string("Upgrade send failed: ") + std::strerror(errno));
+		}
+		data += written;
+		size -= static_cast<size_t>(written);
+	}
+}
+
+static void read_all(int fd, char* data, size_t size)
+{
+	while (size > 0)
+	{
+		ssize_t received = ::recv(fd, data, size, 0);
+		if (received < 0 && errno == EINTR)
+			continue;
+		if (received <= 0)
+			throw std::runtime_error(received == 0 ? "Upgrade socket closed early"
+				: std::string("Upgrade receive failed: ") + std::strerror(errno));
+		data += received;
+		size -= static_cast<size_t>(received);
+	}
+}
+
+// One message: the number of fds as payload, the fds as SCM_RIGHTS
+static void send_fds(int socket_fd, const int* fds, uint32_t count)
+{
+	char control[CMSG_SPACE(sizeof(int) * UPGRADE_FDS_PER_MESSAGE)];
+	std::memset(control, 0, sizeof(control));
+	iovec iov = {&count, sizeof(count)};
+	msghdr message;
+	std::memset(&message, 0, sizeof(message));
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+	cmsghdr* header = CMSG_FIRSTHDR(&message);
+	header->cmsg_level = SOL_SOCKET;
+	header->cmsg_type = SCM_RIGHTS;
+	header->cmsg_len = CMSG_LEN(sizeof(int) * count);
+	std::memcpy(CMSG_DATA(header), fds, sizeof(int) * count);
+	while (sendmsg(socket_fd, &message, MSG_NOSIGNAL) < 0)
+	{
+		if (errno != EINTR)
+			throw std::runtime_error(std::string("Upgrade fd transfer failed: ") + std::strerror(errno));
+	}
+}
+
+// Receives one send_fds() message, appending the fds (close-on-exec) to fds
+static void receive_fds(int socket_fd, std::vector<int>& fds)
+{
+	char control[CMSG_SPACE(sizeof(int) * UPGRADE_FDS_PER_MESSAGE)];
+	uint32_t count = 0;
+	iovec iov = {&count, sizeof(count)};
+	msghdr message;
+	std::memset(&message, 0, sizeof(message));
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+	size_t before = fds.size();
+	ssize_t received;
+	while ((received = recvmsg(socket_fd, &message, MSG_CMSG_CLOEXEC | MSG_WAITALL)) < 0 && errno == EINTR)
+		;
+	if (received != sizeof(count))
+		throw std::runtime_error("Upgrade fd transfer failed");
+	for (cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header))
+	{
+		if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+			continue;
+		size_t in_message = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (size_t i = 0; i < in_message; ++i)
+		{
+			int fd;
+			std::memcpy(&fd, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+			fds.push_back(fd);
+		}
+	}
+	if ((message.msg_flags & MSG_CTRUNC) || fds.size() - before != count)
+		throw std::runtime_error("Upgrade fd transfer truncated");
+}
+
+void UpgradeState::send(int socket_fd) const
+{
+	std::string blob;
+	put_u32(blob, static_cast<uint32_t>(clients.size()));
+	for (const UpgradeClient& client : clients)
+	{
+		put_string(blob, client.nickname);
+		put_string(blob, client.username);
+		put_string(blob, client.realname);
+		put_u32(blob, client.passed_pass | client.passed_nick << 1 | client.passed_user << 2
+			| client.authenticated << 3 | client.is_operator << 4);
+		put_string(blob, client.pending_input);
+		put_string(blob, client.pending_output);
+	}
+	put_u32(blob, static_cast<uint32_t>(channels.size()));
+	for (const UpgradeChannel& channel : channels)
+	{
+		put_string(blob, channel.name);
+		put_u32(blob, static_cast<uint32_t>(channel.members.size()));
+		for (uint32_t member : channel.members)
+			put_u32(blob, member);
+		put_u32(blob, static_cast<uint32_t>(channel.history.size()));
+		for (const UpgradeMessage& message : channel.history)
+		{
+			put_u64(blob, message.time_ms);
+			put_string(blob, message.line);
+		}
+	}
+
+	std::string header;
+	put_u32(header, UPGRADE_MAGIC);
+	put_u32(header, UPGRADE_VERSION);
+	put_u32(header, metrics_fd >= 0);
+	put_u32(header, static_cast<uint32_t>(blob.size()));
+	write_all(socket_fd, header.data(), header.size());
+	write_all(socket_fd, blob.data(), blob.size());
+
+	std::vector<int> fds;
+	fds.push_back(listening_fd);
+	if (metrics_fd >= 0)
+		fds.push_back(metrics_fd);
+	for (const UpgradeClient& client : clients)
+		fds.push_back(client.fd);
+	for (size_t sent = 0; sent < fds.size(); sent += UPGRADE_FDS_PER_MESSAGE)
+	{
+		size_t count = std::min<size_t>(fds.size() - sent, UPGRADE_FDS_PER_MESSAGE);
+		send_fds(socket_fd, fds.data() + sent, static_cast<uint32_t>(count));
+	}
+}
+
+UpgradeState UpgradeState::receive(int socket_fd)
+{
+	uint32_t header[4];
+	read_all(socket_fd, reinterpret_cast<char*>(header), sizeof(header));
+	if (header[0] != UPGRADE_MAGIC || header[1] != UPGRADE_VERSION)
+		throw std::runtime_error("Upgrade state has an unknown format");
+	bool has_metrics = header[2] != 0;
+	std::string blob(header[3], '\0');
+	read_all(socket_fd, &blob[0], blob.size());
+
+	UpgradeState state;
+	BlobReader reader(blob);
+	state.clients.resize(reader.u32());
+	for (UpgradeClient& client : state.clients)
+	{
+		client.fd = -1;
+		client.nickname = reader.string();
+		client.username = reader.string();
+		client.realname = reader.string();
+		uint32_t flags = reader.u32();
+		client.passed_pass = flags & 1;
+		client.passed_nick = flags & 2;
+		client.passed_user = flags & 4;
+		client.authenticated = flags & 8;
+		client.is_operator = flags & 16;
+		client.pending_input = reader.string();
+		client.pending_output = reader.string();
+	}
+	state.channels.resize(reader.u32());
+	for (UpgradeChannel& channel : state.channels)
+	{
+		channel.name = reader.string();
+		channel.members.resize(reader.u32());
+		for (uint32_t& member : channel.members)
+		{
+			member = reader.u32();
+			if (member >= state.clients.size())
+				throw std::runtime_error("Upgrade state has a bad channel member");
+		}
+		channel.history.resize(reader.u32());
+		for (UpgradeMessage& message : channel.history)
+		{
+			message.time_ms = reader.u64();
+			message.line = reader.string();
+		}
+	}
+
+	std::vector<int> fds;
+	size_t expected = 1 + has_metrics + state.clients.size();
+	while (fds.size() < expected)
+		receive_fds(socket_fd, fds);
+	size_t next = 0;
+	state.listening_fd = fds[next++];
+	if (has_metrics)
+		state.metrics_fd = fds[next++];
+	for (UpgradeClient& client : state.clients)
+		client.fd = fds[next++];
+	return state;
+}
+
+void UpgradeState::acknowledge(int socket_fd)
+{
+	char ack = 'R';
+	write_all(socket_fd, &ack, 1);
+	close(socket_fd);
+}
+
+bool UpgradeState::wait_for_acknowledgement(int socket_fd, int timeout_ms)
+{
+	pollfd pfd = {socket_fd, POLLIN, 0};
+	int ready;
+	while ((ready = poll(&pfd, 1, timeout_ms)) < 0 && errno == EINTR)
+		;
+	if (ready <= 0)
+		return false;
+	char ack;
+	return ::recv(socket_fd, &ack, 1, 0) == 1 && ack == 'R';
+}
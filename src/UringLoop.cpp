@@ -0,0 +1,321 @@
+#include "../includes/UringLoop.hpp"
+
+#ifdef IRCSERV_HAVE_IO_URING
+
+# include <sys/mman.h>    // For mmap(), munmap()
+# include <sys/syscall.h> // For __NR_io_uring_setup, __NR_io_uring_enter
+# include <poll.h>        // For POLLIN, POLLOUT...
+# include <unistd.h>      // For close(), syscall()
+# include <cerrno>
+# include <cstring>       // For memset(), strerror()
+# include <stdexcept>
+# include <algorithm>     // For remove_if()
+
+// user_data of every request: what it is, the fd's seq when it was queued, the fd
+# define URING_KIND_IGNORE 0ULL // POLL_REMOVE requests, their completion tells nothing
+# define URING_KIND_POLL 1ULL
+# define URING_KIND_SEND 2ULL
+# define URING_SEQ_MASK 0x3fffffffU
+
+static uint64_t pack_user_data(uint64_t kind, uint32_t seq, int fd)
+{
+	return (kind << 62) | (static_cast<uint64_t>(seq & URING_SEQ_MASK) << 32) | static_cast<uint32_t>(fd);
+}
+
+static uint32_t poll_mask(unsigned int events)
+{
+	uint32_t mask = POLLRDHUP;
+	if (events & EVENT_READ)
+		mask |= POLLIN;
+	if (events & EVENT_WRITE)
+		mask |= POLLOUT;
+	return mask;
+}
+
+UringLoop::UringLoop() : _ring_fd(-1), _sq_ring(MAP_FAILED), _sq_ring_size(0), _sqes(static_cast<io_uring_sqe*>(MAP_FAILED)),
+	_sqes_size(0), _cq_ring(MAP_FAILED), _cq_ring_size(0), _iov_arena(URING_IOV_ARENA), _iov_used(0)
+{
+	io_uring_params params;
+	std::memset(&params, 0, sizeof(params));
+	// The ring fd is close-on-exec already
+	_ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, URING_ENTRIES, &params));
+	if (_ring_fd < 0)
+		throw std::runtime_error(std::string("io_uring_setup failed: ") + std::strerror(errno));
+	// EXT_ARG: wait() with a timeout. NODROP: no completion is ever lost.
+	// RSRC_TAGS came with the same release (5.13) as multishot poll
+	unsigned required = IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP | IORING_FEAT_RSRC_TAGS;
+	if ((params.features & required) != required)
+	{
+		close(_ring_fd);
+		throw std::runtime_error("io_uring: the kernel is too old (5.13 or later is needed)");
+	}
+
+	_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+	if (single_mmap && _cq_ring_size > _sq_ring_size)
+		_sq_ring_size = _cq_ring_size;
+	_sq_ring = mmap(NULL, _sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQ_RING);
+	if (_sq_ring != MAP_FAILED)
+		_cq_ring = single_mmap ? _sq_ring
+			: mmap(NULL, _cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_CQ_RING);
+	_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+	if (_cq_ring != MAP_FAILED)
+		_sqes = static_cast<io_uring_sqe*>(mmap(NULL, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQES));
+	if (_sqes == MAP_FAILED)
+	{
+		int error = errno;
+		unmap();
+		close(_ring_fd);
+		throw std::runtime_error(std::string("io_uring mmap failed: ") + std::strerror(error));
+	}
+
+	char* sq = static_cast<char*>(_sq_ring);
+	_sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+	_sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+	_sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+	_sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+	_sq_entries = params.sq_entries;
+	char* cq = static_cast<char*>(_cq_ring);
+	_cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+	_cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+	_cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+	_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+	// SQE i always sits in slot i of the indirection array
+	for (unsigned i = 0; i < _sq_entries; ++i)
+		_sq_array[i] = i;
+}
+
+UringLoop::~UringLoop()
+{
+	unmap();
+	if (_ring_fd >= 0)
+		close(_ring_fd);
+}
+
+void UringLoop::unmap()
+{
+	if (_sqes != MAP_FAILED)
+		munmap(_sqes, _sqes_size);
+	if (_cq_ring != MAP_FAILED && _cq_ring != _sq_ring)
+		munmap(_cq_ring, _cq_ring_size);
+	if (_sq_ring != MAP_FAILED)
+		munmap(_sq_ring, _sq_ring_size);
+}
+
+UringLoop::FdState& UringLoop::state(int fd)
+{
+	if (fd < 0)
+		throw std::runtime_error("io_uring: negative fd");
+	if (static_cast<size_t>(fd) >= _fds.size())
+		_fds.resize(static_cast<size_t>(fd) + 1, FdState());
+	return _fds[fd];
+}
+
+int UringLoop::enter(unsigned to_submit, unsigned min_complete, unsigned flags, const void* arg, size_t arg_size)
+{
+	return static_cast<int>(syscall(__NR_io_uring_enter, _ring_fd, to_submit, min_complete, flags, arg, arg_size));
+}
+
+// Hands every queued SQE to the kernel, without waiting for anything
+void UringLoop::submit_pending()
+{
+	unsigned tail = *_sq_tail;
+	while (tail != __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE))
+	{
+		if (enter(tail - *_sq_head, 0, 0, NULL, 0) >= 0 || errno == EINTR)
+			continue;
+		// The completion ring is full: make room by moving its entries aside
+		if (errno == EBUSY || errno == EAGAIN)
+			reap(_early);
+		else
+			throw std::runtime_error(std::string("io_uring_enter failed: ") + std::strerror(errno));
+	}
+	_iov_used = 0; // The kernel copied every iovec it needed
+}
+
+// Returns the next free SQE, zeroed. It is only seen by the kernel once
+// commit_sqe() moved the tail past it
+io_uring_sqe* UringLoop::next_sqe()
+{
+	if (*_sq_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) >= _sq_entries)
+		submit_pending();
+	io_uring_sqe* sqe = &_sqes[*_sq_tail & *_sq_mask];
+	std::memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+void UringLoop::commit_sqe()
+{
+	__atomic_store_n(_sq_tail, *_sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+void UringLoop::arm_poll(int fd)
+{
+	FdState& fd_state = _fds[fd];
+	io_uring_sqe* sqe = next_sqe();
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = poll_mask(fd_state.events);
+	sqe->len = IORING_POLL_ADD_MULTI; // Stays armed after each completion
+	sqe->user_data = pack_user_data(URING_KIND_POLL, fd_state.seq, fd);
+	commit_sqe();
+}
+
+void UringLoop::cancel_poll(int fd)
+{
+	FdState& fd_state = _fds[fd];
+	io_uring_sqe* sqe = next_sqe();
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = pack_user_data(URING_KIND_POLL, fd_state.seq, fd);
+	sqe->user_data = pack_user_data(URING_KIND_IGNORE, 0, fd);
+	commit_sqe();
+}
+
+// add / modify only queue requests: they reach the kernel with the next wait()
+void UringLoop::add(int fd, unsigned int events)
+{
+	FdState& fd_state = state(fd);
+	++fd_state.seq;
+	fd_state.events = events;
+	arm_poll(fd);
+}
+
+void UringLoop::modify(int fd, unsigned int events)
+{
+	FdState& fd_state = state(fd);
+	if (fd_state.events == events)
+		return ;
+	cancel_poll(fd);
+	++fd_state.seq;
+	fd_state.events = events;
+	arm_poll(fd);
+}
+
+// Submitted right away: the queued writes of fd must reach the socket, and
+// the poll must let go of it, before the caller closes it. Completions of fd
+// already moved to _early passed the seq check back then: they are dropped
+// here, or a client accepted on the same fd before the next wait() would get them
+void UringLoop::remove(int fd)
+{
+	if (fd < 0 || static_cast<size_t>(fd) >= _fds.size() || _fds[fd].events == 0)
+		return ;
+	cancel_poll(fd);
+	++_fds[fd].seq;
+	_fds[fd].events = 0;
+	submit_pending();
+	_early.erase(std::remove_if(_early.begin(), _early.end(),
+		[fd](const IoEvent& event) { return event.fd == fd; }), _early.end());
+}
+
+void UringLoop::submit_send(int fd, const iovec* iov, int iov_count)
+{
+	if (_iov_used + iov_count > _iov_arena.size())
+		submit_pending();
+	io_uring_sqe* sqe = next_sqe(); // May submit too, which empties the arena
+	iovec* stored = &_iov_arena[_iov_used];
+	std::memcpy(stored, iov, iov_count * sizeof(iovec));
+	_iov_used += iov_count;
+	sqe->opcode = IORING_OP_WRITEV;
+	sqe->fd = fd;
+	sqe->addr = reinterpret_cast<uint64_t>(stored);
+	sqe->len = static_cast<uint32_t>(iov_count);
+	sqe->user_data = pack_user_data(URING_KIND_SEND, state(fd).seq, fd);
+	commit_sqe();
+}
+
+// Turns the waiting completions into IoEvents, dropping the ones of older
+// registrations, and re-arms the polls the kernel ended
+void UringLoop::reap(std::vector<IoEvent>& ready)
+{
+	unsigned head = *_cq_head;
+	unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; ++head)
+	{
+		const io_uring_cqe& cqe = _cqes[head & *_cq_mask];
+		uint64_t kind = cqe.user_data >> 62;
+		uint32_t seq = static_cast<uint32_t>(cqe.user_data >> 32) & URING_SEQ_MASK;
+		int fd = static_cast<int>(static_cast<uint32_t>(cqe.user_data));
+		if (kind == URING_KIND_IGNORE || static_cast<size_t>(fd) >= _fds.size()
+			|| (_fds[fd].seq & URING_SEQ_MASK) != seq || _fds[fd].events == 0)
+			continue;
+		if (kind == URING_KIND_SEND)
+		{
+			ready.push_back({fd, EVENT_SENT, cqe.res});
+			continue;
+		}
+		unsigned int events = 0;
+		if (cqe.res < 0)
+			events = EVENT_ERROR;
+		else
+		{
+			if (cqe.res & POLLIN)
+				events |= EVENT_READ;
+			if (cqe.res & POLLOUT)
+				events |= EVENT_WRITE;
+			if (cqe.res & (POLLHUP | POLLRDHUP))
+				events |= EVENT_HANGUP;
+			if (cqe.res & POLLERR)
+				events |= EVENT_ERROR;
+		}
+		if (events)
+			ready.push_back({fd, events, 0});
+		// A multishot poll can still end (overflow, error): arm a new one
+		if (!(cqe.flags & IORING_CQE_F_MORE) && cqe.res >= 0)
+			arm_poll(fd);
+	}
+	__atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+}
+
+int UringLoop::wait(std::vector<IoEvent>& ready, int timeout_ms)
+{
+	ready.clear();
+	ready.swap(_early);
+	// Submit everything queued since the last call (poll updates, every
+	// client's writes) and wait, in one syscall. Do not block when there is
+	// already something to report
+	bool have_events = !ready.empty() || *_cq_head != __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+	__kernel_timespec timeout;
+	io_uring_getevents_arg arg;
+	std::memset(&arg, 0, sizeof(arg));
+	if (timeout_ms >= 0)
+	{
+		timeout.tv_sec = timeout_ms / 1000;
+		timeout.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+		arg.ts = reinterpret_cast<uint64_t>(&timeout);
+	}
+	unsigned to_submit = *_sq_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+	unsigned flags = IORING_ENTER_EXT_ARG | (have_events ? 0 : IORING_ENTER_GETEVENTS);
+	if (enter(to_submit, have_events ? 0 : 1, flags, &arg, sizeof(arg)) < 0)
+	{
+		if (errno == EINTR && ready.empty())
+			return -1;
+		// ETIME: the timeout expired. EBUSY: completions to reap first
+		if (errno != ETIME && errno != EINTR && errno != EBUSY && errno != EAGAIN)
+			throw std::runtime_error(std::string("io_uring_enter failed: ") + std::strerror(errno));
+	}
+	if (*_sq_tail == __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE))
+		_iov_used = 0;
+	reap(ready);
+	return static_cast<int>(ready.size());
+}
+
+// Multishot polls post a completion per wakeup, not per state: the caller
+// must read until EAGAIN exactly as with epoll's EPOLLET
+bool UringLoop::is_edge_triggered() const
+{
+	return true;
+}
+
+const char* UringLoop::name() const
+{
+	return "io_uring";
+}
+
+bool UringLoop::batches_sends() const
+{
+	return true;
+}
+
+#endif